@@ -3,178 +3,430 @@
  * @brief Driver for BME280 Temperature, Humidity and Pressure Sensor.
  *
  * Implements I2C communication and integer compensation formulas
- * provided by Bosch Sensortec.
+ * provided by Bosch Sensortec. Initialization and the blocking read use
+ * blocking TWI transfers; bme280_trigger() and bme280_collect_fixed() queue
+ * transactions and return without waiting for the bus.
  */
 
 #include <avr/io.h>
+#include <util/delay.h>
+#include <stddef.h>
 #include <twi.h>
 #include "bme280.h"
+#if BME280_BENCH
+#include <avr/interrupt.h>
+#endif
+#if BME280_CALIB_CACHE
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#endif
+
+/* --- Register Map --- */
+#define BME280_REG_CALIB_TP  0x88   /**< dig_T1 .. dig_H1 (26 bytes) */
+#define BME280_REG_CHIP_ID   0xD0
+#define BME280_REG_CALIB_H   0xE1   /**< dig_H2 .. dig_H6 (7 bytes) */
+#define BME280_REG_CTRL_HUM  0xF2
+#define BME280_REG_STATUS    0xF3
+#define BME280_REG_CTRL_MEAS 0xF4
+#define BME280_REG_DATA      0xF7   /**< press_msb .. hum_lsb (8 bytes) */
+
+/** Status register through hum_lsb (0xF3..0xFE) in one burst */
+#define BME280_FETCH_LEN     12
+#define BME280_FETCH_DATA    (BME280_REG_DATA - BME280_REG_STATUS)
+
+/* --- Status register bits --- */
+#define BME280_STATUS_MEASURING 0x08
+#define BME280_STATUS_IM_UPDATE 0x01
+
+/** Status poll interval of the blocking read [us] */
+#define BME280_POLL_US       500
+
+/** ctrl_meas value without the mode bits */
+#define BME280_CTRL_MEAS ((BME280_OSRS_T << 5) | (BME280_OSRS_P << 2))
 
 // -----------------------------------------------------------------------------
 // Calibration data (Compensation parameters)
 // -----------------------------------------------------------------------------
-static int32_t t_fine;
+// Raw calibration registers
+static bme280_calib_t cal;
+
+// Background transactions of bme280_trigger() and bme280_collect_fixed()
+static uint8_t trig_buf[2];     // ctrl_meas address and value
+static twi_xfer_t trig_xfer;
+static const uint8_t fetch_reg = BME280_REG_STATUS;
+static uint8_t fetch_buf[BME280_FETCH_LEN];
+static twi_xfer_t fetch_xfer;
+static uint8_t fetch_pending;   // fetch_xfer submitted, not yet evaluated
 
-// Temperature calibration
-static uint16_t dig_T1;
-static int16_t  dig_T2, dig_T3;
+/** Size of the temperature/pressure block 0x88..0xA1 */
+#define CALIB_TP_LEN (offsetof(bme280_calib_t, dig_H2))
+/** Size of the humidity block 0xE1..0xE7 */
+#define CALIB_H_LEN  (sizeof(bme280_calib_t) - CALIB_TP_LEN)
 
-// Pressure calibration
-static uint16_t dig_P1;
-static int16_t  dig_P2, dig_P3, dig_P4, dig_P5, dig_P6, dig_P7, dig_P8, dig_P9;
+#if BME280_CALIB_CACHE
+/** @brief EEPROM image of the calibration. */
+typedef struct {
+    uint8_t chip_id;        /**< Chip ID the calibration was read from */
+    bme280_calib_t cal;     /**< Calibration registers */
+    uint16_t crc;           /**< CRC-16/CCITT of chip_id and cal */
+} bme280_calib_cache_t;
 
-// Humidity calibration
-static uint8_t  dig_H1, dig_H3;
-static int16_t  dig_H2, dig_H4, dig_H5;
-static int8_t   dig_H6;
+static bme280_calib_cache_t EEMEM ee_calib;
+#endif
 
 // -----------------------------------------------------------------------------
 // Low-level register access
 // -----------------------------------------------------------------------------
 
+/**
+ * @brief Reads consecutive registers in one transaction (auto-increment).
+ * @param reg Starting register address.
+ * @param buf Destination buffer.
+ * @param len Number of bytes, at least 1.
+ * @return TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT.
+ */
+static uint8_t bme280_reg_read_burst(uint8_t reg, uint8_t *buf, uint8_t len)
+{
+    twi_xfer_t x;
+
+    x.addr = BME280_I2C_ADDR;
+    x.wbuf = &reg;
+    x.wlen = 1;
+    x.rbuf = buf;
+    x.rlen = len;   // repeated start between register and data
+    x.done = NULL;
+    return twi_transfer(&x);
+}
+
 /**
  * @brief Reads an 8-bit value from a specific register.
  * @param reg Register address.
- * @return Value read from the register.
+ * @param[out] val Value read from the register (0 if the read failed).
+ * @return TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT.
  */
-static uint8_t bme280_reg_read8(uint8_t reg)
+static uint8_t bme280_reg_read8(uint8_t reg, uint8_t *val)
 {
-    uint8_t val;
-    twi_start();
-    twi_write((BME280_I2C_ADDR << 1) | TWI_WRITE);
-    twi_write(reg);
-    twi_start(); // repeated start
-    twi_write((BME280_I2C_ADDR << 1) | TWI_READ);
-    val = twi_read(TWI_NACK);
-    twi_stop();
-    return val;
+    *val = 0;
+    return bme280_reg_read_burst(reg, val, 1);
 }
 
 /**
- * @brief Reads a 16-bit value (Little Endian) from two consecutive registers.
- * @param reg Starting register address.
- * @return 16-bit unsigned value.
+ * @brief Writes an 8-bit value to a specific register.
+ * @param reg Register address.
+ * @param val Value to write.
+ * @return TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT.
+ */
+static uint8_t bme280_reg_write8(uint8_t reg, uint8_t val)
+{
+    uint8_t buf[2] = { reg, val };
+    twi_xfer_t x;
+
+    x.addr = BME280_I2C_ADDR;
+    x.wbuf = buf;
+    x.wlen = 2;
+    x.rlen = 0;
+    x.done = NULL;
+    return twi_transfer(&x);
+}
+
+// -----------------------------------------------------------------------------
+// Calibration cache
+// -----------------------------------------------------------------------------
+#if BME280_CALIB_CACHE
+/** @brief CRC of a cache image without its CRC field. */
+static uint16_t bme280_calib_crc(const bme280_calib_cache_t *c)
+{
+    const uint8_t *p = (const uint8_t *)c;
+    uint16_t crc = 0xFFFF;
+
+    for (uint8_t i = 0; i < offsetof(bme280_calib_cache_t, crc); i++)
+        crc = _crc_ccitt_update(crc, p[i]);
+    return crc;
+}
+#endif
+
+/**
+ * @brief Load the calibration from EEPROM.
+ * @param chip_id Chip ID reported by the sensor.
+ * @return 1 if a valid cache for this chip ID was loaded, 0 otherwise.
  */
-static uint16_t bme280_reg_read16(uint8_t reg)
+static uint8_t bme280_calib_load(uint8_t chip_id)
 {
-    uint8_t lsb, msb;
-    lsb = bme280_reg_read8(reg);
-    msb = bme280_reg_read8(reg + 1);
-    return (uint16_t)((msb << 8) | lsb);
+#if BME280_CALIB_CACHE
+    bme280_calib_cache_t c;
+
+    eeprom_read_block(&c, &ee_calib, sizeof(c));
+    if (chip_id != BME280_CHIP_ID || c.chip_id != chip_id || c.crc != bme280_calib_crc(&c))
+        return 0;
+    cal = c.cal;
+    return 1;
+#else
+    (void)chip_id;
+    return 0;
+#endif
 }
 
-static int16_t bme280_reg_readS16(uint8_t reg)
+/**
+ * @brief Save the calibration to EEPROM (only changed bytes are written).
+ * @param chip_id Chip ID reported by the sensor.
+ */
+static void bme280_calib_store(uint8_t chip_id)
 {
-    return (int16_t)bme280_reg_read16(reg);
+#if BME280_CALIB_CACHE
+    bme280_calib_cache_t c;
+
+    // Do not cache data from a missing or foreign device
+    if (chip_id != BME280_CHIP_ID) return;
+    c.chip_id = chip_id;
+    c.cal = cal;
+    c.crc = bme280_calib_crc(&c);
+    eeprom_update_block(&c, &ee_calib, sizeof(c));
+#else
+    (void)chip_id;
+#endif
+}
+
+void bme280_calib_clear(void)
+{
+#if BME280_CALIB_CACHE
+    eeprom_update_byte(&ee_calib.chip_id, 0xFF);
+#endif
 }
 
 // -----------------------------------------------------------------------------
 // Initialization
 // -----------------------------------------------------------------------------
-void bme280_init(void)
-{
-    // --- Read Trimming Parameters ---
-    // Temperature calibration 0x88..0x8D
-    dig_T1 = bme280_reg_read16(0x88);
-    dig_T2 = bme280_reg_readS16(0x8A);
-    dig_T3 = bme280_reg_readS16(0x8C);
-
-    // Pressure calibration 0x8E..0x9F
-    dig_P1 = bme280_reg_read16(0x8E);
-    dig_P2 = bme280_reg_readS16(0x90);
-    dig_P3 = bme280_reg_readS16(0x92);
-    dig_P4 = bme280_reg_readS16(0x94);
-    dig_P5 = bme280_reg_readS16(0x96);
-    dig_P6 = bme280_reg_readS16(0x98);
-    dig_P7 = bme280_reg_readS16(0x9A);
-    dig_P8 = bme280_reg_readS16(0x9C);
-    dig_P9 = bme280_reg_readS16(0x9E);
-
-    // Humidity calibration
-    dig_H1 = bme280_reg_read8(0xA1);
-    dig_H2 = bme280_reg_readS16(0xE1);
-    dig_H3 = bme280_reg_read8(0xE3);
-
-    uint8_t e4 = bme280_reg_read8(0xE4);
-    uint8_t e5 = bme280_reg_read8(0xE5);
-    uint8_t e6 = bme280_reg_read8(0xE6);
-
-    dig_H4 = (int16_t)((e4 << 4) | (e5 & 0x0F));
-    dig_H5 = (int16_t)((e6 << 4) | (e5 >> 4));
-    dig_H6 = (int8_t)bme280_reg_read8(0xE7);
+uint8_t bme280_init(void)
+{
+    uint8_t chip_id;
+    uint8_t res;
+
+    twi_set_speed(BME280_I2C_ADDR, BME280_SCL_HZ);
+
+    // --- Load Trimming Parameters ---
+    res = bme280_reg_read8(BME280_REG_CHIP_ID, &chip_id);
+    if (res != TWI_OK) return res;
+
+    if (!bme280_calib_load(chip_id)) {
+        res = bme280_reg_read_burst(BME280_REG_CALIB_TP, (uint8_t *)&cal, CALIB_TP_LEN);
+        if (res == TWI_OK)
+            res = bme280_reg_read_burst(BME280_REG_CALIB_H, (uint8_t *)&cal + CALIB_TP_LEN, CALIB_H_LEN);
+        if (res != TWI_OK) return res;      // Never cache a partial read
+        bme280_calib_store(chip_id);
+    }
 
     // --- Configure Sensor Settings ---
-    twi_start();
-    twi_write((BME280_I2C_ADDR << 1) | TWI_WRITE);
-    twi_write(0xF2); // ctrl_hum
-    twi_write(0x01); // Humidity oversampling x1
-    twi_stop();
+    // ctrl_hum only takes effect after the following ctrl_meas write
+    res = bme280_reg_write8(BME280_REG_CTRL_HUM, BME280_OSRS_H);
+    if (res != TWI_OK) return res;
+#if BME280_MODE == BME280_MODE_FORCED
+    return bme280_reg_write8(BME280_REG_CTRL_MEAS, BME280_CTRL_MEAS); // Sleep until triggered
+#else
+    return bme280_reg_write8(BME280_REG_CTRL_MEAS, BME280_CTRL_MEAS | BME280_MODE_NORMAL);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// Conversion control
+// -----------------------------------------------------------------------------
+
+/**
+ * @brief Time of one measurement with the given oversampling code [us].
+ * @param osrs Oversampling register code (0 = skipped).
+ * @param extra Fixed overhead of the measurement [us].
+ */
+static uint32_t bme280_meas_us(uint8_t osrs, uint16_t extra)
+{
+    if (osrs == 0) return 0;
+    if (osrs > 5) osrs = 5;
+    return 2300UL * (1U << (osrs - 1)) + extra;    // x16: 36800 us
+}
 
-    twi_start();
-    twi_write((BME280_I2C_ADDR << 1) | TWI_WRITE);
-    twi_write(0xF4); // ctrl_meas
-    twi_write(0x27); // Temp x1, Pressure x1, Mode Normal
-    twi_stop();
+uint32_t bme280_conversion_us(void)
+{
+    return 1250UL + bme280_meas_us(BME280_OSRS_T, 0)
+                 + bme280_meas_us(BME280_OSRS_P, 575)
+                 + bme280_meas_us(BME280_OSRS_H, 575);
+}
+
+uint32_t bme280_trigger(void)
+{
+#if BME280_MODE == BME280_MODE_FORCED
+    // The previous trigger write must be off the descriptor, and a result
+    // fetch still outstanding belongs to the previous conversion
+    twi_wait(&trig_xfer);
+    if (fetch_pending) {
+        twi_wait(&fetch_xfer);
+        fetch_pending = 0;
+    }
+    trig_buf[0] = BME280_REG_CTRL_MEAS;
+    trig_buf[1] = BME280_CTRL_MEAS | BME280_MODE_FORCED;
+    trig_xfer.addr = BME280_I2C_ADDR;
+    trig_xfer.wbuf = trig_buf;
+    trig_xfer.wlen = 2;
+    trig_xfer.rlen = 0;
+    trig_xfer.done = NULL;
+    if (twi_submit(&trig_xfer) != 0)
+        twi_transfer(&trig_xfer);   // Queue full: wait for a slot
+    return bme280_conversion_us();
+#else
+    return 0;
+#endif
+}
+
+uint8_t bme280_ready(void)
+{
+    uint8_t status;
+
+    if (bme280_reg_read8(BME280_REG_STATUS, &status) != TWI_OK) return 0;
+    return (status & (BME280_STATUS_MEASURING | BME280_STATUS_IM_UPDATE)) == 0;
 }
 
 // -----------------------------------------------------------------------------
 // Read sensor and apply compensation
 // -----------------------------------------------------------------------------
-void bme280_read(float *temperature, float *pressure, float *humidity)
+
+/** @brief Compensation selected by BME280_COMP. */
+#if BME280_COMP == BME280_COMP_INT32
+#define bme280_compensate bme280_compensate_int32
+#else
+#define bme280_compensate bme280_compensate_int64
+#endif
+
+/**
+ * @brief Construct the raw values from the data registers.
+ * @param data Registers 0xF7..0xFE.
+ * @param[out] raw Raw ADC values.
+ */
+static void bme280_parse_raw(const uint8_t *data, bme280_raw_t *raw)
+{
+    raw->adc_P = ((int32_t)data[0] << 12) | ((int32_t)data[1] << 4) | (data[2] >> 4);
+    raw->adc_T = ((int32_t)data[3] << 12) | ((int32_t)data[4] << 4) | (data[5] >> 4);
+    raw->adc_H = ((int32_t)data[6] << 8) | data[7];
+}
+
+/**
+ * @brief Burst read of the data registers.
+ * @param[out] raw Raw ADC values.
+ * @return TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT.
+ */
+static uint8_t bme280_read_raw(bme280_raw_t *raw)
 {
     uint8_t data[8];
+    uint8_t res;
 
     // Burst read 0xF7..0xFE (pressure, temp, humidity)
-    twi_start();
-    twi_write((BME280_I2C_ADDR << 1) | TWI_WRITE);
-    twi_write(0xF7);
-    twi_start();
-    twi_write((BME280_I2C_ADDR << 1) | TWI_READ);
-
-    for (uint8_t i = 0; i < 7; i++)
-        data[i] = (i == 6) ? twi_read(TWI_NACK) : twi_read(TWI_ACK);
-
-    twi_stop();
-
-    // Construct raw values
-    uint32_t raw_p = ((uint32_t)data[0] << 12) | ((uint32_t)data[1] << 4) | (data[2] >> 4);
-    uint32_t raw_t = ((uint32_t)data[3] << 12) | ((uint32_t)data[4] << 4) | (data[5] >> 4);
-    uint32_t raw_h = ((uint32_t)data[6] << 8) | data[7];
-
-    // ----- Temperature compensation -----
-    int32_t var1 = ((((int32_t)raw_t >> 3) - ((int32_t)dig_T1 << 1)) * (int32_t)dig_T2) >> 11;
-    int32_t var2 = (((((int32_t)raw_t >> 4) - (int32_t)dig_T1) * (((int32_t)raw_t >> 4) - (int32_t)dig_T1)) >> 12) * (int32_t)dig_T3 >> 14;
-    t_fine = var1 + var2;
-    int32_t T = (t_fine * 5 + 128) >> 8;
-    *temperature = T / 100.0f;
-
-    // ----- Pressure compensation -----
-    int64_t varP1 = (int64_t)t_fine - 128000;
-    int64_t varP2 = varP1 * varP1 * (int64_t)dig_P6;
-    varP2 += ((varP1 * (int64_t)dig_P5) << 17);
-    varP2 += ((int64_t)dig_P4 << 35);
-    varP1 = ((varP1 * varP1 * (int64_t)dig_P3) >> 8) + ((varP1 * (int64_t)dig_P2) << 12);
-    varP1 = ((((int64_t)1 << 47) + varP1) * (int64_t)dig_P1) >> 33;
-
-    int64_t p;
-    if (varP1 == 0)
-        p = 0;
-    else
-    {
-        p = 1048576 - raw_p;
-        p = (((p << 31) - varP2) * 3125) / varP1;
-        varP1 = ((int64_t)dig_P9 * (p >> 13) * (p >> 13)) >> 25;
-        varP2 = ((int64_t)dig_P8 * p) >> 19;
-        p = ((p + varP1 + varP2) >> 8) + ((int64_t)dig_P7 << 4);
+    res = bme280_reg_read_burst(BME280_REG_DATA, data, 8);
+    if (res == TWI_OK) bme280_parse_raw(data, raw);
+    return res;
+}
+
+/** @brief Convert a fixed-point result to the float units of the API. */
+static void bme280_to_float(const bme280_data_t *d, float *temperature, float *pressure, float *humidity)
+{
+    *temperature = d->temperature / 100.0f;
+    *pressure = d->pressure / 100.0f;          // Pa -> hPa
+    *humidity = d->humidity / 1024.0f;
+}
+
+uint8_t bme280_collect_fixed(bme280_data_t *data)
+{
+    bme280_raw_t raw;
+
+    if (!fetch_pending) {
+        // Status and data registers in one background burst
+        fetch_xfer.addr = BME280_I2C_ADDR;
+        fetch_xfer.wbuf = &fetch_reg;
+        fetch_xfer.wlen = 1;
+        fetch_xfer.rbuf = fetch_buf;
+        fetch_xfer.rlen = BME280_FETCH_LEN;
+        fetch_xfer.done = NULL;
+        if (twi_submit(&fetch_xfer) == 0)
+            fetch_pending = 1;
+        return 1;
+    }
+    if (fetch_xfer.status == TWI_BUSY) return 1;
+
+    fetch_pending = 0;
+    if (fetch_xfer.status != TWI_OK ||
+        (fetch_buf[0] & (BME280_STATUS_MEASURING | BME280_STATUS_IM_UPDATE))) {
+        return 1;   // Not finished: the next call reads again
     }
-    *pressure = (float)p / 25600.0f; // hPa
-
-    // ----- Humidity compensation -----
-    int32_t v_x1 = t_fine - 76800;
-    v_x1 = (((((raw_h << 14) - ((int32_t)dig_H4 << 20) - ((int32_t)dig_H5 * v_x1)) + 16384) >> 15) *
-           (((((((v_x1 * (int32_t)dig_H6) >> 10) * (((v_x1 * (int32_t)dig_H3) >> 11) + 32768)) >> 10) + 2097152) * dig_H2 + 8192) >> 14));
-    v_x1 = v_x1 - (((((v_x1 >> 15) * (v_x1 >> 15)) >> 7) * dig_H1) >> 4);
-    if (v_x1 < 0) v_x1 = 0;
-    if (v_x1 > 419430400) v_x1 = 419430400;
-    *humidity = (float)(v_x1 >> 12) / 1024.0f;
-}
\ No newline at end of file
+    bme280_parse_raw(&fetch_buf[BME280_FETCH_DATA], &raw);
+    bme280_compensate(&cal, &raw, data);
+    return 0;
+}
+
+uint8_t bme280_read_fixed(bme280_data_t *data)
+{
+    bme280_raw_t raw;
+
+#if BME280_MODE == BME280_MODE_FORCED
+    // Measuring bit is set until the result registers are updated; a sensor
+    // that never clears it (or is missing) fails after the longest conversion
+    uint32_t limit = bme280_trigger() + BME280_WAIT_MARGIN_US;
+    uint32_t waited = 0;
+    while (!bme280_ready()) {
+        if (waited >= limit) return 1;
+        _delay_us(BME280_POLL_US);
+        waited += BME280_POLL_US;
+    }
+#endif
+    if (bme280_read_raw(&raw) != TWI_OK) return 1;
+    bme280_compensate(&cal, &raw, data);
+    return 0;
+}
+
+uint8_t bme280_collect(float *temperature, float *pressure, float *humidity)
+{
+    bme280_data_t d;
+
+    if (bme280_collect_fixed(&d)) return 1;
+
+    bme280_to_float(&d, temperature, pressure, humidity);
+    return 0;
+}
+
+uint8_t bme280_read(float *temperature, float *pressure, float *humidity)
+{
+    bme280_data_t d;
+
+    if (bme280_read_fixed(&d)) return 1;
+    bme280_to_float(&d, temperature, pressure, humidity);
+    return 0;
+}
+
+#if BME280_BENCH
+void bme280_bench(bme280_bench_t *r)
+{
+    // Mid-range raw values (about 25 °C, 1000 hPa, 50 %RH)
+    const bme280_raw_t raw = { 415148L, 519888L, 28000L };
+    bme280_data_t d;
+    float t, p, h;
+    uint8_t sreg = SREG;
+    uint8_t tccr1a = TCCR1A, tccr1b = TCCR1B;
+
+    cli();
+    TCCR1A = 0;
+    TCCR1B = (1 << CS10);           // Count CPU cycles
+
+    TCNT1 = 0;
+    bme280_compensate_int64(&cal, &raw, &d);
+    r->comp_int64 = TCNT1;
+
+    TCNT1 = 0;
+    bme280_to_float(&d, &t, &p, &h);
+    r->to_float = TCNT1;
+
+    TCNT1 = 0;
+    bme280_compensate_int32(&cal, &raw, &d);
+    r->comp_int32 = TCNT1;
+
+    TCCR1B = tccr1b;
+    TCCR1A = tccr1a;
+    SREG = sreg;
+
+    // Keep the conversion from being optimized away
+    r->pressure = (uint32_t)p;
+}
+#endif
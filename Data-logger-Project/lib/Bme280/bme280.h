@@ -3,7 +3,8 @@
  * @brief Driver interface for BME280 Environmental Sensor.
  *
  * Provides functions to initialize the sensor and read compensated data.
- * Communication is handled via I2C (TWI).
+ * Communication is handled via I2C (TWI). The compensation formulas are in
+ * bme280_comp.c and have no hardware dependencies.
  * @defgroup drivers Sensor Drivers
  * @brief Hardware abstraction layer for external sensors.
  * @{
@@ -21,27 +22,275 @@
  */
 #define BME280_I2C_ADDR 0x76
 
+/** @brief Highest I2C clock used for the sensor [Hz] (Fast-mode). */
+#ifndef BME280_SCL_HZ
+#define BME280_SCL_HZ 400000
+#endif
+
+/** @brief Value of the chip-ID register (0xD0) of a BME280. */
+#define BME280_CHIP_ID 0x60
+
+/**
+ * @brief Keep a copy of the calibration data in EEPROM.
+ *
+ * 1 = a warm boot loads the calibration from EEPROM when the chip ID and
+ * the CRC match, so only the chip ID is read over I2C.
+ * 0 = always read the calibration from the sensor.
+ */
+#ifndef BME280_CALIB_CACHE
+#define BME280_CALIB_CACHE 1
+#endif
+
+/**
+ * @brief Factory calibration (trimming) parameters.
+ *
+ * Same layout as the sensor registers 0x88..0xA1 and 0xE1..0xE7
+ * (little-endian), so each block is filled by a single burst read.
+ * dig_H4 and dig_H5 are 12-bit values packed into e4..e6.
+ */
+typedef struct __attribute__((packed)) {
+    /* 0x88..0xA1 */
+    uint16_t dig_T1;
+    int16_t  dig_T2, dig_T3;
+    uint16_t dig_P1;
+    int16_t  dig_P2, dig_P3, dig_P4, dig_P5, dig_P6, dig_P7, dig_P8, dig_P9;
+    uint8_t  reserved;  /**< Register 0xA0 */
+    uint8_t  dig_H1;
+    /* 0xE1..0xE7 */
+    int16_t  dig_H2;
+    uint8_t  dig_H3;
+    uint8_t  e4, e5, e6; /**< dig_H4 = e4:e5[3:0], dig_H5 = e6:e5[7:4] */
+    int8_t   dig_H6;
+} bme280_calib_t;
+
+/**
+ * @name Sensor Modes
+ * @{
+ */
+#define BME280_MODE_FORCED 1    /**< One conversion per bme280_trigger(), sleep otherwise */
+#define BME280_MODE_NORMAL 3    /**< Continuous conversions */
+/** @} */
+
+/**
+ * @brief Operating mode (BME280_MODE_FORCED or BME280_MODE_NORMAL).
+ *
+ * In forced mode the sensor only converts when triggered and draws sleep
+ * current between samples.
+ */
+#ifndef BME280_MODE
+#define BME280_MODE BME280_MODE_FORCED
+#endif
+
+/**
+ * @name Oversampling Settings
+ * Register codes: 0 = measurement skipped, 1 = x1, 2 = x2, 3 = x4, 4 = x8, 5 = x16.
+ * @{
+ */
+#ifndef BME280_OSRS_T
+#define BME280_OSRS_T 1     /**< Temperature oversampling */
+#endif
+#ifndef BME280_OSRS_P
+#define BME280_OSRS_P 1     /**< Pressure oversampling */
+#endif
+#ifndef BME280_OSRS_H
+#define BME280_OSRS_H 1     /**< Humidity oversampling */
+#endif
+/** @} */
+
+/**
+ * @brief Time a blocking read waits beyond the maximum conversion time
+ * before it gives up [us].
+ */
+#ifndef BME280_WAIT_MARGIN_US
+#define BME280_WAIT_MARGIN_US 10000
+#endif
+
+/**
+ * @name Compensation Builds
+ * @{
+ */
+#define BME280_COMP_INT64 0     /**< Bosch 64-bit pressure formula (reference) */
+#define BME280_COMP_INT32 1     /**< Bosch 32-bit pressure formula, no int64 math */
+/** @} */
+
+/**
+ * @brief Compensation used by the read functions.
+ *
+ * The 32-bit pressure formula avoids the 64-bit multiplies and division.
+ * It differs from the 64-bit one by about 1 Pa on average and at most a
+ * few Pa, well below the sensor's relative accuracy of +-12 Pa
+ * (see tools/bme280acc).
+ */
+#ifndef BME280_COMP
+#define BME280_COMP BME280_COMP_INT32
+#endif
+
+/** @brief Raw ADC values of one conversion. */
+typedef struct {
+    int32_t adc_P;      /**< Pressure (20 bit) */
+    int32_t adc_T;      /**< Temperature (20 bit) */
+    int32_t adc_H;      /**< Humidity (16 bit) */
+} bme280_raw_t;
+
+/** @brief Compensated measurement in fixed-point units. */
+typedef struct {
+    int32_t  temperature;   /**< Temperature [0.01 °C] */
+    uint32_t pressure;      /**< Pressure [Pa] */
+    uint32_t humidity;      /**< Humidity [1/1024 %RH] */
+} bme280_data_t;
+
+/**
+ * @brief Compensate with the Bosch 64-bit pressure formula.
+ *
+ * The pressure is rounded from the Q24.8 result to whole Pa.
+ * @param cal Calibration parameters.
+ * @param raw Raw ADC values.
+ * @param out Returns the compensated values.
+ */
+void bme280_compensate_int64(const bme280_calib_t *cal, const bme280_raw_t *raw, bme280_data_t *out);
+
+/**
+ * @brief Compensate with the Bosch 32-bit pressure formula.
+ * @param cal Calibration parameters.
+ * @param raw Raw ADC values.
+ * @param out Returns the compensated values.
+ */
+void bme280_compensate_int32(const bme280_calib_t *cal, const bme280_raw_t *raw, bme280_data_t *out);
+
 /**
  * @brief Initialize the BME280 sensor.
  *
  * Performs the following:
- * - Reads factory calibration parameters from the sensor's ROM.
+ * - Loads factory calibration parameters from the EEPROM cache or, if it is
+ *   missing or belongs to another chip ID, with two burst reads from the
+ *   sensor's ROM (and refreshes the cache).
  * - Configures oversampling settings for Humidity, Temperature, and Pressure.
- * - Sets the sensor mode to Normal.
+ * - Sets the sensor mode to Sleep (forced mode) or Normal.
+ *
+ * Stops at the first failed transfer; a partial calibration read is not
+ * cached.
+ *
+ * @return TWI_OK (0) on success, otherwise the failing TWI status
+ *         (TWI_NACK e.g. for a missing sensor, TWI_ERROR, TWI_TIMEOUT).
+ */
+uint8_t bme280_init(void);
+
+/**
+ * @brief  Invalidate the EEPROM calibration cache.
+ *
+ * The next bme280_init() reads the calibration from the sensor. Needed
+ * after replacing the sensor, since the cache is only keyed by chip ID.
+ */
+void bme280_calib_clear(void);
+
+/**
+ * @brief  Maximum conversion time for the configured oversampling.
+ *
+ * Datasheet formula: 1.25 ms + 2.3 ms * T + (2.3 ms * P + 0.575 ms)
+ * + (2.3 ms * H + 0.575 ms), where T, P, H are the oversampling ratios
+ * and skipped measurements do not count.
+ *
+ * @return Conversion time [us], up to 112800 us with all three at x16.
+ */
+uint32_t bme280_conversion_us(void);
+
+/**
+ * @brief  Start one conversion (forced mode).
+ *
+ * Queues the ctrl_meas write on the TWI bus and returns immediately.
+ * Collect the result with bme280_collect() once the returned time has
+ * passed. In normal mode nothing is sent and 0 is returned.
+ *
+ * @return Expected conversion time [us].
  */
-void bme280_init(void);
+uint32_t bme280_trigger(void);
 
 /**
- * @brief Read and compensate sensor data.
+ * @brief  Check the status register (0xF3) for a finished conversion.
+ * @return 1 if no conversion or NVM copy is running, 0 otherwise or if the
+ *         register could not be read.
+ */
+uint8_t bme280_ready(void);
+
+/**
+ * @brief  Read and compensate the result of the last conversion (integer units).
+ *
+ * Non-blocking. A call queues a background read of the status and data
+ * registers (0xF3..0xFE) and returns 1; a later call evaluates it. The
+ * output is only written if the status showed the conversion finished,
+ * otherwise the next call reads again. Poll it until it returns 0. A failed
+ * read also returns 1, so the caller bounds the polling (the sampler drops
+ * the sample one conversion time after it was due).
  *
- * Reads raw ADC values from the sensor and applies the Bosch compensation formulas
- * using the stored calibration parameters.
+ * @param[out] data Compensated values.
+ * @return 0 if new data was read, 1 if the conversion is not finished yet
+ *         or the read failed.
+ */
+uint8_t bme280_collect_fixed(bme280_data_t *data);
+
+/**
+ * @brief  Read and compensate sensor data in integer units (blocking).
+ *
+ * In forced mode waits at most bme280_conversion_us() plus
+ * BME280_WAIT_MARGIN_US for the conversion.
+ *
+ * @param[out] data Compensated values.
+ * @return 0 on success, 1 if the conversion did not finish in time or a
+ *         read failed.
+ */
+uint8_t bme280_read_fixed(bme280_data_t *data);
+
+/**
+ * @brief  Read and compensate the result of the last conversion.
+ *
+ * Non-blocking, same protocol as bme280_collect_fixed().
  *
  * @param[out] temperature Pointer to float variable for Temperature [°C].
  * @param[out] pressure    Pointer to float variable for Pressure [hPa].
  * @param[out] humidity    Pointer to float variable for Humidity [%RH].
+ * @return 0 if new data was read, 1 if the conversion is not finished yet.
+ */
+uint8_t bme280_collect(float *temperature, float *pressure, float *humidity);
+
+/**
+ * @brief Read and compensate sensor data (blocking).
+ *
+ * In forced mode triggers a conversion and polls the status register until
+ * it is finished (bounded like bme280_read_fixed()). Reads raw ADC values
+ * from the sensor and applies the Bosch compensation formulas using the
+ * stored calibration parameters.
+ *
+ * @param[out] temperature Pointer to float variable for Temperature [°C].
+ * @param[out] pressure    Pointer to float variable for Pressure [hPa].
+ * @param[out] humidity    Pointer to float variable for Humidity [%RH].
+ * @return 0 on success, 1 if the conversion did not finish in time or a
+ *         read failed.
+ */
+uint8_t bme280_read(float *temperature, float *pressure, float *humidity);
+
+/**
+ * @brief Build the compensation benchmark (bme280_bench()).
+ * Enable with -DBME280_BENCH=1 in build_flags.
+ */
+#ifndef BME280_BENCH
+#define BME280_BENCH 0
+#endif
+
+#if BME280_BENCH
+/** @brief CPU cycles of one compensation. */
+typedef struct {
+    uint16_t comp_int64;    /**< bme280_compensate_int64() */
+    uint16_t to_float;      /**< Conversion of the result to float */
+    uint16_t comp_int32;    /**< bme280_compensate_int32() */
+    uint32_t pressure;      /**< Result sink (keeps the float path alive) */
+} bme280_bench_t;
+
+/**
+ * @brief  Time both compensation builds with Timer1 using the loaded calibration.
+ * @param  r Returns the cycle counts.
  */
-void bme280_read(float *temperature, float *pressure, float *humidity);
+void bme280_bench(bme280_bench_t *r);
+#endif
 
 #endif // BME280_H
 
@@ -0,0 +1,105 @@
+/**
+ * @file bme280_comp.c
+ * @brief BME280 compensation formulas (Bosch Sensortec integer reference code).
+ *
+ * Pure C without hardware access, so the same code is linked into the
+ * firmware and into the host accuracy tool (tools/bme280acc). Integer
+ * constants are written as int32_t explicitly because int is 16 bits wide
+ * on AVR.
+ */
+
+#include "bme280.h"
+
+/**
+ * @brief Temperature compensation (shared by both builds).
+ * @param cal   Calibration parameters.
+ * @param adc_T Raw temperature.
+ * @param t     Returns the temperature [0.01 °C].
+ * @return t_fine, the fine temperature used by the P and H formulas.
+ */
+static int32_t comp_temperature(const bme280_calib_t *cal, int32_t adc_T, int32_t *t)
+{
+    int32_t var1 = (((adc_T >> 3) - ((int32_t)cal->dig_T1 << 1)) * (int32_t)cal->dig_T2) >> 11;
+    int32_t var2 = (((((adc_T >> 4) - (int32_t)cal->dig_T1) * ((adc_T >> 4) - (int32_t)cal->dig_T1)) >> 12) *
+                    (int32_t)cal->dig_T3) >> 14;
+    int32_t t_fine = var1 + var2;
+
+    *t = (t_fine * 5 + 128) >> 8;
+    return t_fine;
+}
+
+/**
+ * @brief Humidity compensation (32-bit, shared by both builds).
+ * @return Humidity [1/1024 %RH].
+ */
+static uint32_t comp_humidity(const bme280_calib_t *cal, int32_t adc_H, int32_t t_fine)
+{
+    // dig_H4/dig_H5 are 12-bit values packed into 0xE4..0xE6
+    int32_t dig_H4 = ((int32_t)(int8_t)cal->e4 << 4) | (cal->e5 & 0x0F);
+    int32_t dig_H5 = ((int32_t)(int8_t)cal->e6 << 4) | (cal->e5 >> 4);
+
+    int32_t v_x1 = t_fine - (int32_t)76800;
+    v_x1 = (((((adc_H << 14) - (dig_H4 << 20) - (dig_H5 * v_x1)) + (int32_t)16384) >> 15) *
+           (((((((v_x1 * (int32_t)cal->dig_H6) >> 10) *
+                (((v_x1 * (int32_t)cal->dig_H3) >> 11) + (int32_t)32768)) >> 10) +
+              (int32_t)2097152) * (int32_t)cal->dig_H2 + 8192) >> 14));
+    v_x1 = v_x1 - (((((v_x1 >> 15) * (v_x1 >> 15)) >> 7) * (int32_t)cal->dig_H1) >> 4);
+    if (v_x1 < 0) v_x1 = 0;
+    if (v_x1 > (int32_t)419430400) v_x1 = (int32_t)419430400;
+    return (uint32_t)(v_x1 >> 12);
+}
+
+void bme280_compensate_int64(const bme280_calib_t *cal, const bme280_raw_t *raw, bme280_data_t *out)
+{
+    int32_t t_fine = comp_temperature(cal, raw->adc_T, &out->temperature);
+
+    // ----- Pressure compensation (Q24.8 Pa) -----
+    int64_t var1 = (int64_t)t_fine - 128000;
+    int64_t var2 = var1 * var1 * (int64_t)cal->dig_P6;
+    var2 += ((var1 * (int64_t)cal->dig_P5) << 17);
+    var2 += ((int64_t)cal->dig_P4 << 35);
+    var1 = ((var1 * var1 * (int64_t)cal->dig_P3) >> 8) + ((var1 * (int64_t)cal->dig_P2) << 12);
+    var1 = ((((int64_t)1 << 47) + var1) * (int64_t)cal->dig_P1) >> 33;
+
+    if (var1 == 0) {
+        out->pressure = 0;      // Avoid division by zero
+    } else {
+        int64_t p = 1048576 - raw->adc_P;
+        p = (((p << 31) - var2) * 3125) / var1;
+        var1 = ((int64_t)cal->dig_P9 * (p >> 13) * (p >> 13)) >> 25;
+        var2 = ((int64_t)cal->dig_P8 * p) >> 19;
+        p = ((p + var1 + var2) >> 8) + ((int64_t)cal->dig_P7 << 4);
+        out->pressure = (uint32_t)((p + 128) >> 8);    // Q24.8 -> Pa
+    }
+
+    out->humidity = comp_humidity(cal, raw->adc_H, t_fine);
+}
+
+void bme280_compensate_int32(const bme280_calib_t *cal, const bme280_raw_t *raw, bme280_data_t *out)
+{
+    int32_t t_fine = comp_temperature(cal, raw->adc_T, &out->temperature);
+
+    // ----- Pressure compensation (Pa) -----
+    int32_t var1 = (t_fine >> 1) - (int32_t)64000;
+    int32_t var2 = (((var1 >> 2) * (var1 >> 2)) >> 11) * (int32_t)cal->dig_P6;
+    var2 = var2 + ((var1 * (int32_t)cal->dig_P5) << 1);
+    var2 = (var2 >> 2) + ((int32_t)cal->dig_P4 << 16);
+    var1 = ((((int32_t)cal->dig_P3 * (((var1 >> 2) * (var1 >> 2)) >> 13)) >> 3) +
+            (((int32_t)cal->dig_P2 * var1) >> 1)) >> 18;
+    var1 = (((int32_t)32768 + var1) * (int32_t)cal->dig_P1) >> 15;
+
+    if (var1 == 0) {
+        out->pressure = 0;      // Avoid division by zero
+    } else {
+        uint32_t p = ((uint32_t)((int32_t)1048576 - raw->adc_P) - (uint32_t)(var2 >> 12)) * 3125;
+        if (p < 0x80000000UL)
+            p = (p << 1) / (uint32_t)var1;
+        else
+            p = (p / (uint32_t)var1) * 2;
+        var1 = ((int32_t)cal->dig_P9 * (int32_t)(((p >> 3) * (p >> 3)) >> 13)) >> 12;
+        var2 = ((int32_t)(p >> 2) * (int32_t)cal->dig_P8) >> 13;
+        out->pressure = (uint32_t)((int32_t)p + ((var1 + var2 + (int32_t)cal->dig_P7) >> 4));
+    }
+
+    out->humidity = comp_humidity(cal, raw->adc_H, t_fine);
+}
@@ -3,9 +3,19 @@
  * @brief I2C LCD Driver using PCF8574.
  *
  * Implements initialization and control of HD44780-based LCDs via I2C backpack.
+ *
+ * Initialization is blocking. After it, lcd_i2c_gotoxy(), lcd_i2c_putc(),
+ * lcd_i2c_puts() and lcd_i2c_clrscr() only write into a shadow copy of the
+ * display and mark the characters that changed. The changed characters are
+ * sent by queued TWI transactions in the background: each transaction
+ * holds an optional cursor command and a run of up to LCD_REFRESH_CHARS
+ * consecutive changed characters, and its completion callback queues the
+ * next one until the display matches the shadow.
  */
 
 #include "lcd_i2c.h"
+#include <stddef.h>
+#include <avr/interrupt.h>
 #include "../twi/twi.h"
 
 /* PCF8574 Pin Definitions */
@@ -18,16 +28,41 @@
 /** Global variable to store current backlight state (ON/OFF) */
 uint8_t _backlight_val = LCD_BL_BIT;
 
+#if LCD_ROWS * LCD_COLS > 32
+# error "Dirty mask holds at most 32 characters"
+#endif
+
+/** Expander bytes per LCD byte: 2 nibbles x (data, data+EN, data) */
+#define LCD_BYTE_LEN 6
+
+/** DDRAM address of the first character of each row */
+static const uint8_t row_offsets[] = {0x00, 0x40, 0x14, 0x54};
+
+static char shadow[LCD_ROWS][LCD_COLS];  // Wanted display content
+static volatile uint32_t dirty;          // Bit (row * LCD_COLS + col) set = not yet on the LCD
+static uint8_t cur_col, cur_row;         // Write position of putc
+static uint8_t ddram_pos = 0xFF;         // LCD address counter, 0xFF = unknown
+
+static uint8_t tx_buf[(LCD_REFRESH_CHARS + 1) * LCD_BYTE_LEN];
+static twi_xfer_t tx;                    // Refresh transaction
+static uint32_t tx_mask;                 // Characters carried by tx
+static volatile uint8_t tx_busy;         // Refresh chain running
+
 /**
  * @brief Internal function to send a byte to the PCF8574 expander.
  * @param val Byte to be written to the port.
  */
 static void i2c_send_byte(uint8_t val)
 {
-    twi_start();
-    twi_write(LCD_ADDR << 1);        // Address + Write bit (0)
-    twi_write(val | _backlight_val); // Send data combined with backlight status
-    twi_stop();
+    twi_xfer_t x;
+
+    val |= _backlight_val;           // Send data combined with backlight status
+    x.addr = LCD_ADDR;
+    x.wbuf = &val;
+    x.wlen = 1;
+    x.rlen = 0;
+    x.done = NULL;
+    twi_transfer(&x);
 }
 
 /**
@@ -74,6 +109,7 @@ static void lcd_send(uint8_t value, uint8_t mode)
 void lcd_i2c_init(void)
 {
     twi_init();    // Initialize I2C bus
+    twi_set_speed(LCD_ADDR, LCD_SCL_HZ);
     _delay_ms(50); // Wait for power stabilization
 
     // Initialization sequence for 4-bit mode (HD44780 standard)
@@ -97,28 +133,189 @@ void lcd_i2c_init(void)
     lcd_send(0x06, 0);
     // Display On
     lcd_send(0x0C, 0);
+
+    // The display is clear: start the shadow in the same state
+    for (uint8_t r = 0; r < LCD_ROWS; r++) {
+        for (uint8_t c = 0; c < LCD_COLS; c++)
+            shadow[r][c] = ' ';
+    }
+    dirty = 0;
+    cur_col = 0;
+    cur_row = 0;
+    ddram_pos = 0x00;
+}
+
+/**
+ * @brief Encode one LCD byte as expander bytes for a multi-byte write.
+ * @param buf Destination, LCD_BYTE_LEN bytes.
+ * @param value Byte to send.
+ * @param rs_bit LCD_RS_BIT for data, 0 for an instruction.
+ * @return Number of bytes written (LCD_BYTE_LEN).
+ * @note Two expander bytes (45 us at 400 kHz) separate the latch of one
+ *       write from the next, longer than the 37 us execution time, so no
+ *       delays are needed.
+ */
+static uint8_t lcd_encode(uint8_t *buf, uint8_t value, uint8_t rs_bit)
+{
+    uint8_t hi = (value & 0xF0) | rs_bit | _backlight_val;
+    uint8_t lo = ((value << 4) & 0xF0) | rs_bit | _backlight_val;
+
+    buf[0] = hi;
+    buf[1] = hi | LCD_EN_BIT;
+    buf[2] = hi;
+    buf[3] = lo;
+    buf[4] = lo | LCD_EN_BIT;
+    buf[5] = lo;
+    return LCD_BYTE_LEN;
+}
+
+static void lcd_tx_done(twi_xfer_t *x);
+
+/**
+ * @brief Queue the next run of changed characters or end the refresh.
+ * @note Called with interrupts disabled (from lcd_kick() or the TWI
+ *       completion callback).
+ */
+static void lcd_pump(void)
+{
+    uint32_t bit = 1;
+    uint8_t idx = 0;
+    uint8_t row, col, addr, n = 0;
+
+    if (dirty == 0) {
+        tx_busy = 0;
+        return;
+    }
+
+    // First changed character
+    while (!(dirty & bit)) {
+        bit <<= 1;
+        idx++;
+    }
+    row = idx / LCD_COLS;
+    col = idx % LCD_COLS;
+    addr = row_offsets[row] + col;
+
+    if (addr != ddram_pos)
+        n += lcd_encode(&tx_buf[n], 0x80 | addr, 0);    // Set DDRAM address
+
+    // Run of consecutive changed characters on this row
+    tx_mask = 0;
+    do {
+        n += lcd_encode(&tx_buf[n], (uint8_t)shadow[row][col], LCD_RS_BIT);
+        tx_mask |= bit;
+        bit <<= 1;
+        col++;
+        addr++;
+    } while (n < sizeof(tx_buf) && col < LCD_COLS && (dirty & bit));
+
+    tx.addr = LCD_ADDR;
+    tx.wbuf = tx_buf;
+    tx.wlen = n;
+    tx.rlen = 0;
+    tx.done = lcd_tx_done;
+    if (twi_submit(&tx) != 0) {
+        // Queue full: retry at the next update
+        tx_busy = 0;
+        return;
+    }
+    // Characters changed from now on are sent again
+    dirty &= ~tx_mask;
+    ddram_pos = addr;
+}
+
+/**
+ * @brief TWI completion callback of the refresh transaction.
+ * @param x Finished transaction.
+ */
+static void lcd_tx_done(twi_xfer_t *x)
+{
+    if (x->status != TWI_OK) {
+        // Resend the characters at the next update
+        dirty |= tx_mask;
+        ddram_pos = 0xFF;
+        tx_busy = 0;
+        return;
+    }
+    lcd_pump();
+}
+
+/**
+ * @brief Start the background refresh unless it is running.
+ */
+static void lcd_kick(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+    if (!tx_busy && dirty) {
+        tx_busy = 1;
+        lcd_pump();
+    }
+    SREG = sreg;
+}
+
+/**
+ * @brief Store one character in the shadow at the write position.
+ * @param c Character.
+ */
+static void lcd_store(char c)
+{
+    if (cur_row < LCD_ROWS && cur_col < LCD_COLS) {
+        if (shadow[cur_row][cur_col] != c) {
+            uint8_t sreg = SREG;
+            shadow[cur_row][cur_col] = c;
+            cli();
+            dirty |= (uint32_t)1 << (cur_row * LCD_COLS + cur_col);
+            SREG = sreg;
+        }
+    }
+    cur_col++;
 }
 
 void lcd_i2c_clrscr(void)
 {
-    lcd_send(0x01, 0); // Clear display command
-    _delay_ms(2);
+    for (cur_row = 0; cur_row < LCD_ROWS; cur_row++) {
+        for (cur_col = 0; cur_col < LCD_COLS; )
+            lcd_store(' ');
+    }
+    cur_col = 0;
+    cur_row = 0;
+    lcd_kick();
 }
 
 void lcd_i2c_gotoxy(uint8_t col, uint8_t row)
 {
-    uint8_t row_offsets[] = {0x00, 0x40, 0x14, 0x54};
-    lcd_send(0x80 | (col + row_offsets[row]), 0);
+    cur_col = col;
+    cur_row = row;
 }
 
 void lcd_i2c_putc(char c)
 {
-    lcd_send((uint8_t)c, 1);
+    lcd_store(c);
+    lcd_kick();
 }
 
 void lcd_i2c_puts(const char* s)
 {
     while (*s) {
-        lcd_i2c_putc(*s++);
+        lcd_store(*s++);
     }
-}
\ No newline at end of file
+    lcd_kick();
+}
+
+void lcd_i2c_redraw(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+    dirty = ((uint32_t)1 << (LCD_ROWS * LCD_COLS - 1) << 1) - 1;
+    ddram_pos = 0xFF;
+    SREG = sreg;
+    lcd_kick();
+}
+
+uint8_t lcd_i2c_busy(void)
+{
+    return tx_busy;
+}
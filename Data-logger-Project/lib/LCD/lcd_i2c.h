@@ -3,7 +3,8 @@
  * @brief Driver interface for I2C Character LCD (using PCF8574).
  *
  * Implements functions to control standard HD44780 LCDs connected via
- * an I2C I/O expander backpack.
+ * an I2C I/O expander backpack. Text is written to a shadow buffer and
+ * transferred to the display in the background (TWI interrupt).
  *
  * @author Team DE2-Project
  * @date 2025
@@ -21,11 +22,31 @@
  */
 #define LCD_ADDR 0x27
 
+/**
+ * @brief Highest I2C clock used for the backpack [Hz].
+ * The PCF8574 is specified for 100 kHz. Many backpacks also run at 400 kHz
+ * (a redraw takes a quarter of the bus time); set 400000 only after the
+ * board has been checked with the TWI bench (TWI_BENCH) and shows no
+ * corrupted characters.
+ */
+#ifndef LCD_SCL_HZ
+#define LCD_SCL_HZ 100000
+#endif
+
 /** @brief Display width (characters per line). */
 #define LCD_COLS 16
 /** @brief Display height (number of lines). */
 #define LCD_ROWS 2
 
+/**
+ * @brief Maximum number of characters sent in one background transaction.
+ * Larger values need fewer transactions but hold the bus longer
+ * (6 expander bytes per character: 0.54 ms at 100 kHz, 0.14 ms at 400 kHz).
+ */
+#ifndef LCD_REFRESH_CHARS
+#define LCD_REFRESH_CHARS 4
+#endif
+
 /**
  * @brief Initialize the LCD via I2C.
  * Configures the I2C bus and runs the HD44780 initialization sequence (4-bit mode).
@@ -34,6 +55,7 @@ void lcd_i2c_init(void);
 
 /**
  * @brief Clear the display content.
+ * Fills the shadow with spaces and resets the cursor to (0, 0).
  */
 void lcd_i2c_clrscr(void);
 
@@ -46,6 +68,7 @@ void lcd_i2c_gotoxy(uint8_t col, uint8_t row);
 
 /**
  * @brief Print a single character to the display.
+ * Only characters that differ from the current content are transferred.
  * @param c Character to print.
  */
 void lcd_i2c_putc(char c);
@@ -56,4 +79,15 @@ void lcd_i2c_putc(char c);
  */
 void lcd_i2c_puts(const char* s);
 
+/**
+ * @brief Send the whole shadow to the display again.
+ */
+void lcd_i2c_redraw(void);
+
+/**
+ * @brief Check the background refresh.
+ * @return 1 while changed characters are being sent, 0 when the display is up to date.
+ */
+uint8_t lcd_i2c_busy(void);
+
 #endif /* LCD_I2C_H */
\ No newline at end of file
@@ -1,37 +1,30 @@
-
-
 /**
  * @file LightSensor.c
  * @brief Implementation of light sensor.
  */
 
 #include "LightSensor.h"
-#include <avr/io.h>
-
-// Selected ADC channel (0–7)
-static uint8_t adc_pin = 0;
+#include "adc.h"
 
 // Calibration boundaries
 static uint16_t cal_min = 0;
 static uint16_t cal_max = 1023;
 
+// Scan engine channel, -1 before init
+static int8_t adc_ch = -1;
+
 /**
- * @brief Initializes the ADC for the selected analog input pin.
+ * @brief Adds the selected analog input pin to the ADC scan list.
  *
- * Sets reference voltage to AVCC and configures ADC prescaler for stable readings.
+ * Conversions are timer-triggered and oversampled (see adc.h). The
+ * calibration maps cal_min..cal_max to 100..0 %.
  *
  * @param pin ADC channel number (0–5 on Arduino Uno).
  */
 void lightSensor_init(uint8_t pin)
 {
-    adc_pin = pin & 0x07;
-
-    // Reference voltage = AVCC, select ADC channel
-    ADMUX = (1 << REFS0) | adc_pin;
-
-    // Enable ADC, set prescaler to 128
-    ADCSRA = (1 << ADEN) |
-             (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+    adc_ch = adc_add_channel(pin, LIGHT_OVERSAMPLE_BITS);
+    lightSensor_setCalibration(cal_min, cal_max);
 }
 
 /**
@@ -41,17 +34,17 @@ void lightSensor_init(uint8_t pin)
  */
 uint16_t lightSensor_readRaw(void)
 {
-    // Select ADC channel
-    ADMUX = (ADMUX & 0xF8) | adc_pin;
-
-    // Start conversion
-    ADCSRA |= (1 << ADSC);
+    if (adc_ch < 0) return 0;
 
-    // Wait for conversion to finish
-    while (ADCSRA & (1 << ADSC));
+    uint8_t extra = adc_bits(adc_ch) - 10;
+    uint16_t raw = adc_read(adc_ch);
 
-    // Return raw ADC value
-    return ADC;
+    // Round the oversampled value back to 10 bits
+    if (extra) {
+        raw = (raw + (1 << (extra - 1))) >> extra;
+        if (raw > 1023) raw = 1023;
+    }
+    return raw;
 }
 
 /**
@@ -64,6 +57,9 @@ void lightSensor_setCalibration(uint16_t minValue, uint16_t maxValue)
 {
     cal_min = minValue;
     cal_max = maxValue;
+
+    // Inverted scale: darkest = 100 %, brightest = 0 %
+    if (adc_ch >= 0) adc_set_calibration(adc_ch, cal_min, 100, cal_max, 0);
 }
 
 /**
@@ -73,13 +69,6 @@ void lightSensor_setCalibration(uint16_t minValue, uint16_t maxValue)
  */
 uint16_t lightSensor_readCalibrated(void)
 {
-    uint16_t raw = lightSensor_readRaw();
-
-    // Clamp to range
-    if (raw <= cal_min) return 100;  // darkest = 0%
-    if (raw >= cal_max) return 0;    // brightest = 100%
-
-    // Linear mapping
-    uint16_t pct = (raw - cal_min) * 100UL / (cal_max - cal_min);
-    return 100 - pct;                // invert scale
+    if (adc_ch < 0) return 0;
+    return (uint16_t)adc_value(adc_ch);
 }
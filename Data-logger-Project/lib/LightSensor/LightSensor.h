@@ -1,6 +1,11 @@
 /**
  * @file LightSensor.h
  * @brief Driver interface for the analog Photoresistor module.
+ *
+ * The photoresistor is one channel of the background ADC scan (adc.h);
+ * the read functions return the latest oversampled value and never wait
+ * for a conversion.
+ *
  * @addtogroup drivers
  * @{
  */
@@ -10,15 +15,23 @@
 
 #include <stdint.h>
 
+/** @brief Oversampling exponent: 4^n conversions per value, +n bits (16x = 12 bits). */
+#ifndef LIGHT_OVERSAMPLE_BITS
+#define LIGHT_OVERSAMPLE_BITS 2
+#endif
+
 /**
- * @brief Initializes the ADC for reading a photoresistor.
+ * @brief Adds the photoresistor to the ADC scan list.
+ *
+ * Scanned with LIGHT_OVERSAMPLE_BITS oversampling. adc_init() must have
+ * been called.
  *
  * @param pin ADC channel number (0–5) depending on wiring.
  */
 void lightSensor_init(uint8_t pin);
 
 /**
- * @brief Reads the raw ADC value.
+ * @brief Reads the raw ADC value (latest oversampled value, rounded to 10 bits).
  *
  * @return Raw ADC value in the range 0–1023.
  */
@@ -35,6 +48,8 @@ void lightSensor_setCalibration(uint16_t minValue, uint16_t maxValue);
 /**
  * @brief Returns calibrated light intensity in percent.
  *
+ * Computed from the full oversampled resolution, rounded to 1 %.
+ *
  * @return Light level from 0% (dark) to 100% (bright).
  */
 uint16_t lightSensor_readCalibrated(void);
@@ -0,0 +1,232 @@
+/**
+ * @file adc.c
+ * @brief Interrupt-driven multi-channel ADC scan engine with oversampling.
+ */
+
+#include "adc.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#if (ADC_RING_LEN & (ADC_RING_LEN - 1)) != 0
+#error "ADC_RING_LEN must be a power of two"
+#endif
+
+/**
+ * @brief Conversions discarded after a channel switch. In free-running mode
+ * the conversion after the interrupt has already started on the old input.
+ */
+#if ADC_TRIGGER == ADC_TRIGGER_FREE
+#define ADC_SETTLE 2
+#else
+#define ADC_SETTLE 1
+#endif
+
+/** @brief Channel state. */
+typedef struct {
+    uint8_t mux;                        /**< ADMUX input selection */
+    uint8_t os_bits;                    /**< Oversampling exponent n */
+    uint8_t calibrated;                 /**< Calibration set */
+    uint32_t raw_lo, raw_hi;            /**< Calibration points (oversampled) */
+    int32_t val_lo, val_hi;             /**< Values at the calibration points */
+    volatile uint16_t ring[ADC_RING_LEN]; /**< Published results */
+    volatile uint8_t head;              /**< Next ring slot */
+    volatile uint8_t count;             /**< Valid results in the ring */
+    volatile uint8_t fresh;             /**< Result not read yet */
+} adc_channel_t;
+
+static adc_channel_t chans[ADC_MAX_CHANNELS];
+static volatile uint8_t n_chans;        // Channels in the scan list
+static uint8_t cur;                     // Channel being converted
+static uint16_t acc;                    // Sum of the current block
+static uint8_t acc_n;                   // Conversions in the current block
+static uint8_t settle;                  // Conversions left to discard
+static uint8_t adcsra_saved;            // ADCSRA while suspended
+
+/** @brief Route the multiplexer to channel i and restart its block. */
+static void select_channel(uint8_t i)
+{
+    cur = i;
+    ADMUX = (1 << REFS0) | chans[i].mux;
+    acc = 0;
+    acc_n = 0;
+    settle = ADC_SETTLE;
+}
+
+/**
+ * @brief ADC conversion complete: accumulate, decimate, advance the scan.
+ *
+ * 64 conversions of 1023 still fit the 16-bit accumulator.
+ */
+ISR(ADC_vect)
+{
+    uint16_t v = ADC;
+
+    if (settle) {
+        settle--;
+        return;
+    }
+
+    adc_channel_t *c = &chans[cur];
+    acc += v;
+    if (++acc_n >= (uint8_t)(1 << (2 * c->os_bits))) {
+        c->ring[c->head] = acc >> c->os_bits;
+        c->head = (c->head + 1) & (ADC_RING_LEN - 1);
+        if (c->count < ADC_RING_LEN) c->count++;
+        c->fresh = 1;
+
+        if (n_chans > 1) {
+            select_channel(cur + 1 < n_chans ? cur + 1 : 0);
+        } else {
+            acc = 0;
+            acc_n = 0;
+        }
+    }
+}
+
+void adc_init(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    ADCSRA = 0;             // Stop a running acquisition
+    n_chans = 0;
+    SREG = sreg;
+}
+
+int8_t adc_add_channel(uint8_t mux, uint8_t bits)
+{
+    if (n_chans >= ADC_MAX_CHANNELS) return -1;
+    if (bits > ADC_OVERSAMPLE_MAX) bits = ADC_OVERSAMPLE_MAX;
+
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t i = n_chans;
+    adc_channel_t *c = &chans[i];
+    c->mux = mux & 0x0F;
+    c->os_bits = bits;
+    c->calibrated = 0;
+    c->head = 0;
+    c->count = 0;
+    c->fresh = 0;
+    if (mux < 6) DIDR0 |= (1 << mux);
+    n_chans = i + 1;
+
+    if (i == 0) {
+        // First channel: start the acquisition.
+        // Reference voltage = AVCC, enable ADC with interrupt and auto
+        // trigger, prescaler 128
+        select_channel(0);
+        ADCSRB = ADC_TRIGGER;
+        ADCSRA = (1 << ADEN) | (1 << ADATE) | (1 << ADIE) | (1 << ADIF) |
+                 (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+#if ADC_TRIGGER == ADC_TRIGGER_FREE
+        ADCSRA |= (1 << ADSC);  // First conversion starts the free run
+#endif
+    }
+    SREG = sreg;
+    return (int8_t)i;
+}
+
+void adc_set_calibration(uint8_t ch, uint16_t raw_lo, int32_t val_lo,
+                         uint16_t raw_hi, int32_t val_hi)
+{
+    if (ch >= n_chans || raw_hi <= raw_lo) return;
+
+    adc_channel_t *c = &chans[ch];
+    c->raw_lo = (uint32_t)raw_lo << c->os_bits;
+    c->raw_hi = (uint32_t)raw_hi << c->os_bits;
+    c->val_lo = val_lo;
+    c->val_hi = val_hi;
+    c->calibrated = 1;
+}
+
+uint8_t adc_ready(uint8_t ch)
+{
+    return ch < n_chans ? chans[ch].fresh : 0;
+}
+
+/** @brief Newest result of a channel; optionally mark it as read. */
+static uint16_t latest(adc_channel_t *c, uint8_t consume)
+{
+    uint16_t v = 0;
+    uint8_t sreg = SREG;
+
+    cli();
+    if (c->count) v = c->ring[(c->head - 1) & (ADC_RING_LEN - 1)];
+    if (consume) c->fresh = 0;
+    SREG = sreg;
+    return v;
+}
+
+uint16_t adc_read(uint8_t ch)
+{
+    if (ch >= n_chans) return 0;
+    return latest(&chans[ch], 1);
+}
+
+uint8_t adc_history(uint8_t ch, uint16_t *buf, uint8_t n)
+{
+    if (ch >= n_chans) return 0;
+
+    adc_channel_t *c = &chans[ch];
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t idx = c->head;
+    if (n > c->count) n = c->count;
+    for (uint8_t i = 0; i < n; i++) {
+        idx = (idx - 1) & (ADC_RING_LEN - 1);
+        buf[i] = c->ring[idx];
+    }
+    SREG = sreg;
+    return n;
+}
+
+int32_t adc_value(uint8_t ch)
+{
+    if (ch >= n_chans) return 0;
+
+    adc_channel_t *c = &chans[ch];
+    uint32_t raw = latest(c, 0);
+    if (!c->calibrated) return (int32_t)raw;
+
+    // Clamp to the calibration points
+    if (raw <= c->raw_lo) return c->val_lo;
+    if (raw >= c->raw_hi) return c->val_hi;
+
+    // Linear mapping, rounded half away from zero
+    int32_t span = (int32_t)(c->raw_hi - c->raw_lo);
+    int32_t num = (int32_t)(raw - c->raw_lo) * (c->val_hi - c->val_lo);
+    num += (num >= 0) ? span / 2 : -span / 2;
+    return c->val_lo + num / span;
+}
+
+uint8_t adc_converting(void)
+{
+    return (ADCSRA & (1 << ADSC)) ? 1 : 0;
+}
+
+void adc_suspend(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    adcsra_saved = ADCSRA;
+    ADCSRA = 0;             // Also aborts a running conversion
+    SREG = sreg;
+}
+
+void adc_resume(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    if (adcsra_saved & (1 << ADEN)) {
+        // The interrupted block is incomplete: restart it
+        select_channel(cur);
+        ADCSRA = adcsra_saved | (1 << ADIF);
+    }
+    adcsra_saved = 0;
+    SREG = sreg;
+}
+
+uint8_t adc_bits(uint8_t ch)
+{
+    return ch < n_chans ? 10 + chans[ch].os_bits : 10;
+}
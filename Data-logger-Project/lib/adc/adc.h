@@ -0,0 +1,162 @@
+/**
+ * @file adc.h
+ * @brief Interrupt-driven multi-channel ADC scan engine with oversampling.
+ *
+ * The ADC runs in auto-trigger mode: every conversion is started by the
+ * trigger source (ADC_TRIGGER) without CPU involvement, and the ADC
+ * interrupt adds the result to the accumulator of the current channel.
+ * After 4^n conversions the sum is decimated to a value with n extra bits
+ * (oversampling by 4^n), stored in the channel's ring buffer, and the
+ * multiplexer moves on to the next channel of the scan list. Readers never
+ * wait for a conversion.
+ *
+ * The first conversion after a channel switch is discarded, so the sample
+ * and hold capacitor has settled on the new input before it is used.
+ *
+ * With the default trigger, the 1 ms compare match A of the system tick
+ * (timebase), every channel occupies the ADC for 4^n + 1 milliseconds per
+ * scan; two channels with 16x oversampling each publish a new 12-bit value
+ * every 34 ms. The compare match interrupt must be enabled, since it clears
+ * the flag that forms the trigger edge.
+ *
+ * Each channel has an optional two-point linear calibration that converts
+ * its values to physical units (adc_value()).
+ *
+ * @addtogroup drivers
+ * @{
+ */
+
+#ifndef ADC_H
+#define ADC_H
+
+#include <stdint.h>
+
+/**
+ * @name Trigger Sources (ADTS bits)
+ * @{
+ */
+#define ADC_TRIGGER_FREE        0   /**< Free running, one conversion per 104 us */
+#define ADC_TRIGGER_TIMER0_COMPA 3  /**< Timer0 compare match A (1 ms tick) */
+#define ADC_TRIGGER_TIMER0_OVF  4   /**< Timer0 overflow (never occurs in CTC mode) */
+/** @} */
+
+/** @brief Conversion trigger (ADC_TRIGGER_*). */
+#ifndef ADC_TRIGGER
+#define ADC_TRIGGER ADC_TRIGGER_TIMER0_COMPA
+#endif
+
+/** @brief Largest oversampling exponent (4^3 = 64 conversions, 13-bit result). */
+#define ADC_OVERSAMPLE_MAX 3
+
+/** @brief Maximum number of channels in the scan list. */
+#ifndef ADC_MAX_CHANNELS
+#define ADC_MAX_CHANNELS 4
+#endif
+
+/** @brief Results kept per channel (power of two). */
+#ifndef ADC_RING_LEN
+#define ADC_RING_LEN 4
+#endif
+
+/** @brief Reference voltage (AVCC) [mV], for voltage calibrations. */
+#ifndef ADC_VREF_MV
+#define ADC_VREF_MV 5000
+#endif
+
+/** @brief Multiplexer setting of the internal 1.1 V bandgap reference. */
+#define ADC_MUX_BANDGAP 14
+
+/**
+ * @brief Configure the ADC and clear the scan list.
+ *
+ * Reference AVCC, prescaler 128 (125 kHz ADC clock). Conversions start
+ * with the first adc_add_channel().
+ */
+void adc_init(void);
+
+/**
+ * @brief  Append a channel to the scan list.
+ *
+ * The digital input buffer of the pin is disabled. The new channel starts
+ * uncalibrated: adc_value() returns the raw value.
+ *
+ * @param  mux  ADC input (0–7 or ADC_MUX_BANDGAP).
+ * @param  bits Oversampling exponent n (0–ADC_OVERSAMPLE_MAX): 4^n
+ *              conversions per result, n extra bits of resolution.
+ * @return Channel handle, -1 if the scan list is full.
+ */
+int8_t adc_add_channel(uint8_t mux, uint8_t bits);
+
+/**
+ * @brief  Set the two-point linear calibration of a channel.
+ *
+ * Raw values are given at 10-bit resolution and scaled to the channel's
+ * oversampled resolution internally. Values outside the two points are
+ * clamped to them, so either end may be a limit (e.g. 0 % and 100 %).
+ * |val_hi - val_lo| must stay below 2^18 (13-bit values times the span
+ * fit 32 bits).
+ *
+ * @param  ch     Channel handle.
+ * @param  raw_lo First calibration point, 10-bit raw value.
+ * @param  val_lo Value at raw_lo.
+ * @param  raw_hi Second calibration point (> raw_lo), 10-bit raw value.
+ * @param  val_hi Value at raw_hi.
+ */
+void adc_set_calibration(uint8_t ch, uint16_t raw_lo, int32_t val_lo,
+                         uint16_t raw_hi, int32_t val_hi);
+
+/**
+ * @brief  Check for a result published since the last adc_read().
+ * @param  ch Channel handle.
+ * @return 1 if a new result is available, 0 otherwise.
+ */
+uint8_t adc_ready(uint8_t ch);
+
+/**
+ * @brief  Get the last published result of a channel (non-blocking).
+ * @param  ch Channel handle.
+ * @return Decimated value with 10 + n bits, 0 before the first result.
+ */
+uint16_t adc_read(uint8_t ch);
+
+/**
+ * @brief  Copy the stored results of a channel, newest first.
+ * @param  ch  Channel handle.
+ * @param[out] buf Destination.
+ * @param  n   Capacity of buf.
+ * @return Number of results copied (at most ADC_RING_LEN).
+ */
+uint8_t adc_history(uint8_t ch, uint16_t *buf, uint8_t n);
+
+/**
+ * @brief  Get the last result of a channel in calibrated units (rounded).
+ * @param  ch Channel handle.
+ * @return Calibrated value, or the raw value if the channel is uncalibrated.
+ */
+int32_t adc_value(uint8_t ch);
+
+/**
+ * @brief  Get the resolution of adc_read() results.
+ * @param  ch Channel handle.
+ * @return Number of bits (10 + oversampling exponent).
+ */
+uint8_t adc_bits(uint8_t ch);
+
+/**
+ * @brief  Check for a conversion in progress.
+ * @return 1 while the ADC converts, 0 otherwise.
+ */
+uint8_t adc_converting(void);
+
+/**
+ * @brief Stop the ADC before a deep sleep (the enabled ADC draws current
+ * even without a clock). Published results are kept.
+ */
+void adc_suspend(void);
+
+/** @brief Restart the scan stopped by adc_suspend(). */
+void adc_resume(void);
+
+#endif /* ADC_H */
+
+/** @} */
@@ -0,0 +1,26 @@
+/**
+ * @file battery.c
+ * @brief Implementation of the battery voltage monitor.
+ */
+
+#include "battery.h"
+#include "adc.h"
+
+/** @brief Battery voltage at ADC full scale (raw 1024) [mV]. */
+#define BATTERY_FULL_SCALE_MV \
+    ((uint32_t)ADC_VREF_MV * (BATTERY_R_TOP + BATTERY_R_BOTTOM) / BATTERY_R_BOTTOM)
+
+// Scan engine channel, -1 before init
+static int8_t adc_ch = -1;
+
+void battery_init(uint8_t pin)
+{
+    adc_ch = adc_add_channel(pin, BATTERY_OVERSAMPLE_BITS);
+    if (adc_ch >= 0) adc_set_calibration(adc_ch, 0, 0, 1024, BATTERY_FULL_SCALE_MV);
+}
+
+uint16_t battery_read_mv(void)
+{
+    if (adc_ch < 0) return 0;
+    return (uint16_t)adc_value(adc_ch);
+}
@@ -0,0 +1,55 @@
+/**
+ * @file battery.h
+ * @brief Battery voltage monitor on an ADC input.
+ *
+ * The battery is measured through a resistive divider (BATTERY_R_TOP from
+ * the battery to the pin, BATTERY_R_BOTTOM from the pin to GND). The pin
+ * is one channel of the background ADC scan (adc.h); its calibration maps
+ * the ADC range directly to millivolts at the battery.
+ *
+ * @addtogroup drivers
+ * @{
+ */
+
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <stdint.h>
+
+/**
+ * @name Divider Resistors [kOhm]
+ * The default 10k/10k divider measures up to 2 x ADC_VREF_MV (10 V).
+ * @{
+ */
+#ifndef BATTERY_R_TOP
+#define BATTERY_R_TOP    10
+#endif
+#ifndef BATTERY_R_BOTTOM
+#define BATTERY_R_BOTTOM 10
+#endif
+/** @} */
+
+/** @brief Oversampling exponent: 4^n conversions per value (16x = 12 bits). */
+#ifndef BATTERY_OVERSAMPLE_BITS
+#define BATTERY_OVERSAMPLE_BITS 2
+#endif
+
+/**
+ * @brief Adds the battery divider to the ADC scan list.
+ *
+ * adc_init() must have been called.
+ *
+ * @param pin ADC channel number (0–5) depending on wiring.
+ */
+void battery_init(uint8_t pin);
+
+/**
+ * @brief Returns the battery voltage (latest oversampled value).
+ *
+ * @return Voltage at the battery [mV], 0 before the first result.
+ */
+uint16_t battery_read_mv(void);
+
+#endif /* BATTERY_H */
+
+/** @} */
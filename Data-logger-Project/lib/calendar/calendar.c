@@ -0,0 +1,363 @@
+/**
+ * @file calendar.c
+ * @brief Software calendar clock disciplined by the DS1302 RTC.
+ *
+ * The clock is kept as seconds since 2000 plus a microsecond fraction, and
+ * as broken-down date and time that is carried forward once per second, so
+ * neither a timestamp read nor the per-second update needs a division by
+ * 60 or a date conversion. Elapsed system clock time is folded in at every
+ * poll; the rate correction and the slew are applied during the fold.
+ */
+
+#include "calendar.h"
+#include <stdio.h>
+#include "ds1302.h"
+#include "uart.h"
+
+/** @brief Rate correction scale: parts per 2^20 (1 unit = 0.95 ppm). */
+#define RATE_SHIFT 20
+/** @brief Largest accepted rate error (2^16 / 2^20 = 6.25 %). */
+#define RATE_LIMIT 65536L
+/** @brief Polls without a seconds change before a sync is given up (2 s). */
+#define EDGE_POLLS (2000 / CAL_POLL_MS)
+
+static cal_clock_t clock_us;
+
+static uint32_t sec;                // Seconds since 2000-01-01
+static uint32_t frac_us;            // Fraction of the current second [us]
+static cal_time_t now_bd;           // Broken-down sec (ms, sec unused)
+static uint32_t last_raw;           // Clock at the last fold
+static int32_t rate;                // Rate correction [2^-20]
+static int32_t slew_us;             // Offset still to be slewed out
+
+static uint8_t syncing;             // Waiting for the RTC second edge
+static uint8_t force_step;          // Set the clock at the next sync
+static uint8_t sync_ss;             // RTC seconds register at the last read
+static uint16_t sync_polls;         // Reads since the sync started
+static uint32_t sync_prev_raw;      // Clock at the last read
+static uint32_t next_sync;          // sec at which the next sync starts
+static uint8_t have_edge;           // prev_edge_* valid
+static uint32_t prev_edge_raw;      // Clock at the previous RTC edge
+static uint32_t prev_edge_rtc;      // RTC time at the previous edge [s]
+
+static cal_stats_t stats;
+
+/** @brief Days in a month of a 2000-based year (2000–2099). */
+static uint8_t month_days(uint8_t year, uint8_t month)
+{
+    static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    if (month == 2 && (year & 0x03) == 0) return 29;
+    return days[month - 1];
+}
+
+/** @brief Convert a BCD register value to binary. */
+static uint8_t bcd2bin(uint8_t v)
+{
+    return ((v >> 4) * 10) + (v & 0x0F);
+}
+
+/**
+ * @brief  Decode a DS1302 burst read (BCD, 24 h mode).
+ * @return 1 if the fields form a valid date and time, 0 otherwise
+ *         (e.g. no RTC connected).
+ */
+static uint8_t rtc_decode(const ds1302_time_t *r, cal_time_t *t)
+{
+    t->ss = bcd2bin(r->sec & 0x7F);     // Bit 7: clock halt
+    t->mm = bcd2bin(r->min & 0x7F);
+    t->hh = bcd2bin(r->hour & 0x3F);
+    t->date = bcd2bin(r->date & 0x3F);
+    t->month = bcd2bin(r->month & 0x1F);
+    t->year = bcd2bin(r->year);
+    t->ms = 0;
+
+    return t->ss < 60 && t->mm < 60 && t->hh < 24 &&
+           t->year < 100 && t->month >= 1 && t->month <= 12 &&
+           t->date >= 1 && t->date <= month_days(t->year, t->month);
+}
+
+uint32_t calendar_to_seconds(const cal_time_t *t)
+{
+    uint16_t days = t->year * 365u + (t->year + 3u) / 4u;
+
+    for (uint8_t m = 1; m < t->month; m++) {
+        days += month_days(t->year, m);
+    }
+    days += t->date - 1;
+
+    return (uint32_t)days * 86400UL +
+           (uint32_t)t->hh * 3600UL + (uint16_t)t->mm * 60u + t->ss;
+}
+
+void calendar_from_seconds(uint32_t s, cal_time_t *t)
+{
+    uint16_t days = s / 86400UL;
+    uint32_t rem = s % 86400UL;
+
+    t->hh = rem / 3600u;
+    rem %= 3600u;
+    t->mm = rem / 60u;
+    t->ss = rem % 60u;
+    t->ms = 0;
+    t->sec = s;
+
+    // Whole years and months; every fourth year from 2000 is a leap year
+    t->year = 0;
+    while (days >= ((t->year & 0x03) ? 365u : 366u)) {
+        days -= (t->year & 0x03) ? 365u : 366u;
+        t->year++;
+    }
+    t->month = 1;
+    while (days >= month_days(t->year, t->month)) {
+        days -= month_days(t->year, t->month);
+        t->month++;
+    }
+    t->date = days + 1;
+}
+
+/** @brief Advance the clock by one second, carrying into the date. */
+static void tick_second(void)
+{
+    sec++;
+    if (++now_bd.ss < 60) return;
+    now_bd.ss = 0;
+    if (++now_bd.mm < 60) return;
+    now_bd.mm = 0;
+    if (++now_bd.hh < 24) return;
+    now_bd.hh = 0;
+    if (++now_bd.date <= month_days(now_bd.year, now_bd.month)) return;
+    now_bd.date = 1;
+    if (++now_bd.month <= 12) return;
+    now_bd.month = 1;
+    now_bd.year = (now_bd.year + 1) % 100;
+}
+
+/** @brief Add the system clock time since the last fold. */
+static void fold(void)
+{
+    uint32_t raw = clock_us();
+    uint32_t d = raw - last_raw;
+    last_raw = raw;
+
+    // |rate| < 2^16: the product of a few seconds fits 64 bits easily
+    int32_t adj = (int32_t)(((int64_t)d * rate) >> RATE_SHIFT);
+
+    if (slew_us) {
+        int32_t max = (int32_t)(d >> CAL_SLEW_SHIFT);
+        int32_t s = slew_us;
+        if (s > max) s = max;
+        if (s < -max) s = -max;
+        adj += s;
+        slew_us -= s;
+    }
+
+    frac_us += d + adj;
+    while (frac_us >= 1000000UL) {      // Several passes only after a power-down
+        frac_us -= 1000000UL;
+        tick_second();
+    }
+}
+
+/** @brief Set the clock to an RTC time that began 'since_us' ago. */
+static void set_clock(const cal_time_t *t, uint32_t rtc, uint32_t since_us)
+{
+    sec = rtc;
+    now_bd = *t;
+    frac_us = since_us;
+    slew_us = 0;
+    while (frac_us >= 1000000UL) {
+        frac_us -= 1000000UL;
+        tick_second();
+    }
+}
+
+/** @brief Finish a sync at the RTC edge at clock time edge_raw. */
+static void sync_edge(uint32_t edge_raw)
+{
+    ds1302_time_t r;
+    cal_time_t t;
+
+    ds1302_burst_read(&r);
+    if (!rtc_decode(&r, &t)) {
+        stats.failures++;
+        syncing = 0;
+        next_sync = sec + CAL_SYNC_S;
+        return;
+    }
+    if (t.ss != sync_ss) {
+        // Another edge during the read: wait for the next one
+        sync_ss = t.ss;
+        sync_prev_raw = clock_us();
+        return;
+    }
+
+    uint32_t rtc = calendar_to_seconds(&t);
+    fold();
+    uint32_t since = last_raw - edge_raw;
+
+    // Clock minus RTC at the edge; large differences are not computed
+    int32_t dsec = (int32_t)(sec - rtc);
+    int32_t offset = 0;
+    uint8_t step = force_step || dsec > 2 || dsec < -2;
+    if (!step) {
+        offset = dsec * 1000000L + (int32_t)frac_us - (int32_t)since;
+        step = offset > CAL_STEP_MS * 1000L || offset < -CAL_STEP_MS * 1000L;
+    }
+
+    if (step) {
+        set_clock(&t, rtc, since);
+        force_step = 0;
+        stats.steps++;
+    } else {
+        slew_us = -offset;
+    }
+    stats.offset_us = offset;
+
+    // Rate: system clock time against whole RTC seconds between two edges
+    if (have_edge) {
+        uint32_t span_s = rtc - prev_edge_rtc;
+        uint32_t span_us = edge_raw - prev_edge_raw;
+        if (span_s >= 10 && span_s <= 3600) {
+            int64_t err = (int64_t)span_s * 1000000L - span_us;
+            int32_t meas = (int32_t)((err << RATE_SHIFT) / (int64_t)span_us);
+            if (meas > -RATE_LIMIT && meas < RATE_LIMIT) {
+                if (have_edge > 1) {
+                    rate += (meas - rate) / (1 << CAL_RATE_SHIFT);
+                } else {
+                    rate = meas;    // First measurement
+                }
+                have_edge = 2;
+            }
+        }
+    } else {
+        have_edge = 1;
+    }
+    prev_edge_raw = edge_raw;
+    prev_edge_rtc = rtc;
+
+    // ppm = rate * 10^6 / 2^20 = rate * 15625 / 2^14
+    stats.rate_ppm = (int32_t)(((int64_t)rate * 15625) >> 14);
+    stats.syncs++;
+    syncing = 0;
+    next_sync = sec + CAL_SYNC_S;
+}
+
+void calendar_init(cal_clock_t clock)
+{
+    ds1302_time_t r;
+    cal_time_t t;
+
+    clock_us = clock;
+    last_raw = clock_us();
+    rate = 0;
+    syncing = 0;
+    force_step = 1;
+    have_edge = 0;
+    stats.offset_us = 0;
+    stats.rate_ppm = 0;
+    stats.syncs = 0;
+    stats.steps = 0;
+    stats.failures = 0;
+
+    // Whole seconds now; the first sync finds the sub-second phase
+    ds1302_burst_read(&r);
+    if (!rtc_decode(&r, &t)) {
+        t.year = 0;
+        t.month = 1;
+        t.date = 1;
+        t.hh = 0;
+        t.mm = 0;
+        t.ss = 0;
+        stats.failures++;
+    }
+    set_clock(&t, calendar_to_seconds(&t), 0);
+    next_sync = sec;
+}
+
+void calendar_poll(void)
+{
+    fold();
+
+    if (!syncing) {
+        if ((int32_t)(sec - next_sync) < 0) return;
+        // Start a sync: remember the seconds register
+        sync_ss = bcd2bin(ds1302_read_register(DS1302_CMD_READ_SECONDS) & 0x7F);
+        sync_prev_raw = clock_us();
+        sync_polls = 0;
+        syncing = 1;
+        return;
+    }
+
+    uint32_t raw = clock_us();
+    uint8_t ss = bcd2bin(ds1302_read_register(DS1302_CMD_READ_SECONDS) & 0x7F);
+
+    if (ss == sync_ss) {
+        sync_prev_raw = raw;
+        if (++sync_polls > EDGE_POLLS) {
+            // RTC not counting (halted or not connected)
+            stats.failures++;
+            syncing = 0;
+            next_sync = sec + CAL_SYNC_S;
+        }
+        return;
+    }
+
+    // The edge lies between the last two reads: take the middle
+    sync_ss = ss;
+    sync_edge(sync_prev_raw + (raw - sync_prev_raw) / 2);
+}
+
+void calendar_advance(void)
+{
+    fold();
+    syncing = 0;                // Edge timing across the lag would be wrong
+}
+
+void calendar_now(cal_time_t *t)
+{
+    fold();
+    *t = now_bd;
+    t->ms = (uint16_t)(frac_us / 1000);
+    t->sec = sec;
+}
+
+uint32_t calendar_seconds(void)
+{
+    fold();
+    return sec;
+}
+
+void calendar_resync(void)
+{
+    syncing = 0;
+    force_step = 1;             // The RTC may have been set: step to it
+    have_edge = 0;              // and start a new rate measurement
+    next_sync = sec;
+}
+
+uint8_t calendar_busy(void)
+{
+    return syncing;
+}
+
+const cal_stats_t *calendar_stats(void)
+{
+    return &stats;
+}
+
+void calendar_report(void)
+{
+    char buf[96];
+    cal_time_t t;
+
+    calendar_now(&t);
+    sprintf(buf, "CLOCK: 20%02u-%02u-%02u %02u:%02u:%02u.%03u, next sync in %ld s\r\n",
+            t.year, t.month, t.date, t.hh, t.mm, t.ss, t.ms,
+            (long)(int32_t)(next_sync - sec));
+    uart_puts(buf);
+    sprintf(buf, "CLOCK: offset %ld us, rate %ld ppm, syncs %u, steps %u, failures %u\r\n",
+            (long)stats.offset_us, (long)stats.rate_ppm,
+            stats.syncs, stats.steps, stats.failures);
+    uart_puts(buf);
+}
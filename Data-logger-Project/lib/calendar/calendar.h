@@ -0,0 +1,151 @@
+/**
+ * @file calendar.h
+ * @brief Software calendar clock disciplined by the DS1302 RTC.
+ *
+ * Date and time are kept in software from the system clock, so reading a
+ * timestamp costs no RTC access and has millisecond resolution. Every
+ * CAL_SYNC_S seconds calendar_poll() resynchronizes with the DS1302:
+ *
+ * 1. The seconds register is read once per poll until it changes. The
+ *    second edge of the RTC lies between the last two reads, so its time is
+ *    known to +-CAL_POLL_MS / 2.
+ * 2. The full date and time are burst-read and compared with the software
+ *    clock at the edge. Small offsets are slewed out (the clock runs at most
+ *    1/2^CAL_SLEW_SHIFT faster or slower, so it never jumps backwards);
+ *    offsets above CAL_STEP_MS and the first sync set the clock directly.
+ * 3. The system clock ticks between two edges, compared with the whole
+ *    seconds counted by the RTC, give the rate error of the system clock.
+ *    It is filtered and applied to all later time, so the offset found at
+ *    the next sync stays small.
+ *
+ * The year is counted from 2000 like in the DS1302 (00–99).
+ *
+ * @addtogroup app_logic
+ * @{
+ */
+
+#ifndef CALENDAR_H
+#define CALENDAR_H
+
+#include <stdint.h>
+
+/** @brief Interval between two RTC synchronizations [s]. */
+#ifndef CAL_SYNC_S
+#define CAL_SYNC_S 60
+#endif
+
+/** @brief Period [ms] at which calendar_poll() should be called. */
+#ifndef CAL_POLL_MS
+#define CAL_POLL_MS 10
+#endif
+
+/** @brief Offsets larger than this [ms] are stepped instead of slewed. */
+#ifndef CAL_STEP_MS
+#define CAL_STEP_MS 500
+#endif
+
+/** @brief Slew rate limit: 1/2^n of the elapsed time (6 = 1.6 %). */
+#ifndef CAL_SLEW_SHIFT
+#define CAL_SLEW_SHIFT 6
+#endif
+
+/** @brief Rate filter gain: each measurement moves the estimate by 1/2^n. */
+#ifndef CAL_RATE_SHIFT
+#define CAL_RATE_SHIFT 2
+#endif
+
+/** @brief Calendar date and time. */
+typedef struct {
+    uint8_t year;   /**< Year (00-99, 2000-based) */
+    uint8_t month;  /**< Month (1-12) */
+    uint8_t date;   /**< Day of month (1-31) */
+    uint8_t hh;     /**< Hours (0-23) */
+    uint8_t mm;     /**< Minutes (0-59) */
+    uint8_t ss;     /**< Seconds (0-59) */
+    uint16_t ms;    /**< Milliseconds (0-999) */
+    uint32_t sec;   /**< Seconds since 2000-01-01 00:00:00 (set by calendar_now()) */
+} cal_time_t;
+
+/** @brief Synchronization state and statistics. */
+typedef struct {
+    int32_t offset_us;  /**< Clock minus RTC at the last sync [us] */
+    int32_t rate_ppm;   /**< Applied rate correction [ppm] */
+    uint16_t syncs;     /**< Successful synchronizations */
+    uint16_t steps;     /**< Synchronizations that set the clock */
+    uint16_t failures;  /**< Syncs without an RTC second edge or valid data */
+} cal_stats_t;
+
+/** @brief Time source returning microseconds (wraps at 2^32). */
+typedef uint32_t (*cal_clock_t)(void);
+
+/**
+ * @brief  Set the clock from the DS1302 and schedule a precise sync.
+ *
+ * The DS1302 must be initialized. Without valid RTC data the clock starts
+ * at 2000-01-01 00:00:00.
+ *
+ * @param  clock Microsecond time source (system clock).
+ */
+void calendar_init(cal_clock_t clock);
+
+/**
+ * @brief Advance the clock and run the RTC synchronization when it is due.
+ * Call every CAL_POLL_MS; one seconds register read per call while syncing.
+ */
+void calendar_poll(void);
+
+/**
+ * @brief Advance the clock without RTC access.
+ * Call instead of calendar_poll() while the system clock is known to lag
+ * (e.g. right after a wake-up); a synchronization in progress restarts at
+ * the next calendar_poll().
+ */
+void calendar_advance(void);
+
+/**
+ * @brief  Get the current date and time.
+ * @param[out] t Date and time with milliseconds.
+ */
+void calendar_now(cal_time_t *t);
+
+/**
+ * @brief  Get the current time as a number.
+ * @return Seconds since 2000-01-01 00:00:00.
+ */
+uint32_t calendar_seconds(void);
+
+/**
+ * @brief  Convert a date and time to a number (fields year .. ss are used).
+ * @param  t Date and time.
+ * @return Seconds since 2000-01-01 00:00:00.
+ */
+uint32_t calendar_to_seconds(const cal_time_t *t);
+
+/**
+ * @brief  Convert a number to date and time (ms = 0).
+ * @param  s Seconds since 2000-01-01 00:00:00.
+ * @param[out] t Date and time.
+ */
+void calendar_from_seconds(uint32_t s, cal_time_t *t);
+
+/** @brief Synchronize at the next calendar_poll() (e.g. after setting the RTC). */
+void calendar_resync(void);
+
+/**
+ * @brief  Check for a synchronization in progress.
+ * @return 1 while waiting for the RTC second edge, 0 otherwise.
+ */
+uint8_t calendar_busy(void);
+
+/**
+ * @brief  Get the synchronization statistics.
+ * @return Pointer to the statistics.
+ */
+const cal_stats_t *calendar_stats(void);
+
+/** @brief Print the synchronization state over UART. */
+void calendar_report(void);
+
+#endif /* CALENDAR_H */
+
+/** @} */
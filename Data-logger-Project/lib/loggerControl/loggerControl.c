@@ -2,8 +2,10 @@
  * @file loggerControl.c
  * @brief User Interface Logic and Control.
  *
- * Handles the rotary encoder input using a state machine for debouncing
- * and manages the content displayed on the I2C LCD.
+ * Handles the rotary encoder input and manages the content displayed on the
+ * I2C LCD. Encoder edges are decoded in the PCINT2 interrupt, which queues
+ * rotate and click events for the main loop, so no transition is lost while
+ * the loop is busy with the sensors, the LCD or the SD card.
  */
 
 #include <avr/io.h>
@@ -13,9 +15,10 @@
 
 #include "loggerControl.h"
 #include "lcd_i2c.h"
-#include "twi.h"
 #include "ds1302.h"
 #include "sdlog.h"
+#include "utils.h"
+#include "timebase.h"     // g_millis for the button debounce
 
 /* --- Encoder Pin Configuration (PORTD) --- */
 #define ENC_SW   PD7  /**< Encoder button pin */
@@ -26,12 +29,15 @@
 #define ENC_DDR_REG   DDRD
 #define ENC_PIN_REG   PIND
 
-/* --- RTC Address Definitions --- */
-#define RTC_ADR     0x68
-#define RTC_SEC_MEM 0x00
+/* --- Encoder Pin Change Interrupt (PCINT2 = PORTD) --- */
+#define ENC_PCMSK_REG  PCMSK2
+#define ENC_PCIE       PCIE2
 
-/* --- External Variables --- */
-extern volatile uint32_t g_millis; /**< System time from main.c used for debounce */
+/** @brief Button debounce: a press counts only after this long without SW edges [ms]. */
+#define ENC_BTN_DEBOUNCE_MS 50
+
+/** @brief Event queue length (power of two). */
+#define ENC_QUEUE_LEN 8
 
 /* --- Encoder State Machine Variables --- */
 /**
@@ -40,9 +46,22 @@ extern volatile uint32_t g_millis; /**< System time from main.c used for debounc
  */
 static const int8_t encoder_table[] = {0,-1,1,0,1,0,0,-1,-1,0,0,1,0,1,-1,0};
 
-static uint8_t old_AB = 0;         /**< Previous state of CLK and DT pins */
-static int8_t enc_counter = 0;     /**< Accumulated steps */
-static uint32_t last_btn_time = 0; /**< Timestamp of last button press */
+static uint8_t old_AB = 0;         /**< Previous state of CLK and DT pins (ISR only) */
+static int8_t enc_counter = 0;     /**< Accumulated steps (ISR only) */
+static uint8_t old_sw = 1;         /**< Previous button level (ISR only) */
+static uint32_t last_btn_time = 0; /**< Timestamp of the last button edge (ISR only) */
+
+/**
+ * @brief Event ring buffer.
+ * Single producer (ISR writes head) and single consumer (main loop writes
+ * tail); both indices are bytes, so no locking is needed.
+ */
+static volatile uint8_t enc_queue[ENC_QUEUE_LEN];
+static volatile uint8_t enc_head = 0;    /**< Next slot written by the ISR */
+static volatile uint8_t enc_tail = 0;    /**< Next slot read by the main loop */
+
+/** Number of events lost because the queue was full */
+volatile uint8_t enc_dropped = 0;
 
 /* --- Display Global Variables --- */
 /** Current value displayed on LCD (0=Temp, 1=Pressure, 2=Humidity, 3=Light) */
@@ -50,9 +69,6 @@ volatile uint8_t lcdValue = 0;
 /** Flag indicating that LCD needs to be redrawn */
 volatile uint8_t flag_update_lcd = 0;
 
-/* Helper: BCD to Decimal conversion */
-static uint8_t bcd2dec(uint8_t v) { return ((v>>4)*10 + (v & 0x0F)); }
-
 /* ==========================================
  * Initialization
  * ========================================== */
@@ -81,19 +97,44 @@ void logger_encoder_init(void)
 
     // Store initial state (bit 1 = CLK, bit 0 = DT)
     old_AB = (clk << 1) | dt;
+    old_sw = (ENC_PIN_REG & (1 << ENC_SW)) ? 1 : 0;
+
+    // Interrupt on any edge of CLK, DT and SW (PCINTn bit = PORTD bit)
+    ENC_PCMSK_REG |= (1 << ENC_CLK) | (1 << ENC_DT) | (1 << ENC_SW);
+    PCIFR = (1 << ENC_PCIE);
+    PCICR |= (1 << ENC_PCIE);
 }
 
 /* ==========================================
- * Polling Routine
+ * Interrupt Routine
  * ========================================== */
 
-void logger_encoder_poll(void)
+/** @brief Append an event to the queue (ISR context). */
+static void enc_push(uint8_t ev)
+{
+    uint8_t next = (enc_head + 1) & (ENC_QUEUE_LEN - 1);
+
+    if (next == enc_tail) {
+        enc_dropped++;           // Queue full, main loop is too slow
+        return;
+    }
+    enc_queue[enc_head] = ev;
+    enc_head = next;
+}
+
+/**
+ * @brief Pin Change Interrupt for PORTD (encoder CLK, DT and SW).
+ * Decodes rotation with the Gray code table and detects button presses.
+ */
+ISR(PCINT2_vect)
 {
+    // Sample all pins at once
+    uint8_t pins = ENC_PIN_REG;
+
     // --- 1. ROTATION HANDLING (Table Method) ---
 
-    // Read current pin states
-    uint8_t clk = (ENC_PIN_REG & (1 << ENC_CLK)) ? 1 : 0;
-    uint8_t dt  = (ENC_PIN_REG & (1 << ENC_DT))  ? 1 : 0;
+    uint8_t clk = (pins & (1 << ENC_CLK)) ? 1 : 0;
+    uint8_t dt  = (pins & (1 << ENC_DT))  ? 1 : 0;
 
     // Construct new state (0-3)
     uint8_t current_AB = (clk << 1) | dt;
@@ -110,19 +151,11 @@ void logger_encoder_poll(void)
 
         // Sensitivity threshold (KY-040 usually has 4 steps per click)
         if (enc_counter >= 4) {
-            // CLOCKWISE (Next Screen)
-            lcdValue++;
-            if (lcdValue > 3) lcdValue = 0;
-
-            flag_update_lcd = 1;
+            enc_push(ENC_EVENT_CW);
             enc_counter = 0;
         }
         else if (enc_counter <= -4) {
-            // COUNTER-CLOCKWISE (Previous Screen)
-            if (lcdValue == 0) lcdValue = 3;
-            else lcdValue--;
-
-            flag_update_lcd = 1;
+            enc_push(ENC_EVENT_CCW);
             enc_counter = 0;
         }
     }
@@ -131,41 +164,74 @@ void logger_encoder_poll(void)
 
     // --- 2. BUTTON HANDLING (Debounced) ---
 
-    if ((ENC_PIN_REG & (1 << ENC_SW)) == 0) {
-        // Button pressed (Active Low)
-        uint32_t now = g_millis;
+    uint8_t sw = (pins & (1 << ENC_SW)) ? 1 : 0;
 
-        // Debounce: accept input only once per 250 ms
-        if ((now - last_btn_time) > 250) {
-            flag_sd_toggle = 1;      // Request start/stop logging
-            flag_update_lcd = 1;     // Request redraw (to update icon)
-            last_btn_time = now;
+    if (sw != old_sw) {
+        uint32_t now = g_millis;  // Interrupts are off, plain read is atomic
+
+        // Falling edge (Active Low) after a quiet period is a press;
+        // contact bounce on press and release is ignored
+        if (!sw && (now - last_btn_time) >= ENC_BTN_DEBOUNCE_MS) {
+            enc_push(ENC_EVENT_CLICK);
         }
+        last_btn_time = now;
+        old_sw = sw;
     }
 }
 
 /* ==========================================
- * LCD Drawing
+ * Event Handling
  * ========================================== */
 
-void logger_rtc_read_time(void)
+uint8_t logger_encoder_get_event(void)
+{
+    uint8_t tail = enc_tail;
+
+    if (tail == enc_head) {
+        return ENC_EVENT_NONE;
+    }
+    uint8_t ev = enc_queue[tail];
+    enc_tail = (tail + 1) & (ENC_QUEUE_LEN - 1);
+    return ev;
+}
+
+void logger_encoder_poll(void)
+{
+    uint8_t ev;
+
+    while ((ev = logger_encoder_get_event()) != ENC_EVENT_NONE) {
+        switch (ev) {
+            case ENC_EVENT_CW:
+                // CLOCKWISE (Next Screen)
+                lcdValue++;
+                if (lcdValue > 4) lcdValue = 0;
+                flag_update_lcd = 1;
+                break;
+
+            case ENC_EVENT_CCW:
+                // COUNTER-CLOCKWISE (Previous Screen)
+                if (lcdValue == 0) lcdValue = 4;
+                else lcdValue--;
+                flag_update_lcd = 1;
+                break;
+
+            case ENC_EVENT_CLICK:
+                flag_sd_toggle = 1;      // Request start/stop logging
+                flag_update_lcd = 1;     // Request redraw (to update icon)
+                break;
+        }
+    }
+}
+
+uint8_t logger_ui_busy(void)
 {
-    uint8_t buf[3];
-    // Read 3 bytes (sec, min, hour) from RTC via I2C
-    twi_readfrom_mem_into(RTC_ADR, RTC_SEC_MEM, buf, 3);
-
-    uint8_t sec  = bcd2dec(buf[0] & 0x7F);
-    uint8_t min  = bcd2dec(buf[1]);
-    uint8_t hour = bcd2dec(buf[2] & 0x3F);
-
-    // Atomic write to global structure
-    uint8_t sreg = SREG; cli();
-    g_time.hh = hour;
-    g_time.mm = min;
-    g_time.ss = sec;
-    SREG = sreg;
+    return enc_head != enc_tail || flag_update_lcd || flag_sd_toggle;
 }
 
+/* ==========================================
+ * LCD Drawing
+ * ========================================== */
+
 void logger_display_draw(void)
 {
     // Clear flag
@@ -184,6 +250,7 @@ void logger_display_draw(void)
         case 1: lcd_i2c_puts("PRESS  "); break;
         case 2: lcd_i2c_puts("HUMID  "); break;
         case 3: lcd_i2c_puts("LIGHT  "); break;
+        case 4: lcd_i2c_puts("BATT   "); break;
     }
 
     // Display SD icon and time
@@ -196,30 +263,36 @@ void logger_display_draw(void)
 
     switch (lcdValue)
     {
-        case 0: // Temperature
-            dtostrf(g_T, 6, 1, valStr);
+        case 0: // Temperature (0.01 °C -> 0.1 °C)
+            fmt_fixed(valStr, fixed_div_round(g_sample.temp, 10), 1, 6);
             lcd_i2c_puts(valStr);
             lcd_i2c_puts(" \xDF""C   "); // \xDF is degree symbol on HD44780
             break;
 
-        case 1: // Pressure
-            dtostrf(g_P, 7, 1, valStr);
+        case 1: // Pressure (Pa -> 0.1 hPa)
+            fmt_fixed(valStr, fixed_div_round(g_sample.press, 10), 1, 7);
             lcd_i2c_puts(valStr);
             lcd_i2c_puts(" hPa  ");
             break;
 
-        case 2: // Humidity
-            dtostrf(g_H, 6, 1, valStr);
+        case 2: // Humidity (0.01 % -> 0.1 %)
+            fmt_fixed(valStr, fixed_div_round(g_sample.hum, 10), 1, 6);
             lcd_i2c_puts(valStr);
             lcd_i2c_puts(" %    ");
             break;
 
         case 3: // Light (raw/percent)
-            sprintf(valStr, "%u", g_Light);
+            sprintf(valStr, "%u", g_sample.light);
             lcd_i2c_puts(valStr);
             lcd_i2c_puts(" %      ");
             break;
 
+        case 4: // Battery (mV -> 0.01 V)
+            fmt_fixed(valStr, fixed_div_round(g_sample.batt, 10), 2, 5);
+            lcd_i2c_puts(valStr);
+            lcd_i2c_puts(" V     ");
+            break;
+
         default:
             lcd_i2c_puts("Error           ");
             break;
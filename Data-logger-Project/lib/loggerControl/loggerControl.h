@@ -16,39 +16,39 @@
 
 #include <stdint.h>
 #include "ds1302.h"   /* DS1302 time type (ds1302_time_t) and API */
+#include "sampler.h"  /* Sample record type (sample_t) */
 
 /* --- Global Variables (Shared State) --- */
 
-/** @brief Global shared temperature value in degrees Celsius. */
-extern volatile float g_T;
-
-/** @brief Global shared pressure value in hPa. */
-extern volatile float g_P;
-
-/** @brief Global shared humidity value in %. */
-extern volatile float g_H;
-
-/** @brief Global shared light intensity (raw or percentage). */
-extern volatile uint16_t g_Light;
+/**
+ * @brief Global shared sensor values (fixed-point, see sample_t).
+ * Updated once per sampler output period.
+ */
+extern volatile sample_t g_sample;
 
 /**
- * @brief Simplified structure for holding system time (HH:MM:SS).
+ * @brief Simplified structure for holding system time (HH:MM:SS.mmm) and date.
  * Used for display and logging purposes to save RAM compared to full RTC struct.
  */
 typedef struct {
-    uint8_t hh; /**< Hours (0-23) */
-    uint8_t mm; /**< Minutes (0-59) */
-    uint8_t ss; /**< Seconds (0-59) */
+    uint8_t hh;    /**< Hours (0-23) */
+    uint8_t mm;    /**< Minutes (0-59) */
+    uint8_t ss;    /**< Seconds (0-59) */
+    uint8_t date;  /**< Day of month (1-31) */
+    uint8_t month; /**< Month (1-12) */
+    uint8_t year;  /**< Year (00-99) */
+    uint16_t ms;   /**< Milliseconds (0-999) */
+    uint32_t sec;  /**< Seconds since 2000-01-01 00:00:00 (same instant) */
 } rtc_time_t;
 
-/** @brief Global shared system time. Updated periodically from RTC. */
+/** @brief Global shared system time. Updated from the software calendar clock. */
 extern volatile rtc_time_t g_time;
 
 /* --- UI Control Variables --- */
 
 /**
  * @brief Current value index displayed on LCD.
- * 0 = Temperature, 1 = Pressure, 2 = Humidity, 3 = Light.
+ * 0 = Temperature, 1 = Pressure, 2 = Humidity, 3 = Light, 4 = Battery.
  */
 extern volatile uint8_t lcdValue;
 
@@ -58,6 +58,22 @@ extern volatile uint8_t lcdValue;
  */
 extern volatile uint8_t flag_update_lcd;
 
+/**
+ * @brief Number of encoder events lost because the event queue was full.
+ */
+extern volatile uint8_t enc_dropped;
+
+/**
+ * @name Encoder Events
+ * Queued by the PCINT2 interrupt, read with logger_encoder_get_event().
+ * @{
+ */
+#define ENC_EVENT_NONE  0   /**< Queue empty */
+#define ENC_EVENT_CW    1   /**< One detent clockwise */
+#define ENC_EVENT_CCW   2   /**< One detent counter-clockwise */
+#define ENC_EVENT_CLICK 3   /**< Button pressed (debounced) */
+/** @} */
+
 /* --- Function Prototypes --- */
 
 /**
@@ -68,30 +84,41 @@ void logger_display_init(void);
 /**
  * @brief Render the current screen content to the I2C LCD.
  *
- * Reads the `g_time` and the sensor value selected by `lcdValue`.
+ * Reads the `g_time` and the value of `g_sample` selected by `lcdValue`.
  * Also displays the recording status icon.
  */
 void logger_display_draw(void);
 
 /**
- * @brief Initialize rotary encoder GPIO pins and internal pull-ups.
+ * @brief Initialize rotary encoder GPIO pins, internal pull-ups and the
+ * PCINT2 pin change interrupt on PD5/PD6/PD7.
+ *
+ * Events are queued once global interrupts are enabled.
  */
 void logger_encoder_init(void);
 
 /**
- * @brief Poll the rotary encoder status.
+ * @brief  Take the oldest event from the encoder queue.
+ * @return ENC_EVENT_CW, ENC_EVENT_CCW, ENC_EVENT_CLICK, or ENC_EVENT_NONE if empty.
+ */
+uint8_t logger_encoder_get_event(void);
+
+/**
+ * @brief Handle all queued encoder events.
  *
- * This function handles the state machine for rotation (debouncing)
- * and checks the button press state. It updates `lcdValue` and `flag_update_lcd`.
- * Should be called frequently from the main loop.
+ * Rotation selects the displayed quantity (`lcdValue`), a click requests
+ * a logging toggle (`flag_sd_toggle`); both set `flag_update_lcd`.
+ * Called from the main loop; edges are captured by the interrupt, so
+ * the call rate only affects UI latency.
  */
 void logger_encoder_poll(void);
 
 /**
- * @brief Read current time from DS1302 RTC and update the global `g_time` structure.
- * Uses I2C/TWI communication (note: standard DS1302 is SPI-like, ensuring driver match).
+ * @brief  Check for UI work that has not been handled yet.
+ * @return 1 if encoder events are queued or a redraw or logging toggle is
+ *         requested, 0 otherwise.
  */
-void logger_rtc_read_time(void);
+uint8_t logger_ui_busy(void);
 
 #endif /* LOGGER_CONTROL_H */
 
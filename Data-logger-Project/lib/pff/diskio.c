@@ -20,6 +20,9 @@
 
 #include <avr/io.h>
 #include "diskio.h"
+#if DISKIO_BENCH
+#include <avr/interrupt.h>
+#endif
 
 /* Optional: Include UART for debugging (uncomment if needed) */
 /* #include "uart.h" */
@@ -53,6 +56,7 @@
 #define CMD16   (16)        /**< SET_BLOCKLEN: Set block length (for non-SDHC) */
 #define CMD17   (17)        /**< READ_SINGLE_BLOCK: Read a single block (512 bytes) */
 #define CMD24   (24)        /**< WRITE_BLOCK: Write a single block (512 bytes) */
+#define CMD25   (25)        /**< WRITE_MULTIPLE_BLOCK: Write blocks until Stop Tran token */
 #define CMD55   (55)        /**< APP_CMD: Leading command for ACMD commands */
 #define CMD58   (58)        /**< READ_OCR: Read Operation Conditions Register */
 #define ACMD41  (0x80+41)   /**< SEND_OP_COND: Initiate initialization process (SDC) */
@@ -78,12 +82,34 @@
 #define DESELECT()  CS_PORT |=  _BV(CS_PIN) /**< Deassert CS (Set High) to disable card */
 /** @} */
 
+/**
+ * @name Busy State Flags
+ * @brief Pending card work tracked between disk_writep() and disk_busy().
+ * @{
+ */
+#define BSY_PROG    0x01    /**< Card holds DO low while it programs flash */
+#define BSY_STOP    0x02    /**< Stop Tran token queued until the card is ready */
+/** @} */
+
 
 /** * @brief Global variable storing the detected card type.
  * Initialized by disk_initialize().
  */
 static BYTE CardType;
 
+/** * @brief Pending card work (BSY_PROG, BSY_STOP).
+ * Set when a sector is committed, cleared by disk_busy() once the card is ready.
+ */
+static BYTE Busy;
+
+#if PF_USE_STREAM
+/** * @brief Sector expected next by the open CMD25 session (0 = no session).
+ * Set by disk_writep() when a multi-block write is started, cleared by
+ * disk_stop_write().
+ */
+static DWORD StreamNext;
+#endif
+
 
 /* -- SPI Helper Functions ------------------------------------------- */
 
@@ -134,6 +160,107 @@ static BYTE rcv_spi(void)
     return SPDR;
 }
 
+/** @brief Wait until the byte in flight has been shifted out. */
+#define SPI_WAIT()  loop_until_bit_is_set(SPSR, SPIF)
+
+/**
+ * @brief Transmit a block of bytes via SPI.
+ * * The next byte is fetched while the current one is shifting, and SPDR
+ * is reloaded as soon as SPIF is set, so the bus has no idle gap between
+ * bytes. The loop is unrolled by four to spread the loop overhead.
+ * * @param p Data to transmit.
+ * @param n Number of bytes.
+ */
+static void spi_send_block(const BYTE *p, UINT n)
+{
+    BYTE d;
+
+    if (!n) return;
+    SPDR = *p++;
+    n--;
+    while (n >= 4) {
+        d = p[0]; SPI_WAIT(); SPDR = d;
+        d = p[1]; SPI_WAIT(); SPDR = d;
+        d = p[2]; SPI_WAIT(); SPDR = d;
+        d = p[3]; SPI_WAIT(); SPDR = d;
+        p += 4; n -= 4;
+    }
+    while (n--) {
+        d = *p++; SPI_WAIT(); SPDR = d;
+    }
+    SPI_WAIT();
+}
+
+/**
+ * @brief Receive a block of bytes via SPI.
+ * * The dummy byte for the next transfer is sent right after the received
+ * byte is read, and the byte is stored while the next one is shifting.
+ * Unrolled by four like spi_send_block().
+ * * @param p Buffer for the received data.
+ * @param n Number of bytes (at least 1).
+ */
+static void spi_recv_block(BYTE *p, UINT n)
+{
+    BYTE d;
+
+    SPDR = 0xFF;
+    n--;
+    while (n >= 4) {
+        SPI_WAIT(); d = SPDR; SPDR = 0xFF; p[0] = d;
+        SPI_WAIT(); d = SPDR; SPDR = 0xFF; p[1] = d;
+        SPI_WAIT(); d = SPDR; SPDR = 0xFF; p[2] = d;
+        SPI_WAIT(); d = SPDR; SPDR = 0xFF; p[3] = d;
+        p += 4; n -= 4;
+    }
+    while (n--) {
+        SPI_WAIT(); d = SPDR; SPDR = 0xFF; *p++ = d;
+    }
+    SPI_WAIT();
+    *p = SPDR;
+}
+
+/**
+ * @brief Clock in and discard n bytes via SPI.
+ * * Same back-to-back timing as spi_recv_block() without the store.
+ * * @param n Number of bytes.
+ */
+static void spi_skip(UINT n)
+{
+    if (!n) return;
+    SPDR = 0xFF;
+    n--;
+    while (n >= 4) {
+        SPI_WAIT(); SPDR = 0xFF;
+        SPI_WAIT(); SPDR = 0xFF;
+        SPI_WAIT(); SPDR = 0xFF;
+        SPI_WAIT(); SPDR = 0xFF;
+        n -= 4;
+    }
+    while (n--) {
+        SPI_WAIT(); SPDR = 0xFF;
+    }
+    SPI_WAIT();
+    (void)SPDR;
+}
+
+
+/**
+ * @brief Block until all pending card work has finished.
+ * * Completes a deferred sector commit or Stop Tran. Used before any
+ * operation that needs the card ready, so callers that polled
+ * disk_busy() to completion never wait here.
+ * * @return Operation result:
+ * @retval RES_OK      Card is ready.
+ * @retval RES_ERROR   Card stayed busy (timeout).
+ */
+static DRESULT wait_idle(void)
+{
+    UINT tmr;
+
+    for (tmr = 65000; disk_busy() && tmr; tmr--) ;
+    return Busy ? RES_ERROR : RES_OK;
+}
+
 
 /* -- SD Card Internal Functions ------------------------------------- */
 
@@ -151,6 +278,9 @@ static BYTE send_cmd(BYTE cmd, DWORD arg)
 {
     BYTE n, res;
 
+    /* Finish a deferred write before talking to the card */
+    if (Busy && wait_idle()) return 0xFF;
+
     /* ACMD<n> is the command sequense of CMD55-CMD<n> */
     if (cmd & 0x80) {
         cmd &= 0x7F;
@@ -210,6 +340,12 @@ DSTATUS disk_initialize(void)
 
     /* uart_puts("DISK: Init start\r\n"); */
     spi_init();
+
+    /* Forget write state left over from a previous session */
+    Busy = 0;
+#if PF_USE_STREAM
+    StreamNext = 0;
+#endif
     
     /* Extra delay for power stabilization */
     for(volatile long i=0; i<10000; i++); 
@@ -299,6 +435,9 @@ DRESULT disk_readp(BYTE* buff, DWORD sector, UINT offset, UINT count)
     UINT bc;
 
     if (!(count)) return RES_PARERR;
+#if PF_USE_STREAM
+    disk_stop_write();  /* Card cannot read inside a CMD25 session */
+#endif
     if (!(CardType & CT_BLOCK)) sector *= 512; /* Convert to byte address if not block addressing */
 
     res = RES_ERROR;
@@ -308,19 +447,14 @@ DRESULT disk_readp(BYTE* buff, DWORD sector, UINT offset, UINT count)
 
         if (rc == 0xFE) { /* Data Token received */
             bc = 512 + 2 - offset - count;
-            
-            /* Skip leading bytes */
-            while (offset--) rcv_spi();
-            
-            /* Read requested data */
+
             if (buff) {
-                do { *buff++ = rcv_spi(); } while (--count);
+                spi_skip(offset);               /* Skip leading bytes */
+                spi_recv_block(buff, count);    /* Read requested data */
+                spi_skip(bc);                   /* Skip trailing bytes and CRC */
             } else {
-                do { rcv_spi(); } while (--count);
+                spi_skip(512 + 2);
             }
-            
-            /* Skip trailing bytes and CRC */
-            do rcv_spi(); while (--bc);
             res = RES_OK;
         }
     }
@@ -329,11 +463,75 @@ DRESULT disk_readp(BYTE* buff, DWORD sector, UINT offset, UINT count)
     return res;
 }
 
+#if PF_USE_CLMT
+/**
+ * @brief Read a sector range in chunks with one command.
+ * * Used to check a whole FAT sector of cluster links with a single CMD17
+ * and a small buffer. The chunks are consumed while the card is selected;
+ * once the consumer returns 0, the rest of the sector is clocked out
+ * without storing it.
+ * * @param buff   Chunk buffer.
+ * @param size   Size of the chunk buffer.
+ * @param sector Sector number (LBA).
+ * @param offset Byte offset within the sector to start reading from.
+ * @param count  Number of bytes to read.
+ * @param func   Chunk consumer, returns 0 to stop.
+ * @return Operation result:
+ * @retval RES_OK      Success.
+ * @retval RES_ERROR   Read error or timeout.
+ * @retval RES_PARERR  Invalid parameter.
+ */
+DRESULT disk_scanp(BYTE* buff, UINT size, DWORD sector, UINT offset, UINT count,
+                   UINT (*func)(const BYTE*, UINT))
+{
+    DRESULT res;
+    BYTE rc;
+    UINT bc, n;
+
+    if (!count || !size || offset + count > 512) return RES_PARERR;
+#if PF_USE_STREAM
+    disk_stop_write();  /* Card cannot read inside a CMD25 session */
+#endif
+    if (!(CardType & CT_BLOCK)) sector *= 512; /* Convert to byte address if not block addressing */
+
+    res = RES_ERROR;
+    if (send_cmd(CMD17, sector) == 0) { /* READ_SINGLE_BLOCK */
+        bc = 30000;
+        do { rc = rcv_spi(); } while (rc == 0xFF && --bc);
+
+        if (rc == 0xFE) { /* Data Token received */
+            bc = 512 + 2 - offset;
+            spi_skip(offset);               /* Skip leading bytes */
+            while (count) {
+                n = (count < size) ? count : size;
+                spi_recv_block(buff, n);    /* Read one chunk */
+                bc -= n;
+                count -= n;
+                if (!func(buff, n)) break;
+            }
+            spi_skip(bc);                   /* Skip the rest and CRC */
+            res = RES_OK;
+        }
+    }
+    DESELECT();
+    rcv_spi();
+    return res;
+}
+#endif
+
 /**
  * @brief Write partial sector to the disk.
  * * Writes data to a sector on the SD card. If `buff` is provided, data is written.
  * If `buff` is NULL and `sc` is non-zero, a Write Block command is initiated.
  * If `buff` is NULL and `sc` is zero, the write transaction is finalized.
+ * * With PF_USE_STREAM the sector is written inside a CMD25 multi-block
+ * session. A session is opened on the first sector and kept open while the
+ * following sectors are consecutive, so each of them only costs a Data
+ * Token instead of a full command round trip. A non-consecutive sector
+ * closes the session and opens a new one.
+ * * Finalizing does not wait for the card to program the sector. The call
+ * returns once the block is accepted; use disk_busy() to poll for the
+ * end of programming. The next command waits for it if still pending.
  * * @param buff Pointer to the data to be written.
  * @param sc   Sector number (LBA) or control flag.
  * @return Operation result:
@@ -351,13 +549,36 @@ DRESULT disk_writep(const BYTE* buff, DWORD sc)
     if (buff) {
         /* Send data bytes */
         bc = (UINT)sc;
-        while (bc && wc) {
-            xmit_spi(*buff++);
-            wc--; bc--;
-        }
+        if (bc > wc) bc = wc;
+        spi_send_block(buff, bc);
+        wc -= bc;
         res = RES_OK;
     } else {
         if (sc) {
+#if PF_USE_STREAM
+            if (StreamNext && sc == StreamNext) {
+                /* Continue the open session with the next block */
+                if (wait_idle() == RES_OK) {
+                    SELECT();
+                    xmit_spi(0xFF); xmit_spi(0xFC); /* Multi-block Start Token */
+                    StreamNext++;
+                    wc = 512;
+                    res = RES_OK;
+                }
+            } else {
+                /* Open a new session at this sector */
+                disk_stop_write();
+                StreamNext = sc + 1;
+                if (!(CardType & CT_BLOCK)) sc *= 512;
+                if (send_cmd(CMD25, sc) == 0) {
+                    xmit_spi(0xFF); xmit_spi(0xFC); /* Multi-block Start Token */
+                    wc = 512;
+                    res = RES_OK;
+                } else {
+                    StreamNext = 0;
+                }
+            }
+#else
             /* Initiate Write Sector */
             if (!(CardType & CT_BLOCK)) sc *= 512;
             if (send_cmd(CMD24, sc) == 0) {
@@ -365,6 +586,7 @@ DRESULT disk_writep(const BYTE* buff, DWORD sc)
                 wc = 512;
                 res = RES_OK;
             }
+#endif
         } else {
             /* Finalize Write */
             bc = wc + 2;
@@ -372,15 +594,115 @@ DRESULT disk_writep(const BYTE* buff, DWORD sc)
             
             /* Check data response (xxxx0101 = accepted) */
             if ((rcv_spi() & 0x1F) == 0x05) {
-                /* Wait for busy state to end */
-                for (bc = 65000; rcv_spi() != 0xFF && bc; bc--) ;
-                if (bc) res = RES_OK;
+                /* Card programs the block now; disk_busy() tracks the end */
+                Busy |= BSY_PROG;
+                res = RES_OK;
             }
             DESELECT();
             rcv_spi();
+#if PF_USE_STREAM
+            if (res != RES_OK) disk_stop_write(); /* Abort the session on a rejected block */
+#endif
         }
     }
     return res;
 }
 
+/**
+ * @brief Poll the card busy state without blocking.
+ * * Samples DO once. When the card has finished programming, a queued
+ * Stop Tran token is sent (which makes the card busy once more) or the
+ * busy state is cleared.
+ * * @return Non-zero while a committed write is still in progress.
+ */
+BYTE disk_busy(void)
+{
+    if (Busy) {
+        SELECT();
+        if (rcv_spi() == 0xFF) {        /* DO released: card is ready */
+            if (Busy & BSY_STOP) {
+                xmit_spi(0xFD);         /* Stop Tran token */
+                rcv_spi();              /* Skip a stuff byte */
+                Busy = BSY_PROG;        /* Busy until the session is closed */
+            } else {
+                Busy = 0;
+            }
+        }
+        DESELECT();
+        rcv_spi();
+    }
+    return Busy;
+}
+
+#if PF_USE_STREAM
+/**
+ * @brief Close the open multi-block write session.
+ * * Queues the Stop Tran token. It is sent right away when the card is
+ * ready, otherwise by disk_busy() or by the next command once the
+ * current block has been programmed. Does nothing when no session is
+ * open. Any pending sector must be finalized with disk_writep(0, 0)
+ * before calling this.
+ * * @return RES_OK (a card that never gets ready is reported by the next command).
+ */
+DRESULT disk_stop_write(void)
+{
+    if (StreamNext) {
+        StreamNext = 0;
+        Busy |= BSY_STOP;
+        disk_busy();
+    }
+    return RES_OK;
+}
+#endif
+
+#if DISKIO_BENCH
+/**
+ * @brief Measure the SPI transfer kernels in CPU cycles.
+ * * Times 512-byte transfers with Timer1 at the CPU clock (interrupts
+ * off), once with the per-byte xmit_spi()/rcv_spi() loops and once with
+ * the block kernels. SPI runs at f_osc/2 with the card deselected, so no
+ * card is needed. Call disk_initialize() afterwards before using the card.
+ * * @param r Returns the cycle counts.
+ */
+void disk_bench(disk_bench_t *r)
+{
+    static BYTE buf[512];
+    BYTE sreg = SREG;
+    BYTE tccr1a = TCCR1A, tccr1b = TCCR1B;
+    UINT n;
+
+    spi_init();
+    SPCR &= ~(_BV(SPR1) | _BV(SPR0));
+    SPSR |= _BV(SPI2X);
+
+    cli();
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);             /* Count CPU cycles */
+
+    TCNT1 = 0;
+    for (n = 0; n < 512; n++) xmit_spi(buf[n]);
+    r->send_byte = TCNT1;
+
+    TCNT1 = 0;
+    spi_send_block(buf, 512);
+    r->send_block = TCNT1;
+
+    TCNT1 = 0;
+    for (n = 0; n < 512; n++) buf[n] = rcv_spi();
+    r->recv_byte = TCNT1;
+
+    TCNT1 = 0;
+    spi_recv_block(buf, 512);
+    r->recv_block = TCNT1;
+
+    TCNT1 = 0;
+    spi_skip(512);
+    r->skip_block = TCNT1;
+
+    TCCR1B = tccr1b;
+    TCCR1A = tccr1a;
+    SREG = sreg;
+}
+#endif
+
 /** @} */ // End of addtogroup pff_driver
\ No newline at end of file
@@ -56,6 +56,25 @@ DSTATUS disk_initialize(void);
  */
 DRESULT disk_readp(BYTE* buff, DWORD sector, UINT offset, UINT count);
 
+#if PF_USE_CLMT
+/**
+ * @brief  Read a sector range in chunks with one command.
+ *
+ * Each chunk of up to 'size' bytes is passed to 'func'; when it returns 0,
+ * the rest of the sector is skipped.
+ *
+ * @param  buff   Chunk buffer.
+ * @param  size   Size of the chunk buffer.
+ * @param  sector Sector number (LBA).
+ * @param  offset Offset in the sector.
+ * @param  count  Number of bytes to read.
+ * @param  func   Chunk consumer (0 = stop).
+ * @return Result code (DRESULT).
+ */
+DRESULT disk_scanp(BYTE* buff, UINT size, DWORD sector, UINT offset, UINT count,
+                   UINT (*func)(const BYTE*, UINT));
+#endif
+
 /**
  * @brief  Write partial sector to the disk.
  * @param  buff Pointer to the data to be written.
@@ -64,6 +83,45 @@ DRESULT disk_readp(BYTE* buff, DWORD sector, UINT offset, UINT count);
  */
 DRESULT disk_writep(const BYTE* buff, DWORD sc);
 
+/**
+ * @brief  Poll whether the card is still programming a committed sector.
+ * @return Non-zero while busy, 0 when the card is ready.
+ */
+BYTE disk_busy(void);
+
+#if PF_USE_STREAM
+/**
+ * @brief  Close the open multi-block (CMD25) write session.
+ * @return Result code (DRESULT).
+ */
+DRESULT disk_stop_write(void);
+#endif
+
+/**
+ * @brief Build the SPI kernel cycle benchmark (disk_bench()).
+ * Enable with -DDISKIO_BENCH=1 in build_flags.
+ */
+#ifndef DISKIO_BENCH
+#define DISKIO_BENCH 0
+#endif
+
+#if DISKIO_BENCH
+/** @brief CPU cycles for one 512-byte transfer. */
+typedef struct {
+    WORD send_byte;     /**< xmit_spi() loop */
+    WORD send_block;    /**< Block transmit kernel */
+    WORD recv_byte;     /**< rcv_spi() loop */
+    WORD recv_block;    /**< Block receive kernel */
+    WORD skip_block;    /**< Block skip kernel */
+} disk_bench_t;
+
+/**
+ * @brief  Time the SPI transfer kernels with Timer1 (no card needed).
+ * @param  r Returns the cycle counts.
+ */
+void disk_bench(disk_bench_t *r);
+#endif
+
 /* Disk Status Bits */
 #define STA_NOINIT      0x01    /**< Drive not initialized */
 #define STA_NODISK      0x02    /**< No medium in the drive */
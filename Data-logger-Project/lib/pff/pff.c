@@ -483,6 +483,128 @@ static CLUST get_fat (	/* 1:IO error, Else:Cluster status */
 
 
 
+#if PF_USE_CLMT
+/*-----------------------------------------------------------------------*/
+/* Cluster map - Check the links of one FAT sector                       */
+/*-----------------------------------------------------------------------*/
+
+static CLUST scan_clst;	/* Last cluster of the contiguous run so far */
+static CLUST scan_nxt;	/* Link that ended the run */
+static BYTE scan_end;	/* The run ended inside the scanned sector */
+
+static UINT scan_links (	/* 0:Stop reading the sector */
+	const BYTE* buf,	/* Chunk of FAT entries */
+	UINT n				/* Number of bytes in the chunk */
+)
+{
+	CLUST nxt;
+	UINT w = (FatFs->fs_type == FS_FAT32) ? 4 : 2;
+
+
+	for ( ; n >= w; n -= w, buf += w) {
+#if PF_FS_FAT32
+		nxt = (w == 4) ? ld_dword(buf) & 0x0FFFFFFF : ld_word(buf);
+#else
+		nxt = ld_word(buf);
+#endif
+		if (nxt != scan_clst + 1 || nxt >= FatFs->n_fatent) {
+			scan_nxt = nxt;
+			scan_end = 1;
+			return 0;
+		}
+		scan_clst = nxt;
+	}
+	return 1;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Cluster map - Extend the map by one FAT sector                        */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT clmt_extend (void)
+{
+	BYTE buf[64];
+	BYTE n;
+	CLUST clst;
+	FATFS *fs = FatFs;
+
+
+	n = fs->clmt_n - 1;
+	clst = fs->clmt_start[n] + fs->clmt_len[n] - 1;	/* Last mapped cluster */
+	scan_clst = clst;
+	scan_end = 0;
+
+	switch (fs->fs_type) {		/* One command checks the links up to the end of the FAT sector */
+#if PF_FS_FAT32
+	case FS_FAT32 :
+		if (disk_scanp(buf, sizeof buf, fs->fatbase + clst / 128,
+				((UINT)clst % 128) * 4, (128 - (UINT)clst % 128) * 4, scan_links)) return FR_DISK_ERR;
+		break;
+#endif
+#if PF_FS_FAT16
+	case FS_FAT16 :
+		if (disk_scanp(buf, sizeof buf, fs->fatbase + clst / 256,
+				((UINT)clst % 256) * 2, (256 - (UINT)clst % 256) * 2, scan_links)) return FR_DISK_ERR;
+		break;
+#endif
+	default :					/* FAT12: one link at a time */
+		scan_nxt = get_fat(clst);
+		if (scan_nxt == 1) return FR_DISK_ERR;
+		if (scan_nxt != clst + 1 || scan_nxt >= fs->n_fatent) {
+			scan_end = 1;
+		} else {
+			scan_clst = scan_nxt;
+		}
+	}
+
+	fs->clmt_len[n] += scan_clst - clst;
+	if (scan_end) {
+		if (scan_nxt >= 2 && scan_nxt < fs->n_fatent && fs->clmt_n < PF_CLMT_SIZE) {
+			fs->clmt_start[fs->clmt_n] = scan_nxt;	/* Start the next extent */
+			fs->clmt_len[fs->clmt_n++] = 1;
+		} else {
+			fs->clmt_end = 1;	/* End of chain or map full: the rest is followed with get_fat() */
+		}
+	}
+
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Cluster map - Get cluster# of a cluster index in the file             */
+/*-----------------------------------------------------------------------*/
+
+static CLUST clmt_clust (	/* Cluster# (0:Not in the map) */
+	DWORD ci		/* Cluster index from top of the file */
+)
+{
+	BYTE i;
+	FATFS *fs = FatFs;
+
+
+	for (i = 0; i < fs->clmt_n; i++) {
+		while (ci >= fs->clmt_len[i] && i == fs->clmt_n - 1 && !fs->clmt_end) {
+			if (clmt_extend() != FR_OK) {	/* Map up to ci as the file pointer gets there */
+				fs->clmt_end = 1;			/* get_fat() reports the error */
+				return 0;
+			}
+		}
+		if (ci < fs->clmt_len[i]) return fs->clmt_start[i] + ci;
+		ci -= fs->clmt_len[i];
+	}
+	return 0;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Get sector# from cluster# / Get cluster field from directory entry    */
 /*-----------------------------------------------------------------------*/
@@ -599,21 +721,52 @@ static FRESULT dir_find (
 {
 	FRESULT res;
 	BYTE c;
+#if PF_USE_DIRHINT
+	FATFS *fs = FatFs;
+	BYTE hint = 0;
+#endif
 
 
-	res = dir_rewind(dj);			/* Rewind directory object */
-	if (res != FR_OK) return res;
+#if PF_USE_DIRHINT
+	if (fs->hint_sect && fs->hint_sclust == dj->sclust) {	/* Start at the last opened entry (files opened in directory order) */
+		dj->index = fs->hint_index;
+		dj->clust = fs->hint_clust;
+		dj->sect = fs->hint_sect;
+		hint = 1;
+	} else
+#endif
+	{
+		res = dir_rewind(dj);			/* Rewind directory object */
+		if (res != FR_OK) return res;
+	}
 
-	do {
+	for (;;) {
 		res = disk_readp(dir, dj->sect, (dj->index % 16) * 32, 32)	/* Read an entry */
 			? FR_DISK_ERR : FR_OK;
 		if (res != FR_OK) break;
 		c = dir[DIR_Name];	/* First character */
-		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
-		if (!(dir[DIR_Attr] & AM_VOL) && !mem_cmp(dir, dj->fn, 11)) break;	/* Is it a valid entry? */
-		res = dir_next(dj);					/* Next entry */
-	} while (res == FR_OK);
+		if (c == 0) res = FR_NO_FILE;	/* Reached to end of table */
+		else if (!(dir[DIR_Attr] & AM_VOL) && !mem_cmp(dir, dj->fn, 11)) break;	/* Is it a valid entry? */
+		else res = dir_next(dj);		/* Next entry */
+		if (res == FR_OK) continue;
+#if PF_USE_DIRHINT
+		if (res == FR_NO_FILE && hint) {	/* Not after the hint: search the whole table */
+			hint = 0;
+			res = dir_rewind(dj);
+			if (res == FR_OK) continue;
+		}
+#endif
+		break;
+	}
 
+#if PF_USE_DIRHINT
+	if (res == FR_OK) {					/* Remember the entry for the next search */
+		fs->hint_index = dj->index;
+		fs->hint_sclust = dj->sclust;
+		fs->hint_clust = dj->clust;
+		fs->hint_sect = dj->sect;
+	}
+#endif
 	return res;
 }
 
@@ -836,6 +989,7 @@ FRESULT pf_mount (
 
 
 	FatFs = 0;
+	if (!fs) return FR_OK;				/* Unregister only */
 
 	if (disk_initialize() & STA_NOINIT) {	/* Check if the drive is ready or not */
 		return FR_NOT_READY;
@@ -890,6 +1044,9 @@ FRESULT pf_mount (
 	fs->database = fs->fatbase + fsize + fs->n_rootdir / 16;	/* Data start sector (lba) */
 
 	fs->flag = 0;
+#if PF_USE_DIRHINT
+	fs->hint_sect = 0;
+#endif
 	FatFs = fs;
 
 	return FR_OK;
@@ -923,6 +1080,12 @@ FRESULT pf_open (
 	fs->org_clust = get_clust(dir);		/* File start cluster */
 	fs->fsize = ld_dword(dir+DIR_FileSize);	/* File size */
 	fs->fptr = 0;						/* File pointer */
+#if PF_USE_CLMT
+	fs->clmt_start[0] = fs->org_clust;	/* Start the map; extents are found as fptr moves */
+	fs->clmt_len[0] = 1;
+	fs->clmt_n = 1;
+	fs->clmt_end = (fs->org_clust < 2 || fs->org_clust >= fs->n_fatent);
+#endif
 	fs->flag = FA_OPENED;
 
 	return FR_OK;
@@ -964,6 +1127,10 @@ FRESULT pf_read (
 				if (fs->fptr == 0) {				/* On the top of the file? */
 					clst = fs->org_clust;
 				} else {
+#if PF_USE_CLMT
+					clst = clmt_clust(fs->fptr / 512 / fs->csize);	/* Look up the map first */
+					if (!clst)
+#endif
 					clst = get_fat(fs->curr_clust);
 				}
 				if (clst <= 1) ABORT(FR_DISK_ERR);
@@ -1002,7 +1169,7 @@ FRESULT pf_write (
 	CLUST clst;
 	DWORD sect, remain;
 	const BYTE *p = buff;
-	BYTE cs;
+	BYTE cs, rw = 0;
 	UINT wcnt;
 	FATFS *fs = FatFs;
 
@@ -1014,9 +1181,14 @@ FRESULT pf_write (
 	if (!btw) {		/* Finalize request */
 		if ((fs->flag & FA__WIP) && disk_writep(0, 0)) ABORT(FR_DISK_ERR);
 		fs->flag &= ~FA__WIP;
+#if PF_USE_STREAM
+		if (disk_stop_write()) ABORT(FR_DISK_ERR);	/* Close the multi-block session */
+#endif
+		fs->flag |= FA__PEND;						/* Card may still be programming */
 		return FR_OK;
 	} else {		/* Write data request */
 		if (!(fs->flag & FA__WIP)) {	/* Round-down fptr to the sector boundary */
+			if ((UINT)fs->fptr % 512) rw = 1;	/* Rewrite of a started sector: curr_clust is valid */
 			fs->fptr &= 0xFFFFFE00;
 		}
 	}
@@ -1026,10 +1198,14 @@ FRESULT pf_write (
 	while (btw)	{									/* Repeat until all data transferred */
 		if ((UINT)fs->fptr % 512 == 0) {			/* On the sector boundary? */
 			cs = (BYTE)(fs->fptr / 512 & (fs->csize - 1));	/* Sector offset in the cluster */
-			if (!cs) {								/* On the cluster boundary? */
+			if (!cs && !rw) {						/* On the cluster boundary? */
 				if (fs->fptr == 0) {				/* On the top of the file? */
 					clst = fs->org_clust;
 				} else {
+#if PF_USE_CLMT
+					clst = clmt_clust(fs->fptr / 512 / fs->csize);	/* FAT read only per FAT sector of links */
+					if (!clst)
+#endif
 					clst = get_fat(fs->curr_clust);
 				}
 				if (clst <= 1) ABORT(FR_DISK_ERR);
@@ -1038,6 +1214,7 @@ FRESULT pf_write (
 			sect = clust2sect(fs->curr_clust);		/* Get current sector */
 			if (!sect) ABORT(FR_DISK_ERR);
 			fs->dsect = sect + cs;
+			rw = 0;
 			if (disk_writep(0, fs->dsect)) ABORT(FR_DISK_ERR);	/* Initiate a sector write operation */
 			fs->flag |= FA__WIP;
 		}
@@ -1049,11 +1226,29 @@ FRESULT pf_write (
 		if ((UINT)fs->fptr % 512 == 0) {
 			if (disk_writep(0, 0)) ABORT(FR_DISK_ERR);	/* Finalize the currtent secter write operation */
 			fs->flag &= ~FA__WIP;
+			fs->flag |= FA__PEND;					/* Programming continues in the background */
 		}
 	}
 
 	return FR_OK;
 }
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Poll Pending Write                                                    */
+/*-----------------------------------------------------------------------*/
+
+BYTE pf_write_pending (void)
+{
+	FATFS *fs = FatFs;
+
+
+	if (!fs || !(fs->flag & FA__PEND)) return 0;	/* Nothing committed */
+	if (!disk_busy()) fs->flag &= ~FA__PEND;		/* Card has finished */
+
+	return (fs->flag & FA__PEND) ? 1 : 0;
+}
 #endif
 
 
@@ -1075,11 +1270,26 @@ FRESULT pf_lseek (
 	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
 	if (!(fs->flag & FA_OPENED)) return FR_NOT_OPENED;	/* Check if opened */
 
+#if PF_USE_STREAM
+	if (disk_stop_write()) ABORT(FR_DISK_ERR);	/* A seek ends the multi-block session */
+	fs->flag |= FA__PEND;
+#endif
 	if (ofs > fs->fsize) ofs = fs->fsize;	/* Clip offset with the file size */
 	ifptr = fs->fptr;
 	fs->fptr = 0;
 	if (ofs > 0) {
 		bcs = (DWORD)fs->csize * 512;		/* Cluster size (byte) */
+#if PF_USE_CLMT
+		clst = clmt_clust((ofs - 1) / bcs);	/* Cluster holding the last byte before ofs */
+		if (clst) {							/* Mapped: no chain walk needed */
+			fs->curr_clust = clst;
+			fs->fptr = ofs;
+			sect = clust2sect(clst);
+			if (!sect) ABORT(FR_DISK_ERR);
+			fs->dsect = sect + (fs->fptr / 512 & (fs->csize - 1));
+			return FR_OK;
+		}
+#endif
 		if (ifptr > 0 &&
 			(ofs - 1) / bcs >= (ifptr - 1) / bcs) {	/* When seek to same or following cluster, */
 			fs->fptr = (ifptr - 1) & ~(bcs - 1);	/* start from the current cluster */
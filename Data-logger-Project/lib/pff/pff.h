@@ -90,6 +90,18 @@ typedef struct {
 	CLUST	org_clust;	/**< File start cluster */
 	CLUST	curr_clust;	/**< File current cluster */
 	DWORD	dsect;		/**< File current data sector */
+#if PF_USE_CLMT
+	BYTE	clmt_n;		/**< Number of extents in the cluster map */
+	BYTE	clmt_end;	/**< Map complete (end of chain reached or map full) */
+	CLUST	clmt_start[PF_CLMT_SIZE];	/**< First cluster of each extent */
+	CLUST	clmt_len[PF_CLMT_SIZE];		/**< Number of clusters in each extent */
+#endif
+#if PF_USE_DIRHINT
+	WORD	hint_index;	/**< Directory index of the last opened file */
+	CLUST	hint_sclust;	/**< Start cluster of its directory (0:Root) */
+	CLUST	hint_clust;	/**< Directory cluster holding the entry */
+	DWORD	hint_sect;	/**< Directory sector holding the entry (0:No hint) */
+#endif
 } FATFS;
 
 
@@ -162,6 +174,15 @@ FRESULT pf_read (void* buff, UINT btr, UINT* br);
  */
 FRESULT pf_write (const void* buff, UINT btw, UINT* bw);
 
+/**
+ * @brief  Check whether a committed write is still being programmed.
+ *
+ * pf_write() returns as soon as the card has accepted a sector. Calling this
+ * from the main loop advances the pending commit without blocking.
+ * @return 1 while the card is busy, 0 when it is ready.
+ */
+BYTE pf_write_pending (void);
+
 /**
  * @brief  Move file pointer of the open file.
  * @param  ofs File pointer from top of file.
@@ -191,6 +212,7 @@ FRESULT pf_readdir (DIR* dj, FILINFO* fno);
 /* File status flag (FATFS.flag) */
 #define	FA_OPENED	0x01
 #define	FA_WPRT		0x02
+#define	FA__PEND	0x20
 #define	FA__WIP		0x40
 
 /* FAT sub type (FATFS.fs_type) */
@@ -28,6 +28,18 @@
 /** @brief Enable pf_write() function */
 #define PF_USE_WRITE    1
 
+/** @brief Keep a CMD25 multi-block write session open across sectors (needs PF_USE_WRITE) */
+#define PF_USE_STREAM   1
+
+/** @brief Map the contiguous extents of the open file as it is read, written or seeked, for FAT-free seeks */
+#define PF_USE_CLMT     1
+
+/** @brief Number of extents the cluster map can hold */
+#define PF_CLMT_SIZE    4
+
+/** @brief Start pf_open() directory searches at the entry of the last opened file */
+#define PF_USE_DIRHINT  1
+
 /*---------------------------------------------------------------------------/
 / File System Configurations
 /---------------------------------------------------------------------------*/
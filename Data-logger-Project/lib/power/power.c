@@ -0,0 +1,379 @@
+/**
+ * @file power.c
+ * @brief Sleep mode selection and duty-cycle statistics.
+ *
+ * Every power_idle() call closes an active interval (since the previous
+ * return) and opens a sleep interval; both are added to per-mode counters
+ * in milliseconds with a microsecond remainder, so the statistics cost no
+ * division in the loop.
+ */
+
+#include "power.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include "adc.h"
+#include "uart.h"
+
+/** @brief Watchdog period used to measure its oscillator (2^2 x 16 ms). */
+#define WDT_MEASURE_K 2
+/** @brief Longest watchdog period (2^9 x 16 ms = 8 s). */
+#define WDT_MAX_K 9
+/** @brief Crystal oscillator start-up after power-down (16K CK at 16 MHz) [us]. */
+#define POWER_STARTUP_US 1024
+
+/** @brief Registered busy check. */
+typedef struct {
+    const char *name;       /**< Name for the report */
+    power_busy_fn_t fn;     /**< Check function */
+    uint16_t vetoes;        /**< Idle calls kept out of the deep modes */
+} power_check_t;
+
+static power_check_t checks[POWER_MAX_CHECKS];
+static uint8_t n_checks;
+static power_clock_t clock_us;
+static power_quiet_fn_t quiet_ms;
+
+static uint32_t wdt_tick_us = 16000;    // Measured watchdog base period (nominal 16 ms)
+static volatile uint8_t wdt_fired;      // Set by the watchdog interrupt
+static uint16_t down_rem_us;            // Power-down time not yet returned [us]
+static volatile uint8_t down_pending;   // Early wake: the watchdog still runs
+static volatile uint32_t wdt_at_us;     // Clock when the watchdog fired
+static uint32_t wake_us;                // Clock at the early wake
+static uint32_t pending_period_us;      // Watchdog period of that power-down
+
+static uint32_t last_us;                // End of the previous power_idle()
+static uint32_t mode_ms[POWER_MODES];   // Time per mode [ms]
+static uint16_t mode_frac[POWER_MODES]; // Remainder [us]
+static uint32_t wakes_wdt;              // Power-downs ended by the watchdog
+static uint32_t wakes_early;            // Power-downs ended by a pin change
+
+/**
+ * @brief Watchdog interrupt: wake-up from power-down, or the end of the
+ * period after an early wake.
+ */
+ISR(WDT_vect)
+{
+    if (!wdt_fired) {
+        wdt_fired = 1;
+        if (down_pending) wdt_at_us = clock_us();
+    }
+}
+
+/** @brief Start the watchdog in interrupt mode with period 16 ms x 2^k. */
+static void wdt_start(uint8_t k)
+{
+    uint8_t bits = (k & 0x07) | ((k & 0x08) ? (1 << WDP3) : 0);
+    uint8_t sreg = SREG;
+
+    cli();
+    wdt_reset();
+    MCUSR &= ~(1 << WDRF);
+    // Timed sequence: change enable, then the new setting within 4 cycles
+    WDTCSR = (1 << WDCE) | (1 << WDE);
+    WDTCSR = (1 << WDIE) | bits;
+    SREG = sreg;
+}
+
+/** @brief Stop the watchdog. */
+static void wdt_stop(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+    wdt_reset();
+    MCUSR &= ~(1 << WDRF);
+    WDTCSR = (1 << WDCE) | (1 << WDE);
+    WDTCSR = 0;
+    SREG = sreg;
+}
+
+/** @brief Add an interval to the time of a mode. */
+static void add_us(uint8_t mode, uint32_t us)
+{
+    uint32_t t = mode_frac[mode] + us;
+
+    while (t >= 1000) {     // Normally one or two passes
+        t -= 1000;
+        mode_ms[mode]++;
+    }
+    mode_frac[mode] = (uint16_t)t;
+}
+
+/** @brief Run the busy checks; count the first busy driver. */
+static uint8_t drivers_busy(void)
+{
+    for (uint8_t i = 0; i < n_checks; i++) {
+        if (checks[i].fn()) {
+            if (checks[i].vetoes < 0xFFFF) checks[i].vetoes++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief  Power-down for the longest watchdog period within max_ms.
+ * @return Time slept [ms].
+ */
+static uint32_t power_down(uint32_t max_ms)
+{
+    if (max_ms > 10000) max_ms = 10000;
+
+    uint32_t max_us = max_ms * 1000;
+    uint8_t k = 0;
+    while (k < WDT_MAX_K && (wdt_tick_us << (k + 1)) <= max_us) k++;
+    uint32_t period_us = wdt_tick_us << k;
+
+    // The enabled ADC draws current even without a clock
+    adc_suspend();
+    wdt_fired = 0;
+    wdt_start(k);
+
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    cli();
+    // An interrupt since the first check may have queued work
+    uint8_t busy = drivers_busy();
+    if (!busy) {
+        sleep_enable();
+#ifdef sleep_bod_disable
+        sleep_bod_disable();
+#endif
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+
+    adc_resume();
+    if (busy) {
+        wdt_stop();
+        return 0;
+    }
+
+    // A pin change (encoder) ends the sleep at an unknown point. The
+    // watchdog keeps running; when it fires, the time awake since this
+    // wake is known and the rest of the period was slept (power_settle())
+    cli();
+    if (!wdt_fired) {
+        wake_us = clock_us();
+        pending_period_us = period_us;
+        down_pending = 1;
+    }
+    sei();
+    if (down_pending) {
+        wakes_early++;
+        return 0;
+    }
+
+    wdt_stop();
+    wakes_wdt++;
+    uint32_t us = period_us + POWER_STARTUP_US + down_rem_us;
+    down_rem_us = us % 1000;
+    return us / 1000;
+}
+
+/**
+ * @brief  Finish the accounting of a power-down that ended early.
+ * @return Time slept [ms] once the watchdog period is over, 0 before.
+ */
+static uint32_t power_settle(void)
+{
+    uint32_t awake;
+
+    cli();
+    if (!down_pending || !wdt_fired) {
+        sei();
+        return 0;
+    }
+    down_pending = 0;
+    awake = wdt_at_us - wake_us;
+    sei();
+    wdt_stop();
+
+    uint32_t us = pending_period_us + POWER_STARTUP_US + down_rem_us;
+    us = (us > awake) ? us - awake : 0;
+    down_rem_us = us % 1000;
+    mode_ms[POWER_MODE_DOWN] += us / 1000;
+    return us / 1000;
+}
+
+#if POWER_ADC_SLEEP && ADC_TRIGGER != ADC_TRIGGER_FREE
+/** @brief ADC noise reduction sleep until the running conversion completes. */
+static void adc_sleep(void)
+{
+    set_sleep_mode(SLEEP_MODE_ADC);
+    cli();
+    // The conversion may have finished since the check: entering this mode
+    // with the ADC idle would start an extra conversion
+    if (adc_converting()) {
+        uint8_t start = TCNT0;
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+
+        // Timer0 stood still from 'start' until the end of the conversion
+        cli();
+        if (!adc_converting() && start < POWER_ADC_DONE_TCNT) {
+            TCNT0 += POWER_ADC_DONE_TCNT - start;
+        }
+    }
+    sei();
+}
+#endif
+
+void power_init(power_clock_t clock, power_quiet_fn_t quiet)
+{
+    clock_us = clock;
+    quiet_ms = quiet;
+    n_checks = 0;
+
+    // Unused peripherals: analog comparator, Timer1 and Timer2
+    ACSR |= (1 << ACD);
+    PRR |= (1 << PRTIM1) | (1 << PRTIM2);
+
+    // Measure the watchdog oscillator (128 kHz +-10 %) against the clock;
+    // without interrupts the nominal period is kept
+    if (SREG & (1 << SREG_I)) {
+        wdt_fired = 0;
+        wdt_start(WDT_MEASURE_K);
+        uint32_t t0 = clock_us();
+        while (!wdt_fired);
+        uint32_t t = (clock_us() - t0) >> WDT_MEASURE_K;
+        wdt_stop();
+        if (t > 12000 && t < 20000) wdt_tick_us = t;
+    }
+
+    power_reset_stats();
+}
+
+int8_t power_add_check(const char *name, power_busy_fn_t fn)
+{
+    if (n_checks >= POWER_MAX_CHECKS || !fn) return -1;
+
+    checks[n_checks].name = name;
+    checks[n_checks].fn = fn;
+    checks[n_checks].vetoes = 0;
+    n_checks++;
+    return 0;
+}
+
+uint8_t power_settling(void)
+{
+    return down_pending;
+}
+
+uint32_t power_idle(void)
+{
+    uint32_t t0 = clock_us();
+    uint32_t slept_ms = 0;
+    uint8_t mode = POWER_MODE_IDLE;
+    uint32_t quiet = 0;
+
+    add_us(POWER_MODE_ACTIVE, t0 - last_us);
+
+    if (!drivers_busy()) {
+        quiet = quiet_ms();
+        // The watchdog still times an interrupted power-down
+        if (!down_pending && quiet >= POWER_DOWN_MIN_MS + POWER_WAKE_LEAD_MS) {
+            mode = POWER_MODE_DOWN;
+        }
+#if POWER_ADC_SLEEP && ADC_TRIGGER != ADC_TRIGGER_FREE
+        else if (adc_converting()) {
+            mode = POWER_MODE_ADC;
+        }
+#endif
+    }
+
+    switch (mode) {
+        case POWER_MODE_DOWN:
+            slept_ms = power_down(quiet - POWER_WAKE_LEAD_MS);
+            mode_ms[POWER_MODE_DOWN] += slept_ms;
+            break;
+#if POWER_ADC_SLEEP && ADC_TRIGGER != ADC_TRIGGER_FREE
+        case POWER_MODE_ADC:
+            adc_sleep();
+            break;
+#endif
+        default:
+            // Any interrupt wakes the CPU, at the latest the 1 ms tick
+            set_sleep_mode(SLEEP_MODE_IDLE);
+            sleep_mode();
+            break;
+    }
+
+    // The caller advances the clock by slept_ms: start the next active
+    // interval after that step
+    uint32_t t1 = clock_us();
+    if (mode != POWER_MODE_DOWN) {
+        add_us(mode, t1 - t0);
+        slept_ms = power_settle();
+    }
+    last_us = t1 + slept_ms * 1000;
+    return slept_ms;
+}
+
+void power_reset_stats(void)
+{
+    for (uint8_t i = 0; i < POWER_MODES; i++) {
+        mode_ms[i] = 0;
+        mode_frac[i] = 0;
+    }
+    for (uint8_t i = 0; i < n_checks; i++) {
+        checks[i].vetoes = 0;
+    }
+    wakes_wdt = 0;
+    wakes_early = 0;
+    last_us = clock_us();
+}
+
+/** @brief Share of part in total [0.1 %]. */
+static uint16_t permille(uint32_t part, uint32_t total)
+{
+    // Keep part * 1000 within 32 bits
+    while (total > 4000000UL) {
+        total >>= 1;
+        part >>= 1;
+    }
+    return total ? (uint16_t)((part * 1000 + total / 2) / total) : 0;
+}
+
+void power_report(void)
+{
+    static const char *const names[POWER_MODES] = {"active", "idle", "adc", "down"};
+    static const uint16_t ua[POWER_MODES] = {
+        POWER_UA_ACTIVE, POWER_UA_IDLE, POWER_UA_ADC, POWER_UA_DOWN
+    };
+    char buf[64];
+    uint32_t total = 0;
+    uint32_t avg = 0;
+
+    for (uint8_t i = 0; i < POWER_MODES; i++) {
+        total += mode_ms[i];
+    }
+
+    sprintf(buf, "POWER: up %lu s", total / 1000);
+    uart_puts(buf);
+    for (uint8_t i = 0; i < POWER_MODES; i++) {
+        uint16_t pm = permille(mode_ms[i], total);
+        avg += (uint32_t)pm * ua[i];
+        sprintf(buf, ", %s %u.%u %%", names[i], pm / 10, pm % 10);
+        uart_puts(buf);
+    }
+    // Weighted by the share of time in each mode
+    sprintf(buf, "\r\nPOWER: avg MCU current %lu uA (always active: %u uA)\r\n",
+            (avg + 500) / 1000, POWER_UA_ACTIVE);
+    uart_puts(buf);
+
+    sprintf(buf, "POWER: wakes wdt %lu, early %lu; busy", wakes_wdt, wakes_early);
+    uart_puts(buf);
+    for (uint8_t i = 0; i < n_checks; i++) {
+        sprintf(buf, " %s %u", checks[i].name ? checks[i].name : "?", checks[i].vetoes);
+        uart_puts(buf);
+    }
+    uart_puts("\r\n");
+}
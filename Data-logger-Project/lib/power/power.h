@@ -0,0 +1,183 @@
+/**
+ * @file power.h
+ * @brief Sleep mode selection for the idle main loop and duty-cycle report.
+ *
+ * power_idle() is called when the scheduler has nothing to run. It puts the
+ * CPU into the deepest sleep mode the current state allows:
+ *
+ * - **Power-down** when no driver is busy and the next event (sampler,
+ *   SD flush, release of a scheduler task that is not a poll) is at least
+ *   POWER_DOWN_MIN_MS + POWER_WAKE_LEAD_MS away. The watchdog timer in
+ *   interrupt mode wakes the CPU POWER_WAKE_LEAD_MS before the event; an
+ *   encoder pin change wakes it early. After an early wake the watchdog
+ *   keeps running, and when it fires the time slept is the measured period
+ *   minus the time awake since the wake, so no sleep time is estimated. The ATmega328P on this board has no
+ *   32 kHz crystal for an asynchronous Timer2, so power-save mode would not
+ *   add a usable wake timer and power-down is used instead.
+ * - **ADC noise reduction** when no driver is busy and an ADC conversion is
+ *   in progress; the ADC interrupt wakes the CPU when the conversion is done.
+ * - **Idle** otherwise; the next Timer0 interrupt (1 ms) or any peripheral
+ *   interrupt wakes the CPU.
+ *
+ * With the default sample periods (light every 40 ms, pressure and battery
+ * every 100 ms) the next event is never that far away, so the loop only
+ * uses idle and ADC noise reduction sleep. Power-down needs all sample
+ * periods well above 104 ms (e.g. -DSAMPLER_LIGHT_SAMPLE_MS=1000).
+ *
+ * The UART receiver cannot wake the CPU from power-down (only the encoder
+ * pins and the watchdog do), so console keys sent during a power-down are
+ * lost.
+ *
+ * Drivers report whether they are busy through check functions registered
+ * with power_add_check(). A busy driver (characters in the UART transmitter,
+ * a TWI transfer, a card commit) needs the I/O clock, which both deep modes
+ * stop.
+ *
+ * Timer0 stops in both deep modes. After ADC noise reduction sleep Timer0 is
+ * moved to the count at which the conversion completed; the time spent in
+ * power-down is returned to the caller, which advances the system clock.
+ * The watchdog oscillator is measured against the system clock at init.
+ *
+ * The time spent in each mode is recorded; power_report() prints the duty
+ * cycle and the resulting average MCU current.
+ *
+ * @defgroup power Power Management
+ * @brief Sleep modes between tasks and duty-cycle statistics.
+ * @{
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+/**
+ * @brief Maximum number of registered busy checks (6 bytes of RAM each).
+ * main() registers 6; one entry is spare.
+ */
+#ifndef POWER_MAX_CHECKS
+#define POWER_MAX_CHECKS 7
+#endif
+
+/** @brief Shortest quiet time [ms] worth a power-down (oscillator restart ~1 ms). */
+#ifndef POWER_DOWN_MIN_MS
+#define POWER_DOWN_MIN_MS 64
+#endif
+
+/**
+ * @brief Wake-up margin [ms] before the next event.
+ * Lets the ADC scan refresh its channels (two channels: 34 ms) and covers
+ * the watchdog period error.
+ */
+#ifndef POWER_WAKE_LEAD_MS
+#define POWER_WAKE_LEAD_MS 40
+#endif
+
+/** @brief Use ADC noise reduction sleep during conversions (1 = on). */
+#ifndef POWER_ADC_SLEEP
+#define POWER_ADC_SLEEP 1
+#endif
+
+/**
+ * @brief Timer0 count (4 us steps) at which a conversion started by the
+ * Timer0 trigger completes: 13.5 ADC clocks of 8 us (27 counts) from the
+ * compare match, one count before the counter is cleared.
+ */
+#define POWER_ADC_DONE_TCNT 26
+
+/**
+ * @name Typical Supply Currents [uA]
+ * ATmega328P at 5 V and 16 MHz (datasheet typical characteristics), used
+ * for the average current in power_report(). Override with measured values.
+ * @{
+ */
+#ifndef POWER_UA_ACTIVE
+#define POWER_UA_ACTIVE 9000
+#endif
+#ifndef POWER_UA_IDLE
+#define POWER_UA_IDLE   2500
+#endif
+#ifndef POWER_UA_ADC
+#define POWER_UA_ADC    1000
+#endif
+#ifndef POWER_UA_DOWN
+#define POWER_UA_DOWN   7
+#endif
+/** @} */
+
+/**
+ * @name Sleep Modes (power_idle() statistics)
+ * @{
+ */
+#define POWER_MODE_ACTIVE 0     /**< CPU running */
+#define POWER_MODE_IDLE   1     /**< Idle sleep */
+#define POWER_MODE_ADC    2     /**< ADC noise reduction sleep */
+#define POWER_MODE_DOWN   3     /**< Power-down with watchdog wake */
+#define POWER_MODES       4     /**< Number of modes */
+/** @} */
+
+/** @brief Time source returning microseconds (wraps at 2^32). */
+typedef uint32_t (*power_clock_t)(void);
+
+/** @brief Driver busy check: 1 while the driver needs the I/O clock. */
+typedef uint8_t (*power_busy_fn_t)(void);
+
+/** @brief Time [ms] until the application has work to do again. */
+typedef uint32_t (*power_quiet_fn_t)(void);
+
+/**
+ * @brief  Initialize the power manager.
+ *
+ * Disables the unused analog comparator and timers 1 and 2, and measures
+ * the watchdog oscillator (blocks for about 64 ms). Interrupts must be
+ * enabled for the measurement; otherwise the nominal period is used.
+ *
+ * @param  clock Microsecond time source (system clock).
+ * @param  quiet Time until the next application event.
+ */
+void power_init(power_clock_t clock, power_quiet_fn_t quiet);
+
+/**
+ * @brief  Register a driver busy check.
+ * @param  name Short name shown in the report.
+ * @param  fn   Check function.
+ * @return 0 on success, -1 if the table is full.
+ */
+int8_t power_add_check(const char *name, power_busy_fn_t fn);
+
+/**
+ * @brief  Check for a power-down that ended early and is not accounted yet.
+ *
+ * Until the watchdog period is over, the system clock lags behind by the
+ * unknown time slept; a later power_idle() returns it. Clock measurements
+ * across this window (e.g. an RTC sync) should wait.
+ *
+ * @return 1 while the watchdog still times an interrupted power-down.
+ */
+uint8_t power_settling(void);
+
+/**
+ * @brief  Sleep until the next interrupt in the deepest allowed mode.
+ *
+ * Call from the main loop when no task is due.
+ *
+ * @return Time spent in power-down [ms], by which the caller must advance
+ *         the system clock; 0 after the other modes, except when the
+ *         watchdog period of an interrupted power-down has just ended.
+ */
+uint32_t power_idle(void);
+
+/** @brief Clear the duty-cycle statistics. */
+void power_reset_stats(void);
+
+/**
+ * @brief  Print the duty-cycle report over UART.
+ *
+ * Share of the run time per mode, estimated average MCU current, watchdog
+ * and early wakes, and how often each busy check prevented a deep sleep.
+ */
+void power_report(void);
+
+#endif /* POWER_H */
+
+/** @} */
@@ -0,0 +1,227 @@
+/**
+ * @file sampler.c
+ * @brief Per-channel acquisition scheduling and decimation.
+ *
+ * Every channel keeps its next sample time and the end of its current
+ * output period. Samples are accumulated (sum, min, max, count) until the
+ * period ends, then reduced by the channel filter. Due times advance by
+ * whole periods, so rates do not drift when a poll is late; samples missed
+ * by a late poll are skipped, not repeated.
+ *
+ * BME280 samples are split into trigger and collect steps: the forced
+ * conversion is started one conversion time plus one tick ahead of the
+ * sample time. Once the conversion time has passed, a poll queues the read
+ * of the result and a later poll takes it, so neither the CPU nor the main
+ * loop waits for the sensor or the bus.
+ */
+
+#include "sampler.h"
+#include <stddef.h>
+#include "bme280.h"
+#include "LightSensor.h"
+#include "battery.h"
+
+/** @brief Channel state. */
+typedef struct {
+    uint16_t sample_ms;     /**< Sampling period [ms] */
+    uint16_t output_ms;     /**< Output period [ms] */
+    uint8_t filter;         /**< SAMPLER_FILTER_* */
+    uint32_t next_sample;   /**< Next sample time [ms] */
+    uint32_t next_output;   /**< End of the current output period [ms] */
+    int32_t sum;            /**< Sum of the samples of the period */
+    int32_t min, max;       /**< Extremes of the samples of the period */
+    int32_t last;           /**< Most recent sample */
+    uint16_t n;             /**< Samples in the period */
+    sampler_output_t out;   /**< Last completed output */
+} channel_t;
+
+static channel_t channels[SAMPLER_CHANNELS];
+
+/** @brief Channels served by the BME280. */
+#define BME_CHANNELS ((1 << SAMPLER_CH_TEMP) | (1 << SAMPLER_CH_PRESS) | (1 << SAMPLER_CH_HUM))
+
+static uint8_t bme_pending;     /**< Channels waiting for the running conversion */
+static uint32_t bme_ready_at;   /**< Earliest time to collect the conversion [ms] */
+static uint16_t bme_lead_ms;    /**< Conversion time rounded up plus the read tick [ms] */
+
+/** @brief True once time t has been reached (wrap-safe). */
+static uint8_t is_due(uint32_t now, uint32_t t)
+{
+    return (int32_t)(now - t) >= 0;
+}
+
+/** @brief Convert humidity from 1/1024 %RH to 0.01 %RH (rounded). */
+static int32_t hum_centi(uint32_t h)
+{
+    return (int32_t)((h * 100 + 512) >> 10);
+}
+
+/** @brief Add one sample to the channel accumulator. */
+static void accumulate(channel_t *c, int32_t v)
+{
+    if (c->n == 0 || v < c->min) c->min = v;
+    if (c->n == 0 || v > c->max) c->max = v;
+    c->sum += v;
+    c->last = v;
+    c->n++;
+}
+
+/** @brief Close the output period: compute the filtered value and reset. */
+static void decimate(channel_t *c)
+{
+    sampler_output_t *o = &c->out;
+
+    if (c->n) {
+        switch (c->filter) {
+            case SAMPLER_FILTER_AVG:
+                // Rounded block average
+                o->value = (c->sum + (c->sum >= 0 ? (int32_t)c->n / 2 : -(int32_t)c->n / 2)) / (int32_t)c->n;
+                break;
+            case SAMPLER_FILTER_MIN: o->value = c->min; break;
+            case SAMPLER_FILTER_MAX: o->value = c->max; break;
+            default:                 o->value = c->last; break;
+        }
+        o->min = c->min;
+        o->max = c->max;
+    }
+    // An empty period keeps the previous value
+    o->samples = c->n;
+
+    c->sum = 0;
+    c->n = 0;
+}
+
+int8_t sampler_config(uint8_t ch, uint16_t sample_ms, uint16_t output_ms, uint8_t filter)
+{
+    if (ch >= SAMPLER_CHANNELS || !sample_ms || output_ms < sample_ms ||
+        filter > SAMPLER_FILTER_MAX) {
+        return -1;
+    }
+    channels[ch].sample_ms = sample_ms;
+    channels[ch].output_ms = output_ms;
+    channels[ch].filter = filter;
+    return 0;
+}
+
+void sampler_init(void)
+{
+    sampler_config(SAMPLER_CH_TEMP,  SAMPLER_TEMP_SAMPLE_MS,  SAMPLER_TEMP_OUTPUT_MS,  SAMPLER_TEMP_FILTER);
+    sampler_config(SAMPLER_CH_PRESS, SAMPLER_PRESS_SAMPLE_MS, SAMPLER_PRESS_OUTPUT_MS, SAMPLER_PRESS_FILTER);
+    sampler_config(SAMPLER_CH_HUM,   SAMPLER_HUM_SAMPLE_MS,   SAMPLER_HUM_OUTPUT_MS,   SAMPLER_HUM_FILTER);
+    sampler_config(SAMPLER_CH_LIGHT, SAMPLER_LIGHT_SAMPLE_MS, SAMPLER_LIGHT_OUTPUT_MS, SAMPLER_LIGHT_FILTER);
+    sampler_config(SAMPLER_CH_BATT,  SAMPLER_BATT_SAMPLE_MS,  SAMPLER_BATT_OUTPUT_MS,  SAMPLER_BATT_FILTER);
+}
+
+void sampler_start(uint32_t now_ms)
+{
+    // One extra tick for the background read of the result
+    bme_lead_ms = (uint16_t)((bme280_conversion_us() + 999) / 1000) + SAMPLER_TICK_MS;
+    bme_pending = 0;
+
+    for (uint8_t i = 0; i < SAMPLER_CHANNELS; i++) {
+        channel_t *c = &channels[i];
+        c->next_sample = now_ms + c->sample_ms;
+        c->next_output = now_ms + c->output_ms;
+        c->sum = 0;
+        c->n = 0;
+    }
+}
+
+uint8_t sampler_poll(uint32_t now_ms)
+{
+    uint8_t due = 0;
+    uint8_t ready = 0;
+
+    // 1. Collect a finished BME280 conversion (background register read)
+    if (bme_pending && is_due(now_ms, bme_ready_at)) {
+        bme280_data_t d;
+        if (bme280_collect_fixed(&d) == 0) {
+            if (bme_pending & (1 << SAMPLER_CH_TEMP))  accumulate(&channels[SAMPLER_CH_TEMP],  d.temperature);
+            if (bme_pending & (1 << SAMPLER_CH_PRESS)) accumulate(&channels[SAMPLER_CH_PRESS], (int32_t)d.pressure);
+            if (bme_pending & (1 << SAMPLER_CH_HUM))   accumulate(&channels[SAMPLER_CH_HUM],   hum_centi(d.humidity));
+            bme_pending = 0;
+        } else if (is_due(now_ms, bme_ready_at + bme_lead_ms)) {
+            // No result one more conversion time later (sensor missing or
+            // reads failing): drop the sample, the next one triggers again
+            bme_pending = 0;
+        }
+    }
+
+    // 2. Find the channels whose sample time has come. BME280 channels are
+    // due one conversion time early so the result is in by the sample time.
+    for (uint8_t i = 0; i < SAMPLER_CHANNELS; i++) {
+        channel_t *c = &channels[i];
+        uint16_t lead = (BME_CHANNELS & (1 << i)) ? bme_lead_ms : 0;
+        if (is_due(now_ms + lead, c->next_sample)) {
+            due |= (1 << i);
+            // Next slot on the period grid, skipping slots a late poll missed
+            do {
+                c->next_sample += c->sample_ms;
+            } while (is_due(now_ms + lead, c->next_sample));
+        }
+    }
+
+    // 3. Acquire: one BME280 conversion serves all of its due channels.
+    // A sample that comes due while a conversion runs shares its result.
+    if (due & BME_CHANNELS) {
+        if (!bme_pending) {
+            bme_ready_at = now_ms + (bme280_trigger() + 999) / 1000;
+        }
+        bme_pending |= due & BME_CHANNELS;
+    }
+    if (due & (1 << SAMPLER_CH_LIGHT)) {
+        accumulate(&channels[SAMPLER_CH_LIGHT], lightSensor_readCalibrated());
+    }
+    if (due & (1 << SAMPLER_CH_BATT)) {
+        accumulate(&channels[SAMPLER_CH_BATT], battery_read_mv());
+    }
+
+    // 4. Close finished output periods
+    for (uint8_t i = 0; i < SAMPLER_CHANNELS; i++) {
+        channel_t *c = &channels[i];
+        if (is_due(now_ms, c->next_output)) {
+            decimate(c);
+            ready |= (1 << i);
+            do {
+                c->next_output += c->output_ms;
+            } while (is_due(now_ms, c->next_output));
+        }
+    }
+    return ready;
+}
+
+/** @brief Shorten *idle to the time until t (0 if t has passed). */
+static void idle_until(uint32_t *idle, uint32_t now, uint32_t t)
+{
+    uint32_t d = is_due(now, t) ? 0 : t - now;
+    if (d < *idle) *idle = d;
+}
+
+uint32_t sampler_idle_ms(uint32_t now_ms)
+{
+    uint32_t idle = UINT32_MAX;
+
+    if (bme_pending) idle_until(&idle, now_ms, bme_ready_at);
+    for (uint8_t i = 0; i < SAMPLER_CHANNELS; i++) {
+        channel_t *c = &channels[i];
+        uint16_t lead = (BME_CHANNELS & (1 << i)) ? bme_lead_ms : 0;
+        idle_until(&idle, now_ms, c->next_sample - lead);
+        idle_until(&idle, now_ms, c->next_output);
+    }
+    return idle;
+}
+
+const sampler_output_t *sampler_output(uint8_t ch)
+{
+    if (ch >= SAMPLER_CHANNELS) return NULL;
+    return &channels[ch].out;
+}
+
+void sampler_get_sample(sample_t *s)
+{
+    s->temp  = (int16_t)channels[SAMPLER_CH_TEMP].out.value;
+    s->press = (uint32_t)channels[SAMPLER_CH_PRESS].out.value;
+    s->hum   = (uint16_t)channels[SAMPLER_CH_HUM].out.value;
+    s->light = (uint16_t)channels[SAMPLER_CH_LIGHT].out.value;
+    s->batt  = (uint16_t)channels[SAMPLER_CH_BATT].out.value;
+}
@@ -0,0 +1,201 @@
+/**
+ * @file sampler.h
+ * @brief Per-channel acquisition scheduling and decimation.
+ *
+ * Each measured quantity (temperature, pressure, humidity, light, battery
+ * voltage) is a
+ * channel with its own sampling period and its own output period. The
+ * samples taken during one output period are reduced to a single output
+ * value by the channel's decimation filter (last, block average, minimum
+ * or maximum).
+ *
+ * Sample and output times of all channels are counted from the same start
+ * time, so channels with equal (or integer multiple) output periods finish
+ * their blocks in the same sampler_poll() call and produce one log row.
+ * Channels that have no new output keep their previous value.
+ *
+ * Values are fixed-point integers in the same units as the binary log:
+ * temperature [0.01 °C], pressure [Pa], humidity [0.01 %RH], light [%],
+ * battery [mV].
+ *
+ * @addtogroup app_logic
+ * @{
+ */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+
+/**
+ * @name Channels
+ * @{
+ */
+#define SAMPLER_CH_TEMP   0   /**< BME280 temperature [0.01 °C] */
+#define SAMPLER_CH_PRESS  1   /**< BME280 pressure [Pa] */
+#define SAMPLER_CH_HUM    2   /**< BME280 humidity [0.01 %RH] */
+#define SAMPLER_CH_LIGHT  3   /**< Photoresistor (ADC) [%] */
+#define SAMPLER_CH_BATT   4   /**< Battery divider (ADC) [mV] */
+#define SAMPLER_CHANNELS  5   /**< Number of channels */
+/** @} */
+
+/**
+ * @name Decimation Filters
+ * @{
+ */
+#define SAMPLER_FILTER_LAST 0   /**< Most recent sample */
+#define SAMPLER_FILTER_AVG  1   /**< Block average of the output period */
+#define SAMPLER_FILTER_MIN  2   /**< Minimum of the output period */
+#define SAMPLER_FILTER_MAX  3   /**< Maximum of the output period */
+/** @} */
+
+/**
+ * @brief Period [ms] at which sampler_poll() should be called.
+ * Sampling periods are effectively rounded up to a multiple of it.
+ */
+#ifndef SAMPLER_TICK_MS
+#define SAMPLER_TICK_MS 10
+#endif
+
+/**
+ * @name Default Channel Configuration
+ * Sampling period [ms], output period [ms] and filter of each channel.
+ * The BME280 is read once per poll for all of its channels that are due.
+ * @{
+ */
+#ifndef SAMPLER_TEMP_SAMPLE_MS
+#define SAMPLER_TEMP_SAMPLE_MS   1000
+#endif
+#ifndef SAMPLER_TEMP_OUTPUT_MS
+#define SAMPLER_TEMP_OUTPUT_MS   1000
+#endif
+#ifndef SAMPLER_TEMP_FILTER
+#define SAMPLER_TEMP_FILTER      SAMPLER_FILTER_LAST
+#endif
+
+#ifndef SAMPLER_PRESS_SAMPLE_MS
+#define SAMPLER_PRESS_SAMPLE_MS  100
+#endif
+#ifndef SAMPLER_PRESS_OUTPUT_MS
+#define SAMPLER_PRESS_OUTPUT_MS  1000
+#endif
+#ifndef SAMPLER_PRESS_FILTER
+#define SAMPLER_PRESS_FILTER     SAMPLER_FILTER_AVG
+#endif
+
+#ifndef SAMPLER_HUM_SAMPLE_MS
+#define SAMPLER_HUM_SAMPLE_MS    1000
+#endif
+#ifndef SAMPLER_HUM_OUTPUT_MS
+#define SAMPLER_HUM_OUTPUT_MS    1000
+#endif
+#ifndef SAMPLER_HUM_FILTER
+#define SAMPLER_HUM_FILTER       SAMPLER_FILTER_LAST
+#endif
+
+#ifndef SAMPLER_LIGHT_SAMPLE_MS
+#define SAMPLER_LIGHT_SAMPLE_MS  40     // ADC scan publishes a 16x oversampled value every 34 ms
+#endif
+#ifndef SAMPLER_LIGHT_OUTPUT_MS
+#define SAMPLER_LIGHT_OUTPUT_MS  1000
+#endif
+#ifndef SAMPLER_LIGHT_FILTER
+#define SAMPLER_LIGHT_FILTER     SAMPLER_FILTER_AVG
+#endif
+
+#ifndef SAMPLER_BATT_SAMPLE_MS
+#define SAMPLER_BATT_SAMPLE_MS   100
+#endif
+#ifndef SAMPLER_BATT_OUTPUT_MS
+#define SAMPLER_BATT_OUTPUT_MS   1000
+#endif
+#ifndef SAMPLER_BATT_FILTER
+#define SAMPLER_BATT_FILTER      SAMPLER_FILTER_AVG
+#endif
+/** @} */
+
+/**
+ * @brief One set of sensor values (the fixed-point sample record).
+ *
+ * Produced once per output period by sampler_get_sample() and passed to the
+ * display, the UART and the SD log. Same units as the binary log record.
+ */
+typedef struct {
+    int16_t  temp;      /**< Temperature [0.01 °C] */
+    uint32_t press;     /**< Pressure [Pa] */
+    uint16_t hum;       /**< Humidity [0.01 %RH] */
+    uint16_t light;     /**< Light intensity [%] */
+    uint16_t batt;      /**< Battery voltage [mV] */
+} sample_t;
+
+/** @brief Result of the last completed output period of a channel. */
+typedef struct {
+    int32_t value;      /**< Filtered output value */
+    int32_t min;        /**< Minimum sample of the period */
+    int32_t max;        /**< Maximum sample of the period */
+    uint16_t samples;   /**< Number of samples in the period */
+} sampler_output_t;
+
+/**
+ * @brief Load the default configuration of all channels.
+ * Sensor drivers must be initialized separately.
+ */
+void sampler_init(void);
+
+/**
+ * @brief  Change the configuration of one channel.
+ *
+ * Takes effect at the next sampler_start().
+ *
+ * @param  ch        Channel (SAMPLER_CH_*).
+ * @param  sample_ms Sampling period [ms], at least 1.
+ * @param  output_ms Output period [ms], at least sample_ms.
+ * @param  filter    Decimation filter (SAMPLER_FILTER_*).
+ * @return 0 on success, -1 on invalid arguments.
+ */
+int8_t sampler_config(uint8_t ch, uint16_t sample_ms, uint16_t output_ms, uint8_t filter);
+
+/**
+ * @brief  Restart all channels with the common time origin.
+ *
+ * The first sample of every channel is taken one sampling period later,
+ * the first output one output period later.
+ *
+ * @param  now_ms Current system uptime [ms].
+ */
+void sampler_start(uint32_t now_ms);
+
+/**
+ * @brief  Take the samples that are due and close finished output periods.
+ * @param  now_ms Current system uptime [ms].
+ * @return Bit mask (1 << SAMPLER_CH_*) of channels with a new output, 0 if none.
+ */
+uint8_t sampler_poll(uint32_t now_ms);
+
+/**
+ * @brief  Time until sampler_poll() has work to do.
+ *
+ * Considers the next sample (BME280 channels: its trigger) and output time
+ * of every channel and the collection of a running BME280 conversion.
+ *
+ * @param  now_ms Current system uptime [ms].
+ * @return Milliseconds until the next event, 0 if one is due.
+ */
+uint32_t sampler_idle_ms(uint32_t now_ms);
+
+/**
+ * @brief  Get the last output of a channel.
+ * @param  ch Channel (SAMPLER_CH_*).
+ * @return Pointer to the output, valid until the next sampler_poll().
+ */
+const sampler_output_t *sampler_output(uint8_t ch);
+
+/**
+ * @brief  Assemble the last outputs of all channels into a sample record.
+ * @param[out] s Sample record.
+ */
+void sampler_get_sample(sample_t *s);
+
+#endif /* SAMPLER_H */
+
+/** @} */
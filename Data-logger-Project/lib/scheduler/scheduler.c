@@ -0,0 +1,172 @@
+/**
+ * @file scheduler.c
+ * @brief Cooperative deadline scheduler implementation.
+ *
+ * Tasks live in a fixed table. Each task holds its next release time; a
+ * task is ready once the clock has passed it. sched_run() picks the ready
+ * task with the lowest priority number (earliest absolute deadline on a
+ * tie), runs it to completion and updates its statistics.
+ */
+
+#include "scheduler.h"
+#include <stdio.h>
+#include <stddef.h>
+#include "uart.h"
+
+/** @brief Task control block. */
+typedef struct {
+    const char *name;       /**< Name for the report */
+    sched_fn_t fn;          /**< Task body */
+    uint32_t period_us;     /**< Release period [us] */
+    uint32_t deadline_us;   /**< Relative deadline [us] */
+    uint32_t release;       /**< Next release time [us] */
+    uint8_t priority;       /**< 0 = most urgent */
+    uint8_t poll;           /**< Releases may be slept through */
+    sched_stats_t stats;    /**< Timing statistics */
+} sched_task_t;
+
+static sched_task_t tasks[SCHED_MAX_TASKS];
+static uint8_t n_tasks;
+static sched_clock_t now_us;
+
+/** @brief Saturate a microsecond interval to 16 bits. */
+static uint16_t sat16(uint32_t us)
+{
+    return (us > 0xFFFF) ? 0xFFFF : (uint16_t)us;
+}
+
+void sched_init(sched_clock_t clock)
+{
+    now_us = clock;
+    n_tasks = 0;
+}
+
+int8_t sched_add(const char *name, sched_fn_t fn, uint16_t period_ms,
+                 uint16_t deadline_ms, uint8_t priority, uint16_t offset_ms)
+{
+    if (n_tasks >= SCHED_MAX_TASKS || !fn || !period_ms) return -1;
+
+    sched_task_t *t = &tasks[n_tasks];
+    t->name = name;
+    t->fn = fn;
+    t->period_us = (uint32_t)period_ms * 1000;
+    t->deadline_us = (uint32_t)(deadline_ms ? deadline_ms : period_ms) * 1000;
+    t->release = now_us() + (uint32_t)offset_ms * 1000;
+    t->priority = priority;
+    t->poll = 0;
+    t->stats = (sched_stats_t){0};
+
+    return (int8_t)n_tasks++;
+}
+
+void sched_set_poll(int8_t id)
+{
+    if (id < 0 || id >= n_tasks) return;
+    tasks[id].poll = 1;
+}
+
+uint32_t sched_idle_ms(void)
+{
+    uint32_t now = now_us();
+    uint32_t idle = UINT32_MAX;
+
+    for (uint8_t i = 0; i < n_tasks; i++) {
+        const sched_task_t *t = &tasks[i];
+        if (t->poll) continue;
+        if ((int32_t)(now - t->release) >= 0) return 0;
+        if ((t->release - now) / 1000 < idle) idle = (t->release - now) / 1000;
+    }
+    return idle;
+}
+
+void sched_trigger(int8_t id)
+{
+    if (id < 0 || id >= n_tasks) return;
+    tasks[id].release = now_us();
+}
+
+uint8_t sched_run(void)
+{
+    uint32_t now = now_us();
+    sched_task_t *best = NULL;
+
+    // Pick the ready task with the highest priority, then the earliest deadline
+    for (uint8_t i = 0; i < n_tasks; i++) {
+        sched_task_t *t = &tasks[i];
+        if ((int32_t)(now - t->release) < 0) continue;
+        if (!best || t->priority < best->priority ||
+            (t->priority == best->priority &&
+             (int32_t)((t->release + t->deadline_us) - (best->release + best->deadline_us)) < 0)) {
+            best = t;
+        }
+    }
+    if (!best) return 0;
+
+    uint32_t start = now_us();
+    best->fn();
+    uint32_t end = now_us();
+
+    sched_stats_t *s = &best->stats;
+    uint32_t run = end - start;
+    uint32_t late = start - best->release;
+
+    s->runs++;
+    s->total_us += run;
+    s->last_us = sat16(run);
+    if (s->last_us > s->max_us) s->max_us = s->last_us;
+    if (sat16(late) > s->max_late_us) s->max_late_us = sat16(late);
+    if (late + run > best->deadline_us) s->overruns++;
+
+    // Next release on the period grid; drop releases that are already gone
+    best->release += best->period_us;
+    while ((int32_t)(end - best->release) >= (int32_t)best->period_us) {
+        best->release += best->period_us;
+        s->skipped++;
+    }
+    return 1;
+}
+
+void sched_resume(void)
+{
+    uint32_t now = now_us();
+
+    // Keep one pending release per task, on the period grid
+    for (uint8_t i = 0; i < n_tasks; i++) {
+        sched_task_t *t = &tasks[i];
+        while ((int32_t)(now - t->release) >= (int32_t)t->period_us) {
+            t->release += t->period_us;
+        }
+    }
+}
+
+const sched_stats_t *sched_stats(int8_t id)
+{
+    if (id < 0 || id >= n_tasks) return NULL;
+    return &tasks[id].stats;
+}
+
+void sched_reset_stats(void)
+{
+    for (uint8_t i = 0; i < n_tasks; i++) {
+        tasks[i].stats = (sched_stats_t){0};
+    }
+}
+
+void sched_report(void)
+{
+    char buf[96];
+
+    uart_puts("SCHED: name      per  dl    runs   avg  last   max  late  ovr skip\r\n");
+    for (uint8_t i = 0; i < n_tasks; i++) {
+        const sched_task_t *t = &tasks[i];
+        const sched_stats_t *s = &t->stats;
+        uint32_t avg = s->runs ? s->total_us / s->runs : 0;
+
+        sprintf(buf, "SCHED: %-8s %5lu %3lu %7lu %5lu %5u %5u %5u %4u %4u\r\n",
+                t->name ? t->name : "?",
+                t->period_us / 1000, t->deadline_us / 1000,
+                s->runs, avg, s->last_us, s->max_us, s->max_late_us,
+                s->overruns, s->skipped);
+        uart_puts(buf);
+    }
+}
@@ -0,0 +1,135 @@
+/**
+ * @file scheduler.h
+ * @brief Cooperative deadline scheduler for the main loop.
+ *
+ * Periodic work is registered as tasks with a period, a priority and a
+ * relative deadline. sched_run() starts the most urgent released task and
+ * returns, so after every task the choice is made again and a long step
+ * (SD commit, LCD redraw) delays other work by at most its own run time.
+ *
+ * Tasks are never preempted. Release times advance by whole periods, so a
+ * task does not drift even if it is started late. Per-task run time, worst
+ * case, start latency and deadline overruns are recorded and can be printed
+ * over UART with sched_report().
+ *
+ * @defgroup scheduler Task Scheduler
+ * @brief Cooperative periodic task scheduling and timing statistics.
+ * @{
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+/**
+ * @brief Maximum number of registered tasks (36 bytes of RAM each).
+ * main() registers 8; one entry is spare.
+ */
+#ifndef SCHED_MAX_TASKS
+#define SCHED_MAX_TASKS 9
+#endif
+
+/** @brief Task body. Must return quickly (no busy waiting). */
+typedef void (*sched_fn_t)(void);
+
+/** @brief Time source returning microseconds (wraps at 2^32). */
+typedef uint32_t (*sched_clock_t)(void);
+
+/** @brief Timing statistics of one task. */
+typedef struct {
+    uint32_t runs;          /**< Number of executions */
+    uint32_t total_us;      /**< Sum of run times [us] (wraps) */
+    uint16_t last_us;       /**< Run time of the last execution [us] */
+    uint16_t max_us;        /**< Worst-case run time [us] */
+    uint16_t max_late_us;   /**< Worst start delay after release [us] */
+    uint16_t overruns;      /**< Executions that finished after their deadline */
+    uint16_t skipped;       /**< Releases dropped because the task fell a period behind */
+} sched_stats_t;
+
+/**
+ * @brief  Initialize the scheduler and remove all tasks.
+ * @param  clock Microsecond time source used for releases and run times.
+ */
+void sched_init(sched_clock_t clock);
+
+/**
+ * @brief  Register a periodic task.
+ *
+ * The first release is offset_ms after the call (immediately when
+ * offset_ms is 0); later releases follow every period_ms.
+ *
+ * @param  name        Short name shown in the report.
+ * @param  fn          Task body.
+ * @param  period_ms   Release period [ms], at least 1.
+ * @param  deadline_ms Deadline relative to the release [ms]. 0 = period.
+ * @param  priority    0 = most urgent. Equal priorities run earliest deadline first.
+ * @param  offset_ms   Delay of the first release [ms].
+ * @return Task id, or -1 if the table is full or the arguments are invalid.
+ */
+int8_t sched_add(const char *name, sched_fn_t fn, uint16_t period_ms,
+                 uint16_t deadline_ms, uint8_t priority, uint16_t offset_ms);
+
+/**
+ * @brief  Mark a task as a poll whose releases may be slept through.
+ *
+ * A poll only checks for work that is announced otherwise: by the quiet
+ * time of the power manager, a busy check or a wake-up interrupt. Its
+ * releases do not limit sched_idle_ms(); after a deep sleep it runs once
+ * (sched_resume()).
+ *
+ * @param  id Task id returned by sched_add().
+ */
+void sched_set_poll(int8_t id);
+
+/**
+ * @brief  Get the time until the next release of a task that is not a poll.
+ * @return Time [ms] (rounded down), 0 if such a task is released,
+ *         UINT32_MAX if all tasks are polls.
+ */
+uint32_t sched_idle_ms(void);
+
+/**
+ * @brief  Release a task immediately, ahead of its next period.
+ * @param  id Task id returned by sched_add().
+ */
+void sched_trigger(int8_t id);
+
+/**
+ * @brief  Run the most urgent released task, if any.
+ *
+ * Call repeatedly from the main loop.
+ * @return 1 if a task was executed, 0 if nothing was due.
+ */
+uint8_t sched_run(void);
+
+/**
+ * @brief  Drop the releases missed while the CPU was asleep.
+ *
+ * Call after the clock has been advanced over a deep sleep. Every task runs
+ * once for the missed periods; unlike an overload, this is not counted as
+ * skipped releases.
+ */
+void sched_resume(void);
+
+/**
+ * @brief  Get the timing statistics of a task.
+ * @param  id Task id.
+ * @return Pointer to the statistics, NULL for an invalid id.
+ */
+const sched_stats_t *sched_stats(int8_t id);
+
+/** @brief Clear the statistics of all tasks. */
+void sched_reset_stats(void);
+
+/**
+ * @brief  Print a table of all tasks and their statistics over UART.
+ *
+ * Columns: name, period and deadline [ms], runs, average / last / worst
+ * run time [us], worst start latency [us], overruns and skipped releases.
+ */
+void sched_report(void);
+
+#endif /* SCHEDULER_H */
+
+/** @} */
@@ -3,7 +3,10 @@
  * @brief SD Card Logging Implementation.
  *
  * Uses the Petit FatFs library to write data to a file named DATA.TXT
- * on the SD card.
+ * (or DATA.BIN for the binary format) on the SD card, or to the numbered
+ * set DATA000 ... DATA999 when rotation is enabled. Records are collected in a RAM staging buffer and the
+ * card is only accessed when the buffer is full, the flush deadline has
+ * passed, or logging is stopped.
  */
 
 // Includes must be in this order
@@ -17,15 +20,472 @@
 #include "pff.h"
 #include "diskio.h"
 #include "uart.h"
+#include "utils.h"
+#if SDLOG_ROTATE == SDLOG_ROTATE_DAY && SDLOG_FORMAT == SDLOG_FORMAT_BINARY
+#include "calendar.h"
+#endif
+#if SDLOG_FORMAT == SDLOG_FORMAT_BINARY
+#include <stddef.h>
+#include <util/crc16.h>
+#endif
 
-/** @brief Name of the log file on the SD card. */
+/** @brief Name of the log file (first file of the set with rotation). */
+#if SDLOG_FORMAT == SDLOG_FORMAT_BINARY
+#define LOG_NAME_FMT "DATA%03u.BIN"
+#if SDLOG_ROTATE
+#define LOG_FILENAME "DATA000.BIN"
+#else
+#define LOG_FILENAME "DATA.BIN"
+#endif
+#else
+#define LOG_NAME_FMT "DATA%03u.TXT"
+#if SDLOG_ROTATE
+#define LOG_FILENAME "DATA000.TXT"
+#else
 #define LOG_FILENAME "DATA.TXT"
+#endif
+#endif
+
+#if SDLOG_ROTATE && (SDLOG_FILES < 1 || SDLOG_FILES > 1000)
+#error "SDLOG_FILES must be between 1 and 1000"
+#endif
+
+#if SDLOG_BUF_SIZE > 512 || (512 % SDLOG_BUF_SIZE) != 0
+#error "SDLOG_BUF_SIZE must divide the 512-byte sector"
+#endif
+
+#if SDLOG_FORMAT == SDLOG_FORMAT_BINARY && SDLOG_BUF_SIZE != 512
+#error "SDLOG_FORMAT_BINARY needs a whole-sector staging buffer"
+#endif
 
 /* --- Global Variables --- */
 FATFS fs;                   /**< File system object */
 volatile uint8_t flag_sd_toggle = 0; /**< Flag to request logging start/stop */
 volatile uint8_t sd_logging = 0;     /**< Current logging state (1=active) */
 
+/* --- Staging Buffer --- */
+static char stage[SDLOG_BUF_SIZE];   /**< Records waiting to be written */
+static uint16_t stage_len = 0;       /**< Number of bytes in stage */
+static uint16_t stage_synced = 0;    /**< Bytes of stage already on the card */
+static uint8_t flush_armed = 0;      /**< 1 = flush deadline is running */
+static uint32_t flush_since = 0;     /**< Time the flush deadline started [ms] */
+
+#if SDLOG_ROTATE
+static uint16_t log_file = 0;        /**< Index of the open file in the set */
+#endif
+#if SDLOG_ROTATE == SDLOG_ROTATE_DAY
+static uint16_t log_date = 0;        /**< Date of the open file (FAT packing, 0 = unknown) */
+#endif
+#if SDLOG_FORMAT == SDLOG_FORMAT_BINARY
+static uint32_t log_seq = 0;         /**< Sequence number of the next new sector */
+
+/** @brief Offset of the CRC field in the sector header. */
+#define CRC_OFS offsetof(sdlog_sector_hdr_t, crc)
+
+/**
+ * @brief CRC of a sector image, skipping the CRC field.
+ * @param img 512-byte sector image.
+ * @return CRC-16/CCITT.
+ */
+static uint16_t sector_crc(const char *img)
+{
+    uint16_t crc = 0xFFFF;
+    uint16_t i;
+
+    for (i = 0; i < 512; i++) {
+        if (i == CRC_OFS) i += 2;
+        crc = _crc_ccitt_update(crc, (uint8_t)img[i]);
+    }
+    return crc;
+}
+
+/**
+ * @brief Pad the staged sector image the way pff pads it and stamp its CRC.
+ * @param len Number of staged bytes.
+ */
+static void sector_seal(uint16_t len)
+{
+    memset(&stage[len], 0, 512 - len);
+    ((sdlog_sector_hdr_t *)stage)->crc = sector_crc(stage);
+}
+#endif
+
+/**
+ * @brief Write the staged bytes to the card.
+ *
+ * A full buffer is written and emptied. A partial buffer (deadline or stop)
+ * is written as well; with a whole-sector buffer the sector is finalized and
+ * the bytes are kept, so the next write rewrites the sector from its start.
+ *
+ * @param partial 1 = flush a partially filled buffer, 0 = buffer is full.
+ * @return 0 on success, -1 on disk error, -2 when the file is full.
+ */
+static int8_t stage_flush(uint8_t partial)
+{
+    UINT bw;
+    uint16_t len = stage_len;
+
+    flush_armed = 0;
+    if (len == stage_synced) return 0;
+
+#if SDLOG_FORMAT == SDLOG_FORMAT_BINARY
+    sector_seal(len);
+#endif
+    if (pf_write(stage, len, &bw) != FR_OK) return -1;
+    if (bw < len) {
+        stage_len = stage_synced = 0;
+        return -2;
+    }
+#if SDLOG_BUF_SIZE == 512
+    if (partial) {
+        // Pad and commit the sector; keep the image for the next rewrite
+        if (pf_write(0, 0, &bw) != FR_OK) return -1;
+        stage_synced = len;
+        return 0;
+    }
+#endif
+    stage_len = stage_synced = 0;
+    return 0;
+}
+
+#if SDLOG_ROTATE
+/**
+ * @brief Open file n of the rotation set.
+ *
+ * pf_open() starts its directory search at the entry of the previously
+ * opened file, so moving on to the next file of the set costs a couple of
+ * entry reads instead of a scan of the whole directory.
+ *
+ * @param n File index (0 .. SDLOG_FILES-1).
+ * @return FR_OK, FR_NO_FILE past the end of the set, or an error code.
+ */
+static FRESULT log_open(uint16_t n)
+{
+    char name[13];
+    FRESULT res;
+
+    if (n >= SDLOG_FILES) return FR_NO_FILE;
+    sprintf(name, LOG_NAME_FMT, n);
+    res = pf_open(name);
+    if (res == FR_OK) log_file = n;
+    return res;
+}
+#endif
+
+#if SDLOG_ROTATE == SDLOG_ROTATE_DAY
+/** @brief Current RTC date packed like a FAT date (year << 9 | month << 5 | day). */
+static uint16_t rtc_date(void)
+{
+    return ((uint16_t)g_time.year << 9) | ((uint16_t)g_time.month << 5) | g_time.date;
+}
+#endif
+
+#if SDLOG_FORMAT == SDLOG_FORMAT_BINARY
+/**
+ * @brief Read a log sector into the staging buffer and check it.
+ * @param sect Sector index inside the file.
+ * @param seq0 Sequence number of sector 0 (not checked for sector 0).
+ * @return 1 = valid, 0 = erased, torn or stale, -1 = disk error.
+ */
+static int8_t sector_valid(DWORD sect, uint32_t seq0)
+{
+    const sdlog_sector_hdr_t *h = (const sdlog_sector_hdr_t *)stage;
+    UINT br;
+
+    if (pf_lseek(sect * 512) != FR_OK) return -1;
+    if (pf_read(stage, 512, &br) != FR_OK) return -1;
+    if (br != 512) return 0;
+    if (h->magic[0] != 'D' || h->magic[1] != 'L' || h->version != SDLOG_BIN_VERSION) return 0;
+    if (h->count > SDLOG_RECS_PER_SECT) return 0;
+    if (sect && h->seq != seq0 + sect) return 0;
+    return h->crc == sector_crc(stage);
+}
+#endif
+
+#if SDLOG_RESUME
+/**
+ * @brief Check whether a sector of the log file has never been written.
+ *
+ * Pre-allocated log files are filled with 0x00 (or 0xFF on erased cards),
+ * while every logged sector starts with record text.
+ *
+ * @param sect Sector index inside the file.
+ * @return 1 = erased, 0 = holds data, -1 = disk error.
+ */
+static int8_t sector_erased(DWORD sect)
+{
+    BYTE b;
+    UINT br;
+
+    if (pf_lseek(sect * 512) != FR_OK) return -1;
+    if (pf_read(&b, 1, &br) != FR_OK || br != 1) return -1;
+    return (b == 0x00 || b == 0xFF);
+}
+
+#if SDLOG_FORMAT == SDLOG_FORMAT_BINARY
+/**
+ * @brief Find the end of the logged data and position the file there.
+ *
+ * Sector 0 fixes the sequence base of the file. Binary search then finds
+ * the first sector that is erased, torn (bad CRC) or stale (sequence
+ * break), so a power loss costs at most the sector being rewritten and
+ * the number of card reads grows with log2 of the file size. The last
+ * valid sector is loaded into the staging buffer so new records continue
+ * right after its last one.
+ *
+ * @return FR_OK on success, error code otherwise.
+ */
+static FRESULT seek_log_end(void)
+{
+    const sdlog_sector_hdr_t *h = (const sdlog_sector_hdr_t *)stage;
+    DWORD lo = 1;
+    DWORD hi = fs.fsize / 512;          // First invalid sector lies in [lo, hi]
+    DWORD pos = 0;
+    uint32_t seq0;
+    int8_t e;
+
+    e = sector_valid(0, 0);
+    if (e < 0) return FR_DISK_ERR;
+    if (e) {
+        seq0 = h->seq;
+        while (lo < hi) {
+            DWORD mid = lo + (hi - lo) / 2;
+            e = sector_valid(mid, seq0);
+            if (e < 0) return FR_DISK_ERR;
+            if (e) lo = mid + 1;
+            else   hi = mid;
+        }
+
+        // Reload the last valid sector and continue after its records
+        if (sector_valid(lo - 1, seq0) != 1) return FR_DISK_ERR;
+        log_seq = h->seq + 1;
+        pos = (lo - 1) * 512;
+        if (h->count < SDLOG_RECS_PER_SECT) {
+            stage_len = stage_synced = sizeof(*h) + h->count * sizeof(sdlog_record_t);
+            pos += stage_len;           // Sector gets rewritten with new records
+        } else {
+            pos += 512;
+        }
+    }
+    return pf_lseek(pos);
+}
+#else
+/**
+ * @brief Find the end of the logged data and position the file there.
+ *
+ * Binary search for the first erased sector, so the number of card reads
+ * grows with log2 of the file size. The partial sector before it is then
+ * loaded into the staging buffer (whole-sector buffer only) so new records
+ * continue right after the last one.
+ *
+ * @return FR_OK on success, error code otherwise.
+ */
+static FRESULT seek_log_end(void)
+{
+    DWORD lo = 0;
+    DWORD hi = (fs.fsize + 511) / 512;  // First erased sector lies in [lo, hi]
+    DWORD pos;
+    int8_t e;
+
+    while (lo < hi) {
+        DWORD mid = lo + (hi - lo) / 2;
+        e = sector_erased(mid);
+        if (e < 0) return FR_DISK_ERR;
+        if (e) hi = mid;
+        else   lo = mid + 1;
+    }
+    pos = lo * 512;
+
+#if SDLOG_BUF_SIZE == 512
+    if (lo > 0) {
+        UINT br;
+        uint16_t end;
+
+        // Load the last written sector and find where its data stops
+        pos -= 512;
+        if (pf_lseek(pos) != FR_OK) return FR_DISK_ERR;
+        if (pf_read(stage, 512, &br) != FR_OK) return FR_DISK_ERR;
+        for (end = 0; end < br; end++) {
+            BYTE c = (BYTE)stage[end];
+            if (c == 0x00 || c == 0xFF) break;
+        }
+        if (end < 512) {
+            stage_len = stage_synced = end;  // Sector gets rewritten with new records
+        }
+        pos += end;
+    }
+#endif
+    // A smaller buffer cannot rewrite the sector; continue at the next one
+
+    if (pos > fs.fsize) pos = fs.fsize;
+    return pf_lseek(pos);
+}
+#endif
+
+#if SDLOG_ROTATE
+/**
+ * @brief Open the last file of the set that holds data.
+ *
+ * Files are filled in order, so the used files form a prefix of the set.
+ * The first unused (or missing) file is found by binary search over the
+ * file index, opening about log2(SDLOG_FILES) files.
+ *
+ * @return FR_OK on success, error code otherwise.
+ */
+static FRESULT log_open_last(void)
+{
+    uint16_t lo = 0;
+    uint16_t hi = SDLOG_FILES;          // First unused file lies in [lo, hi]
+    FRESULT res;
+    int8_t e;
+
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        res = log_open(mid);
+        if (res == FR_NO_FILE) {
+            e = 1;                      // Set on this card ends before mid
+        } else if (res != FR_OK) {
+            return res;
+        } else {
+            e = sector_erased(0);
+            if (e < 0) return FR_DISK_ERR;
+        }
+        if (e) hi = mid;
+        else   lo = mid + 1;
+    }
+    return log_open(lo ? lo - 1 : 0);
+}
+#endif
+
+#if SDLOG_ROTATE == SDLOG_ROTATE_DAY
+/**
+ * @brief Read the date of the open file: the "# 20YY-MM-DD" first line of
+ * a text file, or the timestamp of the first record of a binary file (a
+ * file is started on the day of its first record).
+ * @return Packed date, 0 when the file has none.
+ */
+static uint16_t file_date(void)
+{
+#if SDLOG_FORMAT == SDLOG_FORMAT_TEXT
+    char b[12];
+    UINT br;
+
+    if (pf_lseek(0) != FR_OK || pf_read(b, sizeof(b), &br) != FR_OK || br != sizeof(b)) return 0;
+    if (b[0] != '#' || b[2] != '2' || b[3] != '0') return 0;
+
+    uint8_t yy = (b[4] - '0') * 10 + (b[5] - '0');
+    uint8_t mo = (b[7] - '0') * 10 + (b[8] - '0');
+    uint8_t dd = (b[10] - '0') * 10 + (b[11] - '0');
+    return ((uint16_t)yy << 9) | ((uint16_t)mo << 5) | dd;
+#else
+    const sdlog_sector_hdr_t *h = (const sdlog_sector_hdr_t *)stage;
+    const sdlog_record_t *r = (const sdlog_record_t *)(stage + sizeof(*h));
+    cal_time_t t;
+
+    // Uses the staging buffer: call before seek_log_end() loads it
+    if (sector_valid(0, 0) != 1 || h->count == 0) return 0;
+    calendar_from_seconds(r->time, &t);
+    return ((uint16_t)t.year << 9) | ((uint16_t)t.month << 5) | t.date;
+#endif
+}
+#endif
+#endif
+
+/**
+ * @brief Report a failed flush and stop logging when the file is full.
+ * @param rc Return value of stage_flush().
+ */
+static void stage_report(int8_t rc)
+{
+    if (rc == -1) {
+        uart_puts("SD: Write Error!\r\n");
+    } else if (rc == -2) {
+        uart_puts("SD: Disk Full or Error!\r\n");
+        sd_log_stop();
+    }
+}
+
+/**
+ * @brief Copy a record into the staging buffer, flushing each time it fills.
+ * @param s Record bytes.
+ * @param n Number of bytes.
+ * @return 0 on success, otherwise the stage_flush() error code.
+ */
+static int8_t stage_put(const char *s, uint16_t n)
+{
+    int8_t rc;
+
+    while (n) {
+        uint16_t chunk = SDLOG_BUF_SIZE - stage_len;
+        if (chunk > n) chunk = n;
+
+        memcpy(&stage[stage_len], s, chunk);
+        stage_len += chunk;
+        s += chunk;
+        n -= chunk;
+
+        if (stage_len == SDLOG_BUF_SIZE) {
+            rc = stage_flush(0);
+            if (rc) return rc;
+        }
+    }
+    return 0;
+}
+
+#if SDLOG_ROTATE
+/**
+ * @brief Move on to the next file of the set when needed.
+ *
+ * Called before a record is staged. Switches when the record does not fit
+ * in the rest of the current file or, with SDLOG_ROTATE_DAY, when the RTC
+ * date differs from the date of the file. Staged data goes to the old file
+ * first; the switch itself is a single pf_open().
+ *
+ * @param need Bytes the next record needs in the file.
+ * @return 0 on success, otherwise a stage_flush() error code (-2 = set full).
+ */
+static int8_t log_rotate(uint16_t need)
+{
+    DWORD used = fs.fptr - stage_synced + stage_len;  // File offset after the staged data
+    uint8_t due = (fs.fsize - used < need);
+    UINT bw;
+    int8_t rc;
+#if SDLOG_ROTATE == SDLOG_ROTATE_DAY
+    uint16_t today = rtc_date();
+
+    if (used && today != log_date) due = 1;
+#endif
+
+    if (due) {
+        rc = stage_flush(1);
+        if (rc) return rc;
+        stage_len = stage_synced = 0;
+
+        // Finalize the old file and close the multi-block session
+        if (pf_write(0, 0, &bw) != FR_OK) return -1;
+        if (log_open(log_file + 1) != FR_OK) return -2;
+        used = 0;
+
+        char msg[32];
+        sprintf(msg, "SD: Next file " LOG_NAME_FMT "\r\n", log_file);
+        uart_puts(msg);
+    }
+
+#if SDLOG_ROTATE == SDLOG_ROTATE_DAY
+    if (!used) {
+        // Fresh file takes today's date
+        log_date = today;
+#if SDLOG_FORMAT == SDLOG_FORMAT_TEXT
+        char line[16];
+        sprintf(line, "# 20%02u-%02u-%02u\r\n", g_time.year, g_time.month, g_time.date);
+        return stage_put(line, strlen(line));
+#endif
+    }
+#endif
+    return 0;
+}
+#endif
+
 void sd_log_init(void)
 {
     sd_logging = 0;
@@ -47,19 +507,61 @@ int sd_log_start(void)
 
     uart_puts("SD: Opening file...\r\n");
     // File must exist and have pre-allocated size!
+#if SDLOG_ROTATE && SDLOG_RESUME
+    res = log_open_last();
+#elif SDLOG_ROTATE
+    res = log_open(0);
+#else
     res = pf_open(LOG_FILENAME);
+#endif
     if (res != FR_OK) {
-        uart_puts("SD: Open Error! (Check DATA.TXT)\r\n");
+        uart_puts("SD: Open Error! (Check " LOG_FILENAME ")\r\n");
         return res;
     }
 
+    stage_len = stage_synced = 0;
+    flush_armed = 0;
+
+#if SDLOG_RESUME
+    // Continue after the last logged record (Append mode)
+#if SDLOG_ROTATE == SDLOG_ROTATE_DAY
+    log_date = file_date();
+#endif
+    res = seek_log_end();
+#else
     // Rewind to beginning (Overwriting mode)
+#if SDLOG_FORMAT == SDLOG_FORMAT_BINARY
+    // Continue above the old sequence so stale sectors never look valid
+    log_seq = 0;
+    if (sector_valid(0, 0) == 1) {
+        log_seq = ((sdlog_sector_hdr_t *)stage)->seq + fs.fsize / 512;
+    }
+#endif
     res = pf_lseek(0);
+#endif
     if (res != FR_OK) {
         uart_puts("SD: Seek Error!\r\n");
         return res;
     }
 
+#if SDLOG_RESUME
+    char msg[48];
+#if SDLOG_ROTATE
+    sprintf(msg, "SD: Resuming " LOG_NAME_FMT " at byte %lu\r\n", log_file, (unsigned long)fs.fptr);
+#else
+    sprintf(msg, "SD: Resuming at byte %lu\r\n", (unsigned long)fs.fptr);
+#endif
+    uart_puts(msg);
+#endif
+
+#if SDLOG_ROTATE
+    // Last file may be full or from another day
+    if (log_rotate(1) != 0) {
+        uart_puts("SD: Disk Full or Error!\r\n");
+        return FR_DISK_ERR;
+    }
+#endif
+
     sd_logging = 1;
     uart_puts("SD: Logging started.\r\n");
     return 0;
@@ -70,51 +572,144 @@ void sd_log_stop(void)
     if (!sd_logging) return;
 
     UINT bw;
-    // Finalize write (flush incomplete sector)
+    sd_logging = 0;
+
+    // Write out whatever is still staged
+    if (stage_flush(1) != 0) {
+        uart_puts("SD: Flush Error!\r\n");
+    }
+    stage_len = stage_synced = 0;
+
+    // Finalize write (flush incomplete sector, send Stop Tran)
     pf_write(0, 0, &bw);
 
+    // Let the card finish programming before it is released
+    for (uint16_t n = 65000; pf_write_pending() && n; n--) ;
+
     pf_mount(NULL); // Unmount
 
-    sd_logging = 0;
     uart_puts("SD: Logging stopped.\r\n");
 }
 
-void sd_log_append_line(float T, float P, float H, uint16_t L)
+#if SDLOG_FORMAT == SDLOG_FORMAT_BINARY
+void sd_log_append_line(const sample_t *s)
 {
     if (!sd_logging) return;
 
-    char buffer[64];
-    UINT bw;
-    FRESULT res;
+    sdlog_record_t rec;
+    sdlog_sector_hdr_t *h = (sdlog_sector_hdr_t *)stage;
+    int8_t rc;
 
-    // Convert float to int/dec parts manually to avoid heavy printf float support
-    int t_int = (int)T;
-    int t_dec = abs((int)((T - t_int) * 100));
+#if SDLOG_ROTATE
+    // A new sector image needs a whole free sector in the file
+    rc = log_rotate(stage_len ? 0 : SDLOG_BUF_SIZE);
+    if (rc) {
+        stage_report(rc);
+        return;
+    }
+#endif
 
-    int p_int = (int)P;
-    int p_dec = abs((int)((P - p_int) * 100));
+    // Start a new sector image
+    if (stage_len == 0) {
+        h->magic[0] = 'D';
+        h->magic[1] = 'L';
+        h->version = SDLOG_BIN_VERSION;
+        h->count = 0;
+        h->seq = log_seq++;
+        stage_len = sizeof(*h);
+    }
 
-    int h_int = (int)H;
-    int h_dec = abs((int)((H - h_int) * 100));
+    rec.time  = g_time.sec;
+    rec.ms    = g_time.ms;
+    rec.temp  = s->temp;
+    rec.hum   = s->hum;
+    rec.press = s->press;
+    rec.light = s->light;
+    rec.batt  = s->batt;
 
-    // Format: HH:MM:SS, Temp, Press, Hum, Light
-    sprintf(buffer, "%02d:%02d:%02d, %d.%02d, %d.%02d, %d.%02d, %u\r\n",
-            g_time.hh, g_time.mm, g_time.ss,
-            t_int, t_dec,
-            p_int, p_dec,
-            h_int, h_dec,
-            L);
+    memcpy(&stage[stage_len], &rec, sizeof(rec));
+    stage_len += sizeof(rec);
+    h->count++;
 
-    // Write to file
-    res = pf_write(buffer, strlen(buffer), &bw);
+    if (stage_len + sizeof(rec) > SDLOG_BUF_SIZE) {
+        // Sector is full: pad and commit it
+        memset(&stage[stage_len], 0, SDLOG_BUF_SIZE - stage_len);
+        stage_len = SDLOG_BUF_SIZE;
+        rc = stage_flush(0);
+        if (rc) stage_report(rc);
+    }
+}
+#else
+void sd_log_append_line(const sample_t *s)
+{
+    if (!sd_logging) return;
 
-    if (res != FR_OK) {
-        uart_puts("SD: Write Error!\r\n");
-    } else if (bw < strlen(buffer)) {
-        uart_puts("SD: Disk Full or Error!\r\n");
-        sd_log_stop();
+    char buffer[64];
+    char *p;
+    uint16_t len;
+    int8_t rc;
+
+    // Format: HH:MM:SS.mmm, Temp [°C], Press [hPa], Hum [%], Light, Battery [V]
+    // Fixed-point units print directly (two decimals, battery mV = three)
+    p = buffer + sprintf(buffer, "%02d:%02d:%02d.%03u, ",
+                         g_time.hh, g_time.mm, g_time.ss, g_time.ms);
+    p = fmt_fixed(p, s->temp, 2, 0);
+    *p++ = ','; *p++ = ' ';
+    p = fmt_fixed(p, (int32_t)s->press, 2, 0);     // Pa = 0.01 hPa
+    *p++ = ','; *p++ = ' ';
+    p = fmt_fixed(p, s->hum, 2, 0);
+    p += sprintf(p, ", %u, ", s->light);
+    p = fmt_fixed(p, s->batt, 3, 0);
+    strcpy(p, "\r\n");
+
+    // Stage for the next sector write
+    len = strlen(buffer);
+#if SDLOG_ROTATE
+    rc = log_rotate(len);
+    if (!rc) rc = stage_put(buffer, len);
+#else
+    rc = stage_put(buffer, len);
+#endif
+
+    if (rc) {
+        stage_report(rc);
     } else {
         uart_puts("LOG: ");
         uart_puts(buffer);
     }
+}
+#endif
+
+void sd_log_poll(uint32_t now_ms)
+{
+    if (!sd_logging) return;
+
+    // Advance a pending sector commit; do not touch the card while it programs
+    if (pf_write_pending()) return;
+    if (stage_len == stage_synced) return;
+
+    // Start the deadline when the first unflushed record shows up
+    if (!flush_armed) {
+        flush_armed = 1;
+        flush_since = now_ms;
+        return;
+    }
+
+    if (now_ms - flush_since >= SDLOG_FLUSH_MS) {
+        stage_report(stage_flush(1));
+    }
+}
+
+uint8_t sd_log_busy(void)
+{
+    return sd_logging && pf_write_pending();
+}
+
+uint32_t sd_log_idle_ms(uint32_t now_ms)
+{
+    if (!sd_logging || stage_len == stage_synced) return UINT32_MAX;
+    if (!flush_armed) return 0;     // Next poll starts the deadline
+
+    uint32_t age = now_ms - flush_since;
+    return (age >= SDLOG_FLUSH_MS) ? 0 : SDLOG_FLUSH_MS - age;
 }
\ No newline at end of file
@@ -15,6 +15,123 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "sampler.h"
+
+/**
+ * @brief Size of the RAM staging buffer in bytes.
+ *
+ * Formatted records are collected here and written to the card in one burst.
+ * Must divide the 512-byte sector (64, 128, 256 or 512). With 512 the buffer
+ * holds a whole sector image, so a deadline flush can rewrite the partial
+ * sector and leave the card deselected until the next flush.
+ */
+#ifndef SDLOG_BUF_SIZE
+#define SDLOG_BUF_SIZE 512
+#endif
+
+/**
+ * @brief Maximum time [ms] buffered records may wait before being flushed.
+ */
+#ifndef SDLOG_FLUSH_MS
+#define SDLOG_FLUSH_MS 10000UL
+#endif
+
+/**
+ * @name Log Formats
+ * @{
+ */
+#define SDLOG_FORMAT_TEXT   0   /**< CSV text lines in DATA.TXT */
+#define SDLOG_FORMAT_BINARY 1   /**< Packed fixed-size records in DATA.BIN */
+/** @} */
+
+/**
+ * @brief Selected log file format (SDLOG_FORMAT_TEXT or SDLOG_FORMAT_BINARY).
+ *
+ * The binary format needs a whole-sector staging buffer (SDLOG_BUF_SIZE 512).
+ */
+#ifndef SDLOG_FORMAT
+#define SDLOG_FORMAT SDLOG_FORMAT_TEXT
+#endif
+
+/**
+ * @brief Header at the start of every sector of a binary log.
+ *
+ * Records never cross a sector boundary, so record k of the file lives in
+ * sector k / SDLOG_RECS_PER_SECT at a fixed offset. All fields are little-endian.
+ *
+ * The sequence number grows by one per sector across sessions and files, so
+ * sector i of a file is valid only while seq == seq(sector 0) + i and the
+ * CRC matches. A torn or stale sector breaks the run, which lets the end of
+ * the log be found by binary search after a power loss.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  magic[2];  /**< "DL" */
+    uint8_t  version;   /**< Format version (SDLOG_BIN_VERSION) */
+    uint8_t  count;     /**< Number of valid records in this sector */
+    uint32_t seq;       /**< Sector sequence number */
+    uint16_t crc;       /**< CRC-16/CCITT (avr-libc _crc_ccitt_update, init 0xFFFF) of the sector without this field */
+} sdlog_sector_hdr_t;
+
+/**
+ * @brief One binary log sample (18 bytes, little-endian).
+ *
+ * The timestamp is absolute (RTC local time), so records of sessions
+ * resumed on later days keep their date.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t time;      /**< RTC time [s since 2000-01-01 00:00:00] */
+    uint16_t ms;        /**< Milliseconds of the second (0-999) */
+    int16_t  temp;      /**< Temperature [0.01 °C] */
+    uint16_t hum;       /**< Humidity [0.01 %RH] */
+    uint32_t press;     /**< Pressure [Pa] */
+    uint16_t light;     /**< Light intensity [%] */
+    uint16_t batt;      /**< Battery voltage [mV] */
+} sdlog_record_t;
+
+/** @brief Binary format version stored in each sector header. */
+#define SDLOG_BIN_VERSION 5
+
+/** @brief Number of binary records per 512-byte sector. */
+#define SDLOG_RECS_PER_SECT ((512 - sizeof(sdlog_sector_hdr_t)) / sizeof(sdlog_record_t))
+
+/**
+ * @brief Append to the existing log instead of overwriting it from the start.
+ *
+ * 1 = resume after the last written byte, 0 = overwrite from offset 0.
+ */
+#ifndef SDLOG_RESUME
+#define SDLOG_RESUME 1
+#endif
+
+/**
+ * @name Log Rotation Modes
+ * @{
+ */
+#define SDLOG_ROTATE_NONE   0   /**< Single file DATA.TXT / DATA.BIN */
+#define SDLOG_ROTATE_SIZE   1   /**< Next file of the set when the current one is full */
+#define SDLOG_ROTATE_DAY    2   /**< Next file at midnight (RTC date) or when full */
+/** @} */
+
+/**
+ * @brief Selected rotation mode.
+ *
+ * With rotation the log is spread over a set of pre-allocated files
+ * DATA000.TXT ... DATA999.TXT (.BIN for the binary format), filled in order.
+ * File sizes must be a multiple of 512 bytes. In SDLOG_ROTATE_DAY text
+ * files start with a "# 20YY-MM-DD" line; a binary file is dated by its
+ * first record, so a resumed session stays in the file of the same day.
+ *
+ * Off by default, so an existing card keeps logging to DATA.TXT; enabling
+ * rotation needs the file set on the card (tools/mklogset).
+ */
+#ifndef SDLOG_ROTATE
+#define SDLOG_ROTATE SDLOG_ROTATE_NONE
+#endif
+
+/** @brief Number of files in the rotation set (at most 1000). */
+#ifndef SDLOG_FILES
+#define SDLOG_FILES 1000
+#endif
 
 /**
  * @brief Flag set by the UI button to request a toggle of logging state.
@@ -37,7 +154,9 @@ void sd_log_init(void);
 /**
  * @brief Start the logging process.
  *
- * Mounts the file system, opens the "DATA.TXT" file, and seeks to the beginning (or end).
+ * Mounts the file system, opens the log file, and seeks to the end of the
+ * previously logged data (SDLOG_RESUME) or to the beginning. With rotation
+ * the last file of the set holding data is searched for first.
  * @return 0 on success, error code otherwise.
  */
 int sd_log_start(void);
@@ -45,21 +164,50 @@ int sd_log_start(void);
 /**
  * @brief Stop the logging process.
  *
- * Finalizes the write operation (flushes buffer) and unmounts the file system.
+ * Flushes the staging buffer, finalizes the write operation, closes the SD card
+ * multi-block write session and unmounts the file system.
  */
 void sd_log_stop(void);
 
+/**
+ * @brief Flush buffered records once the flush deadline has passed.
+ *
+ * Should be called frequently from the main loop. Also advances a sector
+ * commit that is still being programmed by the card, so the loop never
+ * blocks on the SD busy signal. Does nothing while the buffer is empty or
+ * the oldest unflushed record is younger than SDLOG_FLUSH_MS.
+ *
+ * @param now_ms Current system uptime in milliseconds.
+ */
+void sd_log_poll(uint32_t now_ms);
+
+/**
+ * @brief  Check whether a sector commit is being programmed by the card.
+ *
+ * sd_log_poll() must keep advancing the commit, so the MCU should not
+ * enter a deep sleep mode meanwhile.
+ * @return 1 while a commit is pending, 0 otherwise.
+ */
+uint8_t sd_log_busy(void);
+
+/**
+ * @brief  Time until sd_log_poll() has work to do.
+ * @param  now_ms Current system uptime in milliseconds.
+ * @return Milliseconds until the flush deadline of buffered records, 0 if
+ *         it has passed, UINT32_MAX if nothing is waiting.
+ */
+uint32_t sd_log_idle_ms(uint32_t now_ms);
+
 /**
  * @brief Append a formatted data line to the open log file.
  *
- * Formats the timestamp and sensor values into a CSV-like string and writes it to the SD card.
+ * Formats the timestamp and sensor values into a CSV-like string and stores it in
+ * the staging buffer. The card is written only when the buffer is full.
+ * With SDLOG_FORMAT_BINARY a packed sdlog_record_t is stored instead.
  *
- * @param T Temperature value.
- * @param P Pressure value.
- * @param H Humidity value.
- * @param L Light intensity value.
+ * @param s Sample record (fixed-point values).
  */
-void sd_log_append_line(float T, float P, float H, uint16_t L);
+void sd_log_append_line(const sample_t *s);
 
 #endif /* SDLOG_H */
 
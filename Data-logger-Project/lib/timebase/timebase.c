@@ -0,0 +1,68 @@
+/**
+ * @file timebase.c
+ * @brief Exact 1 ms system tick and microsecond timestamps from Timer0.
+ */
+
+#include "timebase.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+volatile uint32_t g_millis = 0;
+
+/**
+ * @brief Timer0 Compare Match A Interrupt Service Routine.
+ * Increments the system uptime counter every 1 ms.
+ */
+ISR(TIMER0_COMPA_vect)
+{
+    g_millis++;
+}
+
+void timebase_init(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    TCCR0B = 0;                         // Stop while reconfiguring
+    TCNT0 = 0;
+    OCR0A = TIMEBASE_TOP;
+    TCCR0A = (1 << WGM01);              // CTC, TOP = OCR0A, outputs off
+    TIFR0 = (1 << OCF0A) | (1 << TOV0);
+    TIMSK0 = (1 << OCIE0A);
+    TCCR0B = (1 << CS01) | (1 << CS00); // Prescaler 64
+    SREG = sreg;
+}
+
+uint32_t millis(void)
+{
+    uint32_t t;
+    uint8_t sreg = SREG;
+    cli();
+    t = g_millis;
+    SREG = sreg;
+    return t;
+}
+
+uint32_t micros(void)
+{
+    uint32_t ms;
+    uint8_t cnt;
+    uint8_t sreg = SREG;
+    cli();
+    ms = g_millis;
+    cnt = TCNT0;
+    // Compare match not yet serviced: the flag is set while TCNT0 still
+    // equals TOP, so only a cleared counter means a completed millisecond
+    if ((TIFR0 & (1 << OCF0A)) && cnt < TIMEBASE_TOP) {
+        ms++;
+    }
+    SREG = sreg;
+    return ms * 1000UL + (uint16_t)cnt * TIMEBASE_US_PER_COUNT;
+}
+
+void timebase_advance(uint32_t ms)
+{
+    uint8_t sreg = SREG;
+    cli();
+    g_millis += ms;
+    SREG = sreg;
+}
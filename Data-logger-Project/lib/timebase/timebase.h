@@ -0,0 +1,72 @@
+/**
+ * @file timebase.h
+ * @brief Exact 1 ms system tick and microsecond timestamps from Timer0.
+ *
+ * Timer0 runs in CTC mode with prescaler 64 and TOP = TIMEBASE_TOP: the
+ * counter advances every 4 us and is cleared after exactly 250 counts, so
+ * every compare match A interrupt is one millisecond. (The former overflow
+ * tick at the same prescaler lasted 256 counts = 1.024 ms, which made every
+ * millisecond period 2.4 % too long.)
+ *
+ * micros() combines the tick count with the live TCNT0 value, giving a
+ * timestamp with 4 us resolution for profiling, scheduling and sample
+ * timing. The compare match also triggers the ADC scan
+ * (ADC_TRIGGER_TIMER0_COMPA).
+ *
+ * @addtogroup drivers
+ * @{
+ */
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdint.h>
+
+/** @brief Timer0 prescaler (one count = 64 / 16 MHz = 4 us). */
+#define TIMEBASE_PRESCALER 64
+
+/** @brief Microseconds per Timer0 count. */
+#define TIMEBASE_US_PER_COUNT (TIMEBASE_PRESCALER / (F_CPU / 1000000UL))
+
+/** @brief Compare value (TOP): TOP + 1 counts per millisecond. */
+#define TIMEBASE_TOP ((F_CPU / TIMEBASE_PRESCALER / 1000UL) - 1)
+
+#if (F_CPU / TIMEBASE_PRESCALER) % 1000UL != 0 || TIMEBASE_TOP > 255
+#error "F_CPU does not give an exact 1 ms Timer0 tick at prescaler 64"
+#endif
+
+/** @brief Milliseconds since timebase_init(), incremented by the tick interrupt. */
+extern volatile uint32_t g_millis;
+
+/**
+ * @brief Start Timer0 in CTC mode with the 1 ms compare match interrupt.
+ * Interrupts must be enabled globally for the tick to run.
+ */
+void timebase_init(void);
+
+/**
+ * @brief  Get the system uptime (atomic read).
+ * @return Uptime [ms], wraps after 49.7 days.
+ */
+uint32_t millis(void);
+
+/**
+ * @brief  Get a high-resolution uptime (atomic read).
+ *
+ * The tick count plus the live counter value; a compare match not yet
+ * serviced by the interrupt is taken into account, so the result never
+ * steps backwards.
+ *
+ * @return Uptime [us], 4 us resolution, wraps after 71.6 minutes.
+ */
+uint32_t micros(void);
+
+/**
+ * @brief  Advance the uptime over a time the timer was stopped.
+ * @param  ms Time spent in power-down [ms].
+ */
+void timebase_advance(uint32_t ms);
+
+#endif /* TIMEBASE_H */
+
+/** @} */
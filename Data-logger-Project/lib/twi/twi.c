@@ -7,9 +7,44 @@
  */
 
 // -- Includes -------------------------------------------------------
+#include <stddef.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
 #include <twi.h>
 
 
+// -- Transaction engine state ---------------------------------------
+static twi_xfer_t *volatile queue[TWI_QUEUE_LEN]; // Waiting transactions
+static volatile uint8_t q_head = 0;               // Next free slot
+static volatile uint8_t q_tail = 0;               // Oldest waiting transaction
+static twi_xfer_t *volatile current = NULL;       // Transaction on the bus
+static volatile uint8_t x_idx = 0;                // Bytes done in current phase
+static volatile uint8_t x_reading = 0;            // Read phase of current
+// Incremented on every bus event. 16 bits: twi_service() compares it
+// across 10 ms, in which 400 kHz allows about 450 events: an 8-bit count
+// could wrap back to the same value and abort a healthy transfer
+static volatile uint16_t x_progress = 0;
+
+/* TWCR values: continue with interrupt enabled, with or without ACK */
+#define TWCR_GO      ((1<<TWINT) | (1<<TWEN) | (1<<TWIE))
+#define TWCR_GO_ACK  (TWCR_GO | (1<<TWEA))
+
+/* Bus recovery: line low = output 0, line high = input with pull-up */
+#define LINE_LOW(_pin)  do { TWI_PORT &= ~(1<<(_pin)); DDR(TWI_PORT) |= (1<<(_pin)); } while (0)
+#define LINE_HIGH(_pin) do { DDR(TWI_PORT) &= ~(1<<(_pin)); TWI_PORT |= (1<<(_pin)); } while (0)
+
+// -- Speed profiles and counters ------------------------------------
+static twi_profile_t profiles[TWI_MAX_PROFILES];  // max_scl == 0: unused
+static uint8_t bus_addr = 0xff;                   // Device TWBR is set for
+static uint16_t recoveries = 0;                   // twi_recover() calls
+
+/* Pseudo address of the byte-level functions: always the default rate */
+#define TWI_NO_DEVICE 0x80
+
+// -- Byte-level state -----------------------------------------------
+static uint8_t seq_status = TWI_OK;               // First failure since twi_stop()
+
+
 // -- Functions ------------------------------------------------------
 /*
  * Function: twi_init()
@@ -26,19 +61,143 @@ void twi_init(void)
     /* Set SCL frequency */
     TWSR &= ~((1<<TWPS1) | (1<<TWPS0));
     TWBR = TWI_BIT_RATE_REG;
+    bus_addr = TWI_NO_DEVICE;
+}
+
+
+/*
+ * Function: find_profile()
+ * Purpose:  Look up the profile of one device.
+ * Input:    addr Slave address
+ * Returns:  Profile or NULL
+ */
+static twi_profile_t *find_profile(uint8_t addr)
+{
+    for (uint8_t i = 0; i < TWI_MAX_PROFILES; i++) {
+        if (profiles[i].max_scl && profiles[i].addr == addr)
+            return &profiles[i];
+    }
+    return NULL;
+}
+
+
+/*
+ * Function: select_speed()
+ * Purpose:  Load TWBR for the addressed device if it differs from the
+ *           previous one. Called with the bus idle.
+ * Input:    addr Slave address or TWI_NO_DEVICE
+ * Returns:  none
+ */
+static void select_speed(uint8_t addr)
+{
+    twi_profile_t *p;
+
+    if (addr == bus_addr)
+        return;
+    bus_addr = addr;
+
+    p = find_profile(addr);
+    TWBR = p ? p->twbr : TWI_BIT_RATE_REG;
+}
+
+
+/*
+ * Function: count_failure()
+ * Purpose:  Update the counters of a device after a failed transfer.
+ * Input:    addr Slave address
+ *           status TWI_NACK, TWI_ERROR or TWI_TIMEOUT
+ * Returns:  none
+ */
+static void count_failure(uint8_t addr, uint8_t status)
+{
+    twi_profile_t *p = find_profile(addr);
+
+    if (p == NULL)
+        return;
+    if (status == TWI_NACK)
+        p->stats.nack++;
+    else if (status == TWI_TIMEOUT)
+        p->stats.timeout++;
+    else
+        p->stats.error++;
+}
+
+
+/*
+ * Function: wait_twint()
+ * Purpose:  Wait for the end of the current bus event of the byte-level
+ *           functions. On timeout the bus is recovered.
+ * Returns:  TWI_OK or TWI_TIMEOUT
+ */
+static uint8_t wait_twint(void)
+{
+    uint16_t us = 0;
+
+    while ((TWCR & (1<<TWINT)) == 0) {
+        if (++us > TWI_TIMEOUT_US) {
+            twi_recover();
+            seq_status = TWI_TIMEOUT;
+            return TWI_TIMEOUT;
+        }
+        _delay_us(1);
+    }
+    return TWI_OK;
+}
+
+
+/*
+ * Function: wait_stop()
+ * Purpose:  Wait until a Stop condition has been sent. If the bus does
+ *           not complete it in time, the bus is recovered.
+ * Returns:  none
+ */
+static void wait_stop(void)
+{
+    uint16_t us = 0;
+
+    while (TWCR & (1<<TWSTO)) {
+        if (++us > TWI_TIMEOUT_US) {
+            twi_recover();
+            return;
+        }
+        _delay_us(1);
+    }
 }
 
 
 /*
  * Function: twi_start()
  * Purpose:  Start communication on I2C/TWI bus.
- * Returns:  none
+ * Returns:  TWI_OK, TWI_ERROR or TWI_TIMEOUT
  */
-void twi_start(void)
+uint8_t twi_start(void)
 {
+    uint8_t twi_status;
+
+    /* Let queued transactions finish first */
+    while (!twi_idle())
+        ;
+    if (seq_status == TWI_TIMEOUT)
+        return TWI_TIMEOUT;
+    select_speed(TWI_NO_DEVICE);
+    wait_stop();
+
     /* Send Start condition */
     TWCR = (1<<TWINT) | (1<<TWSTA) | (1<<TWEN);
-    while ((TWCR & (1<<TWINT)) == 0);
+    if (wait_twint() != TWI_OK)
+        return TWI_TIMEOUT;
+
+    /* Status Code:
+         - 0x08: Start condition has been transmitted
+         - 0x10: Repeated Start condition has been transmitted
+    */
+    twi_status = TWSR & 0xf8;
+    if (twi_status == 0x08 || twi_status == 0x10)
+        return TWI_OK;
+
+    if (seq_status == TWI_OK)
+        seq_status = TWI_ERROR;
+    return TWI_ERROR;
 }
 
 
@@ -46,16 +205,20 @@ void twi_start(void)
  * Function: twi_write()
  * Purpose:  Write one byte to the I2C/TWI bus.
  * Input:    data Byte to be transmitted
- * Returns:  ACK/NACK received value
+ * Returns:  ACK/NACK received value, TWI_TIMEOUT if not transmitted
  */
 uint8_t twi_write(uint8_t data)
 {
     uint8_t twi_status;
 
+    if (seq_status == TWI_TIMEOUT)
+        return TWI_TIMEOUT;
+
     /* Send SLA+R, SLA+W, or data byte on I2C/TWI bus */
     TWDR = data;
     TWCR = (1<<TWINT) | (1<<TWEN);
-    while ((TWCR & (1<<TWINT)) == 0);
+    if (wait_twint() != TWI_OK)
+        return TWI_TIMEOUT;
 
     /* Check value of TWI status register */
     twi_status = TWSR & 0xf8;
@@ -67,8 +230,10 @@ uint8_t twi_write(uint8_t data)
     */
     if (twi_status == 0x18 || twi_status == 0x28 || twi_status == 0x40)
         return 0;   /* ACK received */
-    else
-        return 1;   /* NACK received */
+
+    if (seq_status == TWI_OK)
+        seq_status = TWI_NACK;
+    return 1;       /* NACK received */
 }
 
 
@@ -77,15 +242,19 @@ uint8_t twi_write(uint8_t data)
  * Purpose:  Read one byte from the I2C/TWI bus and acknowledge
  *           it by ACK or NACK.
  * Input:    ack ACK/NACK value to be transmitted
- * Returns:  Received data byte
+ * Returns:  Received data byte, 0xff on timeout
  */
 uint8_t twi_read(uint8_t ack)
 {
+    if (seq_status == TWI_TIMEOUT)
+        return 0xff;
+
     if (ack == TWI_ACK)
         TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWEA);
     else
         TWCR = (1<<TWINT) | (1<<TWEN);
-    while ((TWCR & (1<<TWINT)) == 0);
+    if (wait_twint() != TWI_OK)
+        return 0xff;
 
     return (TWDR);
 }
@@ -94,11 +263,18 @@ uint8_t twi_read(uint8_t ack)
 /*
  * Function: twi_stop()
  * Purpose:  Generates Stop condition on I2C/TWI bus.
- * Returns:  none
+ * Returns:  First failure since the previous twi_stop()
  */
-void twi_stop(void)
+uint8_t twi_stop(void)
 {
-    TWCR = (1<<TWINT) | (1<<TWSTO) | (1<<TWEN);
+    uint8_t status = seq_status;
+
+    /* After a timeout the bus has already been released */
+    if (status != TWI_TIMEOUT)
+        TWCR = (1<<TWINT) | (1<<TWSTO) | (1<<TWEN);
+    seq_status = TWI_OK;
+
+    return status;
 }
 
 
@@ -110,13 +286,14 @@ void twi_stop(void)
  */
 uint8_t twi_test_address(uint8_t addr)
 {
-    uint8_t ack;  // ACK response from Slave
+    twi_xfer_t x;
 
-    twi_start();
-    ack = twi_write((addr<<1) | TWI_WRITE);
-    twi_stop();
+    x.addr = addr;
+    x.wlen = 0;
+    x.rlen = 0;
+    x.done = NULL;
 
-    return ack;
+    return (twi_transfer(&x) == TWI_OK) ? 0 : 1;
 }
 
 
@@ -127,32 +304,454 @@ uint8_t twi_test_address(uint8_t addr)
  *           memaddr Starting address
  *           buf Buffer to be read into
  *           nbytes Number of bytes
- * Returns:  None
- */
-void twi_readfrom_mem_into(uint8_t addr, uint8_t memaddr, volatile uint8_t *buf, uint8_t nbytes)
-{
-    twi_start();
-    if (twi_write((addr<<1) | TWI_WRITE) == 0)
-    {
-        // Set starting address
-        twi_write(memaddr);
-        twi_stop();
-
-        // Read data into the buffer
-        twi_start();
-        twi_write((addr<<1) | TWI_READ);
-        if (nbytes >= 2)
-        {
-            for (uint8_t i=0; i<(nbytes-1); i++)
-            {
-                *buf++ = twi_read(TWI_ACK);
-            }
+ * Returns:  TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT
+ */
+uint8_t twi_readfrom_mem_into(uint8_t addr, uint8_t memaddr, volatile uint8_t *buf, uint8_t nbytes)
+{
+    twi_xfer_t x;
+
+    x.addr = addr;
+    x.wbuf = &memaddr;
+    x.wlen = 1;
+    x.rbuf = (uint8_t *)buf;
+    x.rlen = nbytes;
+    x.done = NULL;
+
+    return twi_transfer(&x);
+}
+
+
+/*
+ * Function: twi_recover()
+ * Purpose:  Release a stuck bus: 9 SCL pulses and a Stop condition,
+ *           driven as open-drain outputs with the TWI unit disabled.
+ * Returns:  none
+ */
+void twi_recover(void)
+{
+    TWCR = 0;
+    LINE_HIGH(TWI_SDA_PIN);
+
+    /* Clock out the byte a slave may still be sending */
+    for (uint8_t i = 0; i < 9; i++) {
+        LINE_LOW(TWI_SCL_PIN);
+        _delay_us(5);
+        LINE_HIGH(TWI_SCL_PIN);
+        _delay_us(5);
+    }
+
+    /* Stop condition: SDA rises while SCL is high */
+    LINE_LOW(TWI_SCL_PIN);
+    LINE_LOW(TWI_SDA_PIN);
+    _delay_us(5);
+    LINE_HIGH(TWI_SCL_PIN);
+    _delay_us(5);
+    LINE_HIGH(TWI_SDA_PIN);
+    _delay_us(5);
+
+    /* Back to the TWI unit */
+    TWCR = (1<<TWEN);
+    bus_addr = 0xff;
+    recoveries++;
+}
+
+
+// -- Transaction engine ---------------------------------------------
+/*
+ * Function: start_next()
+ * Purpose:  Take the oldest queued transaction and send Start, or leave
+ *           the engine idle. Called with interrupts disabled.
+ * Returns:  none
+ */
+static void start_next(void)
+{
+    if (q_tail == q_head) {
+        current = NULL;
+        return;
+    }
+    current = queue[q_tail];
+    q_tail = (q_tail + 1) & (TWI_QUEUE_LEN - 1);
+    x_idx = 0;
+    x_reading = (current->wlen == 0 && current->rlen != 0);
+
+    /* A previous Stop must be on the bus before the next Start */
+    wait_stop();
+    select_speed(current->addr);
+    TWCR = TWCR_GO | (1<<TWSTA);
+}
+
+
+/*
+ * Function: complete()
+ * Purpose:  Report the result of the current transaction and start the
+ *           next one. The bus must already be released.
+ * Input:    status TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT
+ * Returns:  none
+ */
+static void complete(uint8_t status)
+{
+    twi_xfer_t *x = current;
+
+    current = NULL;
+    if (status != TWI_OK)
+        count_failure(x->addr, status);
+    x->status = status;
+    if (x->done)
+        x->done(x);
+    if (current == NULL)
+        start_next();
+}
+
+
+/*
+ * Function: finish()
+ * Purpose:  Send Stop and complete the current transaction.
+ * Input:    status TWI_OK or TWI_NACK
+ * Returns:  none
+ */
+static void finish(uint8_t status)
+{
+    TWCR = (1<<TWINT) | (1<<TWSTO) | (1<<TWEN);
+    complete(status);
+}
+
+
+/*
+ * Function: abort_current()
+ * Purpose:  Fail the current transaction and release the bus.
+ *           Called with interrupts disabled.
+ * Input:    status TWI_ERROR or TWI_TIMEOUT
+ * Returns:  none
+ */
+static void abort_current(uint8_t status)
+{
+    twi_recover();
+    if (current != NULL)
+        complete(status);
+}
+
+
+/*
+ * Function: twi_step()
+ * Purpose:  Advance the current transaction after TWINT was set.
+ *           Body of the TWI interrupt, also polled by twi_wait().
+ * Returns:  none
+ */
+static void twi_step(void)
+{
+    twi_xfer_t *x = current;
+
+    x_progress++;
+    if (x == NULL) {
+        /* Nothing running: clear a stray flag without re-enabling TWIE */
+        TWCR = (1<<TWINT) | (1<<TWEN);
+        return;
+    }
+
+    switch (TWSR & 0xf8) {
+    case 0x08:  /* Start transmitted */
+    case 0x10:  /* Repeated Start transmitted */
+        TWDR = (x->addr << 1) | (x_reading ? TWI_READ : TWI_WRITE);
+        TWCR = TWCR_GO;
+        break;
+
+    case 0x18:  /* SLA+W transmitted, ACK received */
+    case 0x28:  /* Data byte transmitted, ACK received */
+        if (x_idx < x->wlen) {
+            TWDR = x->wbuf[x_idx++];
+            TWCR = TWCR_GO;
+        } else if (x->rlen) {
+            x_reading = 1;
+            x_idx = 0;
+            TWCR = TWCR_GO | (1<<TWSTA);
+        } else {
+            finish(TWI_OK);
         }
-        *buf = twi_read(TWI_NACK);
-        twi_stop();
+        break;
+
+    case 0x40:  /* SLA+R transmitted, ACK received */
+        /* NACK the last byte */
+        TWCR = (x->rlen > 1) ? TWCR_GO_ACK : TWCR_GO;
+        break;
+
+    case 0x50:  /* Data byte received, ACK returned */
+        x->rbuf[x_idx++] = TWDR;
+        TWCR = (x_idx + 1 < x->rlen) ? TWCR_GO_ACK : TWCR_GO;
+        break;
+
+    case 0x58:  /* Data byte received, NACK returned */
+        x->rbuf[x_idx] = TWDR;
+        finish(TWI_OK);
+        break;
+
+    case 0x20:  /* SLA+W transmitted, NACK received */
+    case 0x30:  /* Data byte transmitted, NACK received */
+    case 0x48:  /* SLA+R transmitted, NACK received */
+        finish(TWI_NACK);
+        break;
+
+    default:    /* Arbitration lost, bus error */
+        abort_current(TWI_ERROR);
+        break;
     }
-    else
-    {
-        twi_stop();
+}
+
+
+/*
+ * Function: TWI interrupt
+ * Purpose:  Run the transaction state machine.
+ */
+ISR(TWI_vect)
+{
+    twi_step();
+}
+
+
+/*
+ * Function: watchdog()
+ * Purpose:  One microsecond of a wait loop: service the unit when
+ *           interrupts are off and abort the current transaction after
+ *           TWI_TIMEOUT_US without progress.
+ * Input:    seen Progress count at the last check
+ *           idle_us Microseconds without progress
+ * Returns:  none
+ */
+static void watchdog(uint16_t *seen, uint16_t *idle_us)
+{
+    uint8_t sreg = SREG;
+
+    if (!(sreg & (1<<SREG_I)) && (TWCR & (1<<TWINT)))
+        twi_step();
+
+    cli();
+    if (current == NULL || x_progress != *seen) {
+        *seen = x_progress;
+        *idle_us = 0;
+    } else if (++*idle_us > TWI_TIMEOUT_US) {
+        abort_current(TWI_TIMEOUT);
+        *idle_us = 0;
     }
+    SREG = sreg;
+
+    _delay_us(1);
+}
+
+
+/*
+ * Function: twi_submit()
+ * Purpose:  Queue a transaction for background execution.
+ * Input:    xfer Transaction descriptor
+ * Returns:  0 if queued, -1 if the queue is full
+ */
+int8_t twi_submit(twi_xfer_t *xfer)
+{
+    uint8_t sreg = SREG;
+    uint8_t next;
+
+    cli();
+    next = (q_head + 1) & (TWI_QUEUE_LEN - 1);
+    if (next == q_tail) {
+        SREG = sreg;
+        return -1;
+    }
+    xfer->status = TWI_BUSY;
+    queue[q_head] = xfer;
+    q_head = next;
+    if (current == NULL)
+        start_next();
+    SREG = sreg;
+
+    return 0;
+}
+
+
+/*
+ * Function: twi_wait()
+ * Purpose:  Wait until a submitted transaction is finished.
+ * Input:    xfer Transaction descriptor
+ * Returns:  TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT
+ */
+uint8_t twi_wait(twi_xfer_t *xfer)
+{
+    uint16_t seen = x_progress;
+    uint16_t idle_us = 0;
+
+    while (xfer->status == TWI_BUSY)
+        watchdog(&seen, &idle_us);
+
+    return xfer->status;
+}
+
+
+/*
+ * Function: twi_transfer()
+ * Purpose:  Execute a transaction and wait for its completion.
+ * Input:    xfer Transaction descriptor
+ * Returns:  TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT
+ */
+uint8_t twi_transfer(twi_xfer_t *xfer)
+{
+    uint16_t seen = x_progress;
+    uint16_t idle_us = 0;
+
+    /* Queue full: let the running transactions progress */
+    while (twi_submit(xfer) != 0)
+        watchdog(&seen, &idle_us);
+
+    return twi_wait(xfer);
+}
+
+
+/*
+ * Function: twi_idle()
+ * Purpose:  Check whether no transaction is queued or running. Waits at
+ *           most one timeout step for a stalled transaction.
+ * Returns:  1 if idle, 0 otherwise
+ */
+uint8_t twi_idle(void)
+{
+    static uint16_t seen;
+    static uint16_t idle_us;
+    uint8_t idle;
+    uint8_t sreg = SREG;
+
+    cli();
+    idle = (current == NULL) && (q_tail == q_head);
+    SREG = sreg;
+
+    if (!idle)
+        watchdog(&seen, &idle_us);
+
+    return idle;
+}
+
+
+/*
+ * Function: twi_service()
+ * Purpose:  Abort a background transaction without progress since the
+ *           previous call.
+ * Returns:  none
+ */
+void twi_service(void)
+{
+    static twi_xfer_t *last_xfer = NULL;
+    static uint16_t last_progress = 0;
+    uint8_t sreg = SREG;
+
+    cli();
+    if (current != NULL && current == last_xfer && x_progress == last_progress)
+        abort_current(TWI_TIMEOUT);
+    last_xfer = current;
+    last_progress = x_progress;
+    SREG = sreg;
+}
+
+
+// -- Speed profiles and counters ------------------------------------
+/*
+ * Function: twi_set_speed()
+ * Purpose:  Set the bit rate used for one device.
+ * Input:    addr Slave address
+ *           scl_hz Highest SCL frequency of the device
+ * Returns:  0 on success, -1 if no profile is free
+ */
+int8_t twi_set_speed(uint8_t addr, uint32_t scl_hz)
+{
+    twi_profile_t *p = find_profile(addr);
+    uint32_t div;
+    uint8_t sreg;
+
+    for (uint8_t i = 0; i < TWI_MAX_PROFILES && p == NULL; i++) {
+        if (!profiles[i].max_scl)
+            p = &profiles[i];
+    }
+    if (p == NULL)
+        return -1;
+
+    /* fscl = fcpu/(16 + 2*TWBR), never above the requested rate */
+    if (scl_hz > TWI_SCL_MAX)
+        scl_hz = TWI_SCL_MAX;
+    div = (F_CPU + scl_hz - 1) / scl_hz;
+    div = (div > 16) ? (div - 16 + 1) / 2 : 0;
+
+    sreg = SREG;
+    cli();
+    p->addr = addr;
+    p->max_scl = scl_hz;
+    p->twbr = (div > 255) ? 255 : (uint8_t)div;
+    bus_addr = 0xff;            /* Reload TWBR at the next transaction */
+    SREG = sreg;
+
+    return 0;
+}
+
+
+/*
+ * Function: twi_get_speed()
+ * Purpose:  Get the SCL frequency used for one device.
+ * Input:    addr Slave address
+ * Returns:  SCL frequency in Hz
+ */
+uint32_t twi_get_speed(uint8_t addr)
+{
+    twi_profile_t *p = find_profile(addr);
+    uint8_t twbr = p ? p->twbr : TWI_BIT_RATE_REG;
+
+    return F_CPU / (16 + 2 * (uint32_t)twbr);
+}
+
+
+/*
+ * Function: twi_stats()
+ * Purpose:  Get the failure counters of one device.
+ * Input:    addr Slave address
+ * Returns:  Counters or NULL
+ */
+const twi_stats_t *twi_stats(uint8_t addr)
+{
+    twi_profile_t *p = find_profile(addr);
+
+    return p ? &p->stats : NULL;
+}
+
+
+/*
+ * Function: twi_profile()
+ * Purpose:  Get a device profile by table index.
+ * Input:    i Index
+ * Returns:  Profile or NULL if unused
+ */
+const twi_profile_t *twi_profile(uint8_t i)
+{
+    if (i >= TWI_MAX_PROFILES || !profiles[i].max_scl)
+        return NULL;
+    return &profiles[i];
+}
+
+
+/*
+ * Function: twi_recoveries()
+ * Purpose:  Get the number of bus recoveries.
+ * Returns:  Recovery count
+ */
+uint16_t twi_recoveries(void)
+{
+    return recoveries;
+}
+
+
+/*
+ * Function: twi_reset_stats()
+ * Purpose:  Clear all failure counters.
+ * Returns:  none
+ */
+void twi_reset_stats(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+    for (uint8_t i = 0; i < TWI_MAX_PROFILES; i++)
+        profiles[i].stats = (twi_stats_t){0};
+    recoveries = 0;
+    SREG = sreg;
 }
@@ -19,6 +19,22 @@
  * This library defines functions for the TWI (I2C) communication between
  * AVR and Slave device(s). Functions use internal TWI module of AVR.
  *
+ * Transfers can be queued as transactions (twi_submit()) that run in the
+ * background from the TWI interrupt, or executed blocking (twi_transfer()).
+ * The byte-level functions twi_start(), twi_write(), twi_read() and
+ * twi_stop() poll the hardware directly and wait until the queue is idle.
+ *
+ * The bit rate is set per device: twi_set_speed() stores a profile
+ * (address, maximum clock, TWBR value) and the driver reloads TWBR whenever
+ * a transaction addresses a different device than the previous one.
+ * Devices without a profile and the byte-level functions use F_SCL.
+ *
+ * Every wait is bounded: a transfer that makes no progress for
+ * TWI_TIMEOUT_US fails with TWI_TIMEOUT, and the bus is released by
+ * twi_recover() (9 SCL pulses and a Stop condition). Transactions that run
+ * in the background are watched by twi_service(), which must be called
+ * periodically. Failures are counted per device (see twi_stats()).
+ *
  * @note Only Master transmitting and Master receiving modes are implemented. Based on Microchip Atmel ATmega16 and ATmega328P manuals.
  * @copyright (c) 2018-2024 Tomas Fryza, MIT license
  * @{
@@ -35,8 +51,12 @@
 #ifndef F_CPU
 # define F_CPU 16000000 /**< @brief CPU frequency in Hz required TWI_BIT_RATE_REG */
 #endif
-#define F_SCL 100000 /**< @brief I2C/TWI bit rate. Must be greater than 31000 */
-#define TWI_BIT_RATE_REG ((F_CPU/F_SCL - 16) / 2) /**< @brief TWI bit rate register value */
+#ifndef F_SCL
+# define F_SCL 100000 /**< @brief Default I2C/TWI bit rate. Must be greater than 31000 */
+#endif
+#define TWI_SCL_MAX 400000 /**< @brief Highest supported bit rate (Fast-mode) */
+#define TWI_BIT_RATE(_f) ((F_CPU/(_f) - 16) / 2) /**< @brief TWI bit rate register value for SCL frequency _f */
+#define TWI_BIT_RATE_REG TWI_BIT_RATE(F_SCL) /**< @brief TWI bit rate register value */
 
 
 /**
@@ -58,6 +78,90 @@
 #define PIN(_x) (*(&_x - 2)) /**< @brief Address of input register of port _x */
 
 
+/**
+ * @name Transaction queue
+ */
+#ifndef TWI_QUEUE_LEN
+# define TWI_QUEUE_LEN 8 /**< @brief Maximum number of queued transactions (power of two) */
+#endif
+
+/**
+ * @name Result codes
+ * TWI_NACK (1): address or data byte not acknowledged.
+ */
+#define TWI_OK      0    /**< @brief Transaction completed */
+#define TWI_ERROR   2    /**< @brief Bus error or arbitration lost */
+#define TWI_TIMEOUT 3    /**< @brief No progress within TWI_TIMEOUT_US */
+#define TWI_BUSY    0x80 /**< @brief Transaction queued or in progress */
+
+#ifndef TWI_TIMEOUT_US
+# define TWI_TIMEOUT_US 1000 /**< @brief Longest wait for one bus event (Start, byte, Stop) [us] */
+#endif
+
+
+/**
+ * @name Speed profiles
+ */
+#ifndef TWI_MAX_PROFILES
+# define TWI_MAX_PROFILES 4 /**< @brief Number of devices with their own bit rate */
+#endif
+
+/**
+ * @brief Build the bus speed benchmark (LCD redraw and BME280 read at
+ *        100 and 400 kHz, printed by main()).
+ * Enable with -DTWI_BENCH=1 in build_flags.
+ */
+#ifndef TWI_BENCH
+# define TWI_BENCH 0
+#endif
+
+
+// -- Types ----------------------------------------------------------
+/**
+ * @brief Failure counters of one slave device.
+ */
+typedef struct {
+    uint16_t nack;      /**< @brief Address or data byte not acknowledged */
+    uint16_t timeout;   /**< @brief No progress within TWI_TIMEOUT_US */
+    uint16_t error;     /**< @brief Bus error or arbitration lost */
+} twi_stats_t;
+
+/**
+ * @brief Bit rate profile and failure counters of one slave device.
+ */
+typedef struct {
+    uint8_t addr;       /**< @brief 7-bit slave address */
+    uint32_t max_scl;   /**< @brief Highest SCL frequency of the device [Hz], 0 = unused */
+    uint8_t twbr;       /**< @brief TWBR value used for the device */
+    twi_stats_t stats;  /**< @brief Failures of transactions to the device */
+} twi_profile_t;
+
+struct twi_xfer;
+
+/**
+ * @brief  Completion callback, called from the TWI interrupt.
+ *         May submit further transactions.
+ */
+typedef void (*twi_callback_t)(struct twi_xfer *xfer);
+
+/**
+ * @brief  One bus transaction: write wlen bytes, then (after a repeated
+ *         Start) read rlen bytes. Either part may be empty; with both
+ *         empty only the address is sent (presence test).
+ * @note   The descriptor and its buffers are owned by the caller and must
+ *         stay valid until status is no longer TWI_BUSY.
+ */
+typedef struct twi_xfer {
+    uint8_t addr;               /**< @brief 7-bit slave address */
+    const uint8_t *wbuf;        /**< @brief Bytes to write */
+    uint8_t wlen;               /**< @brief Number of bytes to write */
+    uint8_t *rbuf;              /**< @brief Buffer for read bytes */
+    uint8_t rlen;               /**< @brief Number of bytes to read */
+    twi_callback_t done;        /**< @brief Completion callback or NULL */
+    volatile uint8_t status;    /**< @brief TWI_BUSY, then TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT */
+} twi_xfer_t;
+
+
 // -- Function prototypes --------------------------------------------
 /**
  * @brief  Initialize TWI unit, enable internal pull-ups, and set SCL frequency.
@@ -73,9 +177,9 @@ void twi_init(void);
 
 /**
  * @brief  Start communication on I2C/TWI bus.
- * @return none
+ * @return TWI_OK, TWI_ERROR or TWI_TIMEOUT
  */
-void twi_start(void);
+uint8_t twi_start(void);
 
 
 /**
@@ -84,6 +188,7 @@ void twi_start(void);
  * @return ACK/NACK received value
  * @retval 0 - ACK has been received
  * @retval 1 - NACK has been received
+ * @retval TWI_TIMEOUT - the byte was not transmitted (bus released)
  * @note   Function returns 0 if 0x18, 0x28, or 0x40 status code is detected\n
  *           - 0x18: SLA+W has been transmitted and ACK has been received\n
  *           - 0x28: Data byte has been transmitted and ACK has been received\n
@@ -96,16 +201,19 @@ uint8_t twi_write(uint8_t data);
  * @brief  Read one byte from the I2C/TWI bus and acknowledge
  *         it by ACK or NACK.
  * @param  ack - ACK/NACK value to be transmitted
- * @return Received data byte
+ * @return Received data byte (0xff on timeout, reported by twi_stop())
  */
 uint8_t twi_read(uint8_t ack);
 
 
 /**
  * @brief  Generates Stop condition on I2C/TWI bus.
- * @return none
+ * @return First failure since the previous twi_stop(): TWI_OK, TWI_NACK,
+ *         TWI_ERROR or TWI_TIMEOUT
+ * @note   After a timeout the remaining byte-level calls up to twi_stop()
+ *         return at once.
  */
-void twi_stop(void);
+uint8_t twi_stop(void);
 
 
 /**
@@ -124,9 +232,114 @@ uint8_t twi_test_address(uint8_t addr);
  * @param  memaddr Starting address
  * @param  buf Buffer to be read into
  * @param  nbytes Number of bytes
+ * @return TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT
+ */
+uint8_t twi_readfrom_mem_into(uint8_t addr, uint8_t memaddr, volatile uint8_t *buf, uint8_t nbytes);
+
+
+/**
+ * @brief  Queue a transaction for background execution.
+ * @param  xfer Transaction descriptor (status is set to TWI_BUSY)
+ * @return 0 if queued, -1 if the queue is full
+ * @note   Safe to call from interrupts and completion callbacks.
+ */
+int8_t twi_submit(twi_xfer_t *xfer);
+
+
+/**
+ * @brief  Execute a transaction and wait for its completion.
+ * @param  xfer Transaction descriptor
+ * @return TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT
+ * @note   Also works with global interrupts disabled; the TWI unit is
+ *         then serviced by polling.
+ */
+uint8_t twi_transfer(twi_xfer_t *xfer);
+
+
+/**
+ * @brief  Wait until a submitted transaction is finished.
+ * @param  xfer Transaction descriptor
+ * @return TWI_OK, TWI_NACK, TWI_ERROR or TWI_TIMEOUT
+ */
+uint8_t twi_wait(twi_xfer_t *xfer);
+
+
+/**
+ * @brief  Check whether the transaction queue is empty and the bus idle.
+ * @return 1 if idle, 0 if a transaction is queued or running
+ */
+uint8_t twi_idle(void);
+
+
+/**
+ * @brief  Set the bit rate used for one device.
+ * @param  addr   7-bit slave address
+ * @param  scl_hz Highest SCL frequency the device supports [Hz]; limited
+ *                to TWI_SCL_MAX and rounded down to a reachable TWBR value
+ * @return 0 on success, -1 if all TWI_MAX_PROFILES profiles are in use
+ * @note   Takes effect with the next transaction to the device.
+ */
+int8_t twi_set_speed(uint8_t addr, uint32_t scl_hz);
+
+
+/**
+ * @brief  Get the SCL frequency used for one device.
+ * @param  addr 7-bit slave address
+ * @return SCL frequency [Hz] (F_SCL for devices without a profile)
+ */
+uint32_t twi_get_speed(uint8_t addr);
+
+
+/**
+ * @brief  Abort a background transaction that stopped making progress.
+ * @par    Implementation notes:
+ *           - A transaction that did not advance since the previous call
+ *             fails with TWI_TIMEOUT and the bus is recovered
+ *           - Call it periodically, at intervals longer than TWI_TIMEOUT_US
+ * @return none
+ */
+void twi_service(void);
+
+
+/**
+ * @brief  Release a stuck bus.
+ * @par    Implementation notes:
+ *           - Disables the TWI unit and clocks 9 SCL pulses so that a slave
+ *             holding SDA low can finish its byte, then generates Stop
+ *           - Re-enables the TWI unit
+ * @return none
+ */
+void twi_recover(void);
+
+
+/**
+ * @brief  Get the failure counters of one device.
+ * @param  addr 7-bit slave address
+ * @return Counters, or NULL if the device has no profile (twi_set_speed())
+ */
+const twi_stats_t *twi_stats(uint8_t addr);
+
+
+/**
+ * @brief  Get a device profile by table index (for reports).
+ * @param  i Index, 0 to TWI_MAX_PROFILES - 1
+ * @return Profile, or NULL if the entry is unused
+ */
+const twi_profile_t *twi_profile(uint8_t i);
+
+
+/**
+ * @brief  Get the number of bus recoveries since start or twi_reset_stats().
+ * @return Recovery count
+ */
+uint16_t twi_recoveries(void);
+
+
+/**
+ * @brief  Clear all failure counters.
  * @return none
  */
-void twi_readfrom_mem_into(uint8_t addr, uint8_t memaddr, volatile uint8_t *buf, uint8_t nbytes);
+void twi_reset_stats(void);
 
 /** @} */
 
@@ -241,6 +241,7 @@
 # define UART0_BIT_TXEN           TXEN0
 # define UART0_BIT_UCSZ0          UCSZ00
 # define UART0_BIT_UCSZ1          UCSZ01
+# define UART0_BIT_TXC            TXC0
 #elif defined(__AVR_ATtiny2313__) || defined(__AVR_ATtiny2313A__) || defined(__AVR_ATtiny4313__)
 /* ATtiny with one USART */
 # define UART0_RECEIVE_INTERRUPT  USART_RX_vect
@@ -355,6 +356,7 @@ static volatile unsigned char UART_TxTail;
 static volatile unsigned char UART_RxHead;
 static volatile unsigned char UART_RxTail;
 static volatile unsigned char UART_LastRxError;
+static volatile unsigned char UART_TxStarted;
 
 #if defined( ATMEGA_USART1 )
 static volatile unsigned char UART1_TxBuf[UART_TX_BUFFER_SIZE];
@@ -431,6 +433,11 @@ ISR(UART0_TRANSMIT_INTERRUPT)
         UART_TxTail = tmptail;
         /* get one byte from buffer and write it to UART */
         UART0_DATA = UART_TxBuf[tmptail]; /* start transmission */
+        #ifdef UART0_BIT_TXC
+        /* clear transmit complete, set again when the shifter runs empty */
+        UART0_STATUS = (UART0_STATUS & _BV(UART0_BIT_U2X)) | _BV(UART0_BIT_TXC);
+        UART_TxStarted = 1;
+        #endif
     }
     else
     {
@@ -452,6 +459,7 @@ void uart_init(unsigned int baudrate)
     UART_TxTail = 0;
     UART_RxHead = 0;
     UART_RxTail = 0;
+    UART_TxStarted = 0;
 
     #ifdef UART_TEST
     # ifndef UART0_BIT_U2X
@@ -552,6 +560,25 @@ void uart_putc(unsigned char data)
     UART0_CONTROL |= _BV(UART0_UDRIE);
 }/* uart_putc */
 
+/*************************************************************************
+ * Function: uart_tx_busy()
+ * Purpose:  check whether characters are still waiting or being sent
+ * Returns:  1 while the buffer or the transmitter holds data, 0 when idle
+ **************************************************************************/
+unsigned char uart_tx_busy(void)
+{
+    if (UART_TxHead != UART_TxTail)
+    {
+        return 1;
+    }
+    #ifdef UART0_BIT_TXC
+    /* last byte still in the shift register */
+    return UART_TxStarted && !(UART0_STATUS & _BV(UART0_BIT_TXC));
+    #else
+    return 0;
+    #endif
+}/* uart_tx_busy */
+
 /*************************************************************************
  * Function: uart_puts()
  * Purpose:  transmit string to UART
@@ -180,6 +180,17 @@ extern void uart_putc(unsigned char data);
 extern void uart_puts(const char *s);
 
 
+/**
+ *  @brief   Check whether the transmitter is still busy
+ *
+ *  Sleep modes that stop the I/O clock (ADC noise reduction, power-down)
+ *  would corrupt a character that is still being shifted out.
+ *
+ *  @return  1 while characters are buffered or being sent, 0 when idle
+ */
+extern unsigned char uart_tx_busy(void);
+
+
 /**
  * @brief    Put string from program memory to ringbuffer for transmitting via UART.
  *
@@ -21,4 +21,59 @@ void i2c_scan(void) {
     }
     
     uart_puts("I2C Scan: Done.\r\n");
-}
\ No newline at end of file
+}
+
+void i2c_report(void) {
+    char buf[64];
+
+    uart_puts("I2C: addr   kHz  nack  tout   err\r\n");
+    for(uint8_t i = 0; i < TWI_MAX_PROFILES; i++) {
+        const twi_profile_t *p = twi_profile(i);
+        if(p == NULL) {
+            continue;
+        }
+        sprintf(buf, "I2C: 0x%02X %5lu %5u %5u %5u\r\n", p->addr,
+                twi_get_speed(p->addr) / 1000, p->stats.nack, p->stats.timeout, p->stats.error);
+        uart_puts(buf);
+    }
+    sprintf(buf, "I2C: bus recoveries %u\r\n", twi_recoveries());
+    uart_puts(buf);
+}
+
+int32_t fixed_div_round(int32_t value, int32_t div) {
+    // Magnitude in unsigned arithmetic, no overflow at the int32 limits
+    uint32_t mag = (value < 0) ? 0u - (uint32_t)value : (uint32_t)value;
+
+    mag = (mag + (uint32_t)div / 2) / (uint32_t)div;
+    return (value < 0) ? -(int32_t)mag : (int32_t)mag;
+}
+
+char *fmt_fixed(char *buf, int32_t value, uint8_t dec, uint8_t width) {
+    char tmp[12];
+    uint8_t n = 0;
+    uint32_t mag = (value < 0) ? 0u - (uint32_t)value : (uint32_t)value;
+
+    // Digits in reverse order, at least one before the decimal point
+    do {
+        tmp[n++] = '0' + (mag % 10);
+        mag /= 10;
+        if (n == dec) {
+            tmp[n++] = '.';
+        }
+    } while (mag || n <= dec + (dec ? 1 : 0));
+    if (value < 0) {
+        tmp[n++] = '-';
+    }
+
+    // Right-align in the field
+    char *p = buf;
+    while (width > n) {
+        *p++ = ' ';
+        width--;
+    }
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    *p = '\0';
+    return p;
+}
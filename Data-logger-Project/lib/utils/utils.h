@@ -16,4 +16,31 @@
  */
 void i2c_scan(void);
 
+/**
+ * @brief Prints the speed and failure counters of the registered I2C devices to UART.
+ * Devices are registered by twi_set_speed() in their driver init.
+ */
+void i2c_report(void);
+
+/**
+ * @brief Divides a scaled integer with rounding half away from zero.
+ * Used to drop decimal places before formatting, e.g. 0.01 °C -> 0.1 °C.
+ * @param value Dividend.
+ * @param div   Divisor (positive).
+ * @return Rounded quotient.
+ */
+int32_t fixed_div_round(int32_t value, int32_t div);
+
+/**
+ * @brief Formats a scaled integer as a decimal number without float support.
+ * * Example: value 2137, dec 2 -> "21.37"; value -5, dec 2 -> "-0.05".
+ * Replaces dtostrf() for the fixed-point sample values.
+ * @param buf   Output buffer, at least 13 bytes (or width + 1 if larger).
+ * @param value Value in units of 10^-dec.
+ * @param dec   Number of decimal places (0-9).
+ * @param width Minimum field width, right-aligned with spaces like dtostrf().
+ * @return Pointer to the terminating zero in buf.
+ */
+char *fmt_fixed(char *buf, int32_t value, uint8_t dec, uint8_t width);
+
 #endif /* UTILS_H_ */
\ No newline at end of file
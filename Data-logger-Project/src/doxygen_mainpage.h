@@ -14,30 +14,55 @@
  * - **Sensors:**
  * - **BME280:** Measures Temperature, Humidity, and Atmospheric Pressure (I2C).
  * - **Photoresistor:** Measures ambient light intensity (Analog ADC).
+ * - **Battery Monitor:** Measures the supply battery through a resistive divider (Analog ADC).
  * - **User Interface:**
  * - **LCD Display (16x2):** Connected via I2C (PCF8574) to visualize real-time data.
  * - **Rotary Encoder (KY-040):** User input for switching display screens and controlling logging.
  * - **Data Logging:**
- * - **SD Card:** Logs measurement data to `DATA.TXT` in CSV format.
+ * - **SD Card:** Logs measurement data in CSV format to the pre-allocated file `DATA.TXT`, or optionally (SDLOG_ROTATE) to the file set `DATA000.TXT` ... `DATA999.TXT` (see tools/mklogset), rotated by size or by day.
  * - **File System:** Uses the lightweight **Petit FatFs** library.
  * - **Timekeeping:**
- * - **DS1302 RTC:** Provides accurate date and time for timestamps.
+ * - **DS1302 RTC:** Reference for a software calendar clock that timestamps samples
+ *   with millisecond resolution; synchronized once a minute with drift correction.
  *
  * @section structure_sec Software Architecture
  *
- * The project follows a non-blocking "Super-Loop" architecture with modular drivers:
+ * The project follows a non-blocking architecture: periodic work is registered
+ * with a cooperative deadline scheduler and run from the main loop, on top of
+ * modular drivers:
  *
  * - **Application Layer:**
- * - `main.c`: Central loop handling timing, sensor polling, and task scheduling.
+ * - `main.c`: Initialization and the tasks (encoder, sampling, LCD, SD, console).
+ * - `sampler`: Per-channel sampling and output rates with decimation filters
+ *   (e.g. light at 25 Hz averaged to 1 Hz).
+ * - `scheduler`: Runs tasks by priority and deadline and records their timing
+ *   (send `s` over UART for the report, `r` to clear it).
+ * - `calendar`: Date and time kept from the system clock, disciplined by the
+ *   DS1302 (send `c` over UART for the offset and measured drift).
+ * - `power`: Sleeps whenever no task is due: idle, ADC noise reduction during
+ *   conversions, power-down with watchdog or encoder wake-up when the next
+ *   sample is far away (send `p` over UART for the duty-cycle report).
+ *   Power-down needs sample periods above about 100 ms, which the defaults
+ *   do not use. UART input cannot wake the CPU, so console keys sent
+ *   during a power-down are lost.
  * - `loggerControl`: Manages the UI state machine and high-level control logic.
  * - `sdlog`: High-level wrapper for SD card operations.
  *
  * - **Driver Layer (lib/):**
  * - `bme280`: I2C driver for the Bosch BME280 sensor.
  * - `ds1302`: Bit-banged 3-wire driver for the Real-Time Clock.
+ * - `timebase`: Exact 1 ms system tick (Timer0 CTC) with `millis()` and a
+ *   4 us resolution `micros()` for scheduling, profiling and timestamps.
+ * - `adc`: Timer-triggered scan of several ADC channels in the ADC interrupt,
+ *   with per-channel oversampling (16x, 12-bit values), result rings and
+ *   calibration.
+ * - `LightSensor`, `battery`: Light level [%] and battery voltage [mV] from
+ *   their ADC channels.
  * - `lcd`: HD44780 LCD controller driver.
  * - `uart`: Interrupt-driven UART library for debug output.
- * - `twi`: I2C/TWI Master driver.
+ * - `twi`: Interrupt-driven I2C/TWI Master driver with a transaction queue,
+ *   per-device bit rates, timeouts and bus recovery (send `i` over UART for
+ *   the device failure counters).
  * - `gpio`, `timer`: Low-level AVR peripheral abstractions.
  * - `pff`: Petit FatFs library for SD card file system access.
  *
@@ -51,6 +76,7 @@
  * | **DS1302** | PB0-PB2 | D8-D10 | CE, IO, SCLK |
  * | **Encoder** | PD5-PD7 | D5-D7 | CLK, DT, SW |
  * | **Light** | PC0 | A0 | Analog Input |
+ * | **Battery** | PC1 | A1 | Analog Input (10k/10k divider) |
  *
  * @section authors_sec Authors
  *
@@ -21,84 +21,267 @@
 #include "twi.h"
 #include "bme280.h"
 #include "LightSensor.h"
+#include "battery.h"
+#include "adc.h"
 #include "loggerControl.h"
 #include "sdlog.h"
+#include "diskio.h"
 #include "lcd_i2c.h"
 #include "ds1302.h"
-#include "timer.h"
+#include "calendar.h"
+#include "timebase.h"
 #include "utils.h"
-
-/** @brief Sampling period in milliseconds. */
-#define SAMPLE_PERIOD_MS 1000UL
+#include "scheduler.h"
+#include "sampler.h"
+#include "power.h"
+
+/** @brief Encoder event handling period in milliseconds. */
+#define ENCODER_PERIOD_MS 20
+/** @brief LCD refresh check period in milliseconds. */
+#define LCD_PERIOD_MS 20
+/** @brief SD background work period in milliseconds. */
+#define SDLOG_PERIOD_MS 10
+/** @brief TWI watchdog period in milliseconds (longer than TWI_TIMEOUT_US). */
+#define TWI_PERIOD_MS 10
 
 /* --- Global Shared Variables --- */
-/** @brief Global temperature value [°C]. */
-volatile float g_T = 0.0f;
-/** @brief Global pressure value [hPa]. */
-volatile float g_P = 0.0f;
-/** @brief Global humidity value [%]. */
-volatile float g_H = 0.0f;
-/** @brief Global light intensity [%]. */
-volatile uint16_t g_Light = 0;
+/** @brief Global sensor values (fixed-point sample record). */
+volatile sample_t g_sample = {0};
 /** @brief Global system time structure. */
-volatile rtc_time_t g_time = {0, 0, 0};
+volatile rtc_time_t g_time = {0};
+
+/**
+ * @brief  Copy the software calendar clock into the global time structure.
+ * No RTC access: the DS1302 is only read by the periodic calendar sync.
+ */
+void sys_update_time(void) {
+    cal_time_t t;
+
+    calendar_now(&t);
+
+    // Atomically update global structure
+    uint8_t sreg = SREG;
+    cli();
+    g_time.hh = t.hh;
+    g_time.mm = t.mm;
+    g_time.ss = t.ss;
+    g_time.ms = t.ms;
+    g_time.date = t.date;
+    g_time.month = t.month;
+    g_time.year = t.year;
+    g_time.sec = t.sec;
+    SREG = sreg;
+}
 
-/** @brief System uptime counter in milliseconds. */
-volatile uint32_t g_millis = 0;
+/* --- Registration --- */
 
 /**
- * @brief Timer0 Overflow Interrupt Service Routine.
- * Increments the system uptime counter every 1 ms.
+ * @brief Register a task; report a full table or invalid arguments over UART.
+ * @return Task id, or -1 if not registered.
  */
-ISR(TIMER0_OVF_vect) {
-    g_millis++;
+static int8_t add_task(const char *name, sched_fn_t fn, uint16_t period_ms,
+                       uint16_t deadline_ms, uint8_t priority, uint16_t offset_ms) {
+    char buf[48];
+    int8_t id = sched_add(name, fn, period_ms, deadline_ms, priority, offset_ms);
+
+    if (id < 0) {
+        sprintf(buf, "ERR: Task %s not registered\r\n", name);
+        uart_puts(buf);
+    }
+    return id;
+}
+
+/** @brief Register a busy check; report a full table over UART. */
+static void add_busy_check(const char *name, power_busy_fn_t fn) {
+    char buf[48];
+
+    if (power_add_check(name, fn) < 0) {
+        sprintf(buf, "ERR: Busy check %s not registered\r\n", name);
+        uart_puts(buf);
+    }
+}
+
+/* --- Power Management --- */
+
+/** @brief Busy check of the TWI queue for the power manager. */
+static uint8_t twi_busy(void) {
+    return !twi_idle();
+}
+
+/** @brief Time until the sampler, the SD log or a timed task needs the CPU again [ms]. */
+static uint32_t app_quiet_ms(void) {
+    uint32_t now = millis();
+    uint32_t q = sampler_idle_ms(now);
+    uint32_t f = sd_log_idle_ms(now);
+    uint32_t t = sched_idle_ms();
+    if (f < q) q = f;
+    return (t < q) ? t : q;
+}
+
+/* --- Scheduler Tasks --- */
+
+/** @brief Handle rotate/click events queued by the encoder interrupt. */
+static void task_encoder(void) {
+    logger_encoder_poll();
+}
+
+/** @brief Redraw the LCD if the flag was set by the encoder or a sample. */
+static void task_display(void) {
+    if (flag_update_lcd) {
+        logger_display_draw();
+    }
 }
 
 /**
- * @brief  Get current system uptime safely (atomic read).
- * @return System uptime in milliseconds.
+ * @brief Sample the channels that are due; when any channel finishes its
+ * output period, publish the values, print them and log them.
  */
-static uint32_t millis(void) {
-    uint32_t t;
-    uint8_t sreg = SREG;
-    cli();
-    t = g_millis;
+static void task_sample(void) {
+    char debug_buffer[80];
+    sample_t s;
+
+    // A) Acquire Sensor Data (per-channel rates and decimation)
+    if (!sampler_poll(millis())) {
+        return;     // No channel has a new output value yet
+    }
+    sampler_get_sample(&s);
+
+    // B) Update Global State (Atomic)
+    uint8_t sreg = SREG; cli();
+    g_sample = s;
     SREG = sreg;
-    return t;
+
+    // C) Debug Output via UART (integer formatting, one decimal)
+    char bufT[12], bufP[12], bufH[12], bufB[12];
+    fmt_fixed(bufT, fixed_div_round(s.temp, 10), 1, 4);
+    fmt_fixed(bufP, fixed_div_round(s.press, 10), 1, 6);    // Pa -> 0.1 hPa
+    fmt_fixed(bufH, fixed_div_round(s.hum, 10), 1, 4);
+    fmt_fixed(bufB, s.batt, 3, 0);                          // mV -> V
+
+    sprintf(debug_buffer, "DATA: T=%s C, P=%s hPa, H=%s %%, L=%u %%, B=%s V\r\n",
+            bufT, bufP, bufH, s.light, bufB);
+    uart_puts(debug_buffer);
+
+    // D) Timestamp from the software clock
+    sys_update_time();
+
+    // E) Data Logging to SD
+    // If logging is enabled, append a new line to the file.
+    if(sd_logging) {
+        sd_log_append_line(&s);
+    }
+
+    // F) Request UI Refresh (to update values on screen)
+    flag_update_lcd = 1;
 }
 
 /**
- * @brief  Initialize Timer0 for 1ms overflow interrupts.
- * Uses macros from timer.h library.
+ * @brief SD background work.
+ * Polls the card busy state and writes buffered records
+ * if they waited longer than SDLOG_FLUSH_MS.
  */
-void timer0_init_system_tick(void) {
-    tim0_ovf_1ms();
-    tim0_ovf_enable();
+static void task_sdlog(void) {
+    sd_log_poll(millis());
+}
+
+/** @brief Abort background TWI transfers that stopped on a stuck bus. */
+static void task_twi(void) {
+    twi_service();
+}
+
+/** @brief Advance the calendar clock; resynchronize it with the DS1302 when due. */
+static void task_clock(void) {
+    // After an early wake the clock lags until the sleep is accounted;
+    // an RTC sync in that window would measure a wrong drift
+    if (power_settling()) {
+        calendar_advance();
+    } else {
+        calendar_poll();
+    }
+}
+
+/** @brief SD control logic (triggered by the encoder button). */
+static void task_sd_control(void) {
+    if(!flag_sd_toggle) {
+        return;
+    }
+    flag_sd_toggle = 0;
+
+    if(!sd_logging) {
+        // User requested START
+        if (sd_log_start() != 0) {
+            uart_puts("ERR: SD Start failed\r\n");
+        }
+    } else {
+        // User requested STOP
+        sd_log_stop();
+    }
+    // Update LCD to show/hide '*' recording icon
+    flag_update_lcd = 1;
 }
 
 /**
- * @brief  Reads the RTC, converts BCD to Binary, and updates the global time structure.
- * Should be called periodically or before data logging.
+ * @brief UART console: 's' prints the scheduler statistics, 'i' the I2C
+ * device counters, 'p' the power duty cycle, 'c' the calendar clock sync,
+ * 'r' clears the statistics.
  */
-void sys_update_time(void) {
-    ds1302_time_t raw_time;
+static void task_console(void) {
+    unsigned int c = uart_getc();
 
-    // 1. Read raw BCD data from DS1302
-    ds1302_read_time(&raw_time);
+    if (c & 0xFF00) {
+        return;     // No data or receive error
+    }
+    if ((char)c == 's') {
+        sched_report();
+    } else if ((char)c == 'i') {
+        i2c_report();
+    } else if ((char)c == 'p') {
+        power_report();
+    } else if ((char)c == 'c') {
+        calendar_report();
+    } else if ((char)c == 'r') {
+        sched_reset_stats();
+        twi_reset_stats();
+        power_reset_stats();
+        uart_puts("SCHED: stats cleared\r\n");
+    }
+}
 
-    // 2. Convert BCD to Binary
-    uint8_t hh = ((raw_time.hour >> 4) * 10) + (raw_time.hour & 0x0F);
-    uint8_t mm = ((raw_time.min  >> 4) * 10) + (raw_time.min  & 0x0F);
-    uint8_t ss = ((raw_time.sec  >> 4) * 10) + (raw_time.sec  & 0x0F);
+#if TWI_BENCH
+/**
+ * @brief Time an LCD full redraw and a BME280 result read at 100 and 400 kHz.
+ * The redraw is timed until the background refresh finishes, the BME280
+ * read is one bme280_collect_fixed() register fetch.
+ */
+static void twi_bench(void) {
+    static const uint32_t speeds[] = {100000, 400000};
+    bme280_data_t d;
+    char buf[80];
+
+    for (uint8_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        twi_set_speed(LCD_ADDR, speeds[i]);
+        twi_set_speed(BME280_I2C_ADDR, speeds[i]);
+
+        uint32_t t0 = micros();
+        lcd_i2c_redraw();
+        while (lcd_i2c_busy());
+        uint32_t t_lcd = micros() - t0;
+
+        uint32_t t_bme = 0;
+        if (bme280_read_fixed(&d) == 0) {   // Leaves a finished conversion
+            t0 = micros();
+            while (bme280_collect_fixed(&d));
+            t_bme = micros() - t0;
+        }
 
-    // 3. Atomically update global structure
-    uint8_t sreg = SREG;
-    cli();
-    g_time.hh = hh;
-    g_time.mm = mm;
-    g_time.ss = ss;
-    SREG = sreg;
+        sprintf(buf, "TWI bench: %lu Hz: LCD redraw %lu us, BME280 read %lu us\r\n",
+                twi_get_speed(LCD_ADDR), t_lcd, t_bme);
+        uart_puts(buf);
+    }
+    twi_set_speed(LCD_ADDR, LCD_SCL_HZ);
+    twi_set_speed(BME280_I2C_ADDR, BME280_SCL_HZ);
 }
+#endif
 
 /**
  * @brief Main application function.
@@ -132,7 +315,8 @@ int main(void) {
     */
     /* ----------------------------------------------------------- */
 
-    // Initial time read
+    // Software clock: whole seconds now, sub-second phase at the first sync
+    calendar_init(micros);
     sys_update_time();
 
     /* --- 2. Peripherals Initialization --- */
@@ -144,101 +328,101 @@ int main(void) {
     // SD Card Init (Internal flags only)
     sd_log_init();
 
-    // Timer setup & Interrupts enable
-    timer0_init_system_tick();
+    // 1 ms system tick & Interrupts enable
+    timebase_init();
     sei();
 
     uart_puts("--- System Boot Complete ---\r\n");
 
+#if DISKIO_BENCH
+    // SPI transfer kernels: CPU cycles per 512-byte sector
+    disk_bench_t bench;
+    char bench_buffer[80];
+    disk_bench(&bench);
+    sprintf(bench_buffer, "SPI bench: tx %u/%u, rx %u/%u, skip %u cycles\r\n",
+            bench.send_byte, bench.send_block, bench.recv_byte, bench.recv_block,
+            bench.skip_block);
+    uart_puts(bench_buffer);
+#endif
+
     // Optional: Scan I2C bus for debugging
     i2c_scan();
 
     /* --- 3. Sensor Initialization --- */
     uart_puts("Sensors: Init BME280...\r\n");
-    bme280_init();
+    if (bme280_init() != TWI_OK) {
+        uart_puts("ERR: BME280 not responding\r\n");
+    }
+
+#if BME280_BENCH
+    // Compensation cost: 64-bit vs 32-bit pressure formula
+    bme280_bench_t comp_bench;
+    char comp_buffer[64];
+    bme280_bench(&comp_bench);
+    sprintf(comp_buffer, "BME280 bench: int64 %u + float %u, int32 %u cycles\r\n",
+            comp_bench.comp_int64, comp_bench.to_float, comp_bench.comp_int32);
+    uart_puts(comp_buffer);
+#endif
+
+    // Analog channels share the background ADC scan
+    adc_init();
 
     uart_puts("Sensors: Init Light Sensor...\r\n");
     lightSensor_init(0); // Analog pin A0
     lightSensor_setCalibration(10, 750);
 
+    uart_puts("Sensors: Init Battery Monitor...\r\n");
+    battery_init(1);     // Analog pin A1 (divider)
+
+    // Per-channel sampling/output rates (defaults from sampler.h)
+    sampler_init();
+
     // UI Controls
     logger_display_init();
     logger_encoder_init();
 
-    /* --- 4. Loop Variables --- */
-    uint32_t last_sample_time = 0;
-    char debug_buffer[80];
-    float temp, press, hum;
-    uint16_t calLight;
-
-    /* === Main Super-Loop === */
+#if TWI_BENCH
+    // Bus-bound work at standard and fast mode (LCD shows the boot screen)
+    twi_bench();
+#endif
+
+    /* --- 4. Task Registration --- */
+    // Priority 0 is the most urgent; deadlines are relative to each release
+    sched_init(micros);
+    // Polls may be slept through: their work is announced by the quiet time
+    // (sample, sdlog), a busy check (twi, clock sync) or the encoder wake-up
+    // (encoder, sdctl, lcd). The console is a poll because UART RX cannot
+    // wake the CPU: keys sent during a power-down are lost.
+    sched_set_poll(add_task("twi",     task_twi,        TWI_PERIOD_MS,     0,   0, 0));
+    sched_set_poll(add_task("encoder", task_encoder,    ENCODER_PERIOD_MS, 0,   0, 0));
+    sched_set_poll(add_task("sample",  task_sample,     SAMPLER_TICK_MS,   0,   1, 0));
+    sched_set_poll(add_task("sdlog",   task_sdlog,      SDLOG_PERIOD_MS,   0,   2, 0));
+    sched_set_poll(add_task("sdctl",   task_sd_control, 50,                0,   2, 0));
+    sched_set_poll(add_task("clock",   task_clock,      CAL_POLL_MS,       0,   2, 0));
+    sched_set_poll(add_task("lcd",     task_display,    LCD_PERIOD_MS,     100, 3, 0));
+    sched_set_poll(add_task("console", task_console,    100,               0,   4, 0));
+
+    // Sleep between tasks; drivers that need the I/O clock keep it running
+    power_init(micros, app_quiet_ms);
+    add_busy_check("uart",  uart_tx_busy);
+    add_busy_check("twi",   twi_busy);
+    add_busy_check("lcd",   lcd_i2c_busy);
+    add_busy_check("sd",    sd_log_busy);
+    add_busy_check("ui",    logger_ui_busy);
+    add_busy_check("clock", calendar_busy);
+
+    sampler_start(millis());
+
+    /* === Main Loop === */
+    // All periodic work is a registered task; add new work above
     while(1) {
-        uint32_t current_time = millis();
-
-        // -- TASK 1: UI Input Polling --
-        // Polls the rotary encoder and button state
-        logger_encoder_poll();
-
-        // -- TASK 2: Display Update --
-        // Redraws LCD if the flag was set by encoder or timer
-        if (flag_update_lcd) {
-            logger_display_draw();
-        }
-
-        // -- TASK 3: Periodic Sampling (1000 ms) --
-        if (current_time - last_sample_time >= SAMPLE_PERIOD_MS) {
-            last_sample_time = current_time;
-
-            // A) Acquire Sensor Data
-            bme280_read(&temp, &press, &hum);
-            calLight = lightSensor_readCalibrated();
-
-            // B) Update Global State (Atomic)
-            uint8_t sreg = SREG; cli();
-            g_T = temp;
-            g_P = press;
-            g_H = hum;
-            g_Light = calLight;
-            SREG = sreg;
-
-            // C) Debug Output via UART
-            char bufT[10], bufP[10], bufH[10];
-            dtostrf(temp, 4, 1, bufT);
-            dtostrf(press, 6, 1, bufP);
-            dtostrf(hum, 4, 1, bufH);
-
-            sprintf(debug_buffer, "DATA: T=%s C, P=%s hPa, H=%s %%, L=%u %%\r\n",
-                    bufT, bufP, bufH, calLight);
-            uart_puts(debug_buffer);
-
-            // D) Update System Time from RTC
-            sys_update_time();
-
-            // E) Data Logging to SD
-            // If logging is enabled, append a new line to the file.
-            if(sd_logging) {
-                sd_log_append_line(g_T, g_P, g_H, g_Light);
-            }
-
-            // F) Request UI Refresh (to update values on screen)
-            flag_update_lcd = 1;
-        }
-
-        // -- TASK 4: SD Control Logic (Triggered by Encoder Button) --
-        if(flag_sd_toggle) {
-            flag_sd_toggle = 0;
-
-            if(!sd_logging) {
-                // User requested START
-                if (sd_log_start() != 0) {
-                    uart_puts("ERR: SD Start failed\r\n");
-                }
-            } else {
-                // User requested STOP
-                sd_log_stop();
+        if (!sched_run()) {
+            // Nothing due: sleep until the next interrupt
+            uint32_t slept = power_idle();
+            if (slept) {
+                timebase_advance(slept);
+                sched_resume();
             }
-            // Update LCD to show/hide '*' recording icon
-            flag_update_lcd = 1;
         }
     }
 
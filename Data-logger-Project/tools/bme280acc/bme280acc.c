@@ -0,0 +1,263 @@
+/**
+ * @file bme280acc.c
+ * @brief Host accuracy test of the BME280 compensation builds.
+ *
+ * Runs bme280_compensate_int64() (the original firmware path) and
+ * bme280_compensate_int32() from lib/Bme280/bme280_comp.c over a corpus
+ * of raw readings and compares both against the Bosch double-precision
+ * reference formulas:
+ *
+ *  - calibration sets: the datasheet example plus -n random variations,
+ *  - raw readings: a grid over the operating range (-40..85 °C,
+ *    300..1100 hPa, 0..100 %RH) found by inverting the reference, plus
+ *    the readings of an optional CSV file (adc_T,adc_P,adc_H per line).
+ *
+ * Reported: maximum and mean absolute error per quantity and the number
+ * of readings where the two integer builds disagree.
+ * CPU cycles on the target are measured with BME280_BENCH (bme280_bench()).
+ *
+ * Build and run (from this directory):
+ * @code
+ * gcc -O2 -Wall -I../../lib/Bme280 -o bme280acc bme280acc.c ../../lib/Bme280/bme280_comp.c -lm
+ * ./bme280acc -n 200
+ * @endcode
+ *
+ * @author Team DE2-Project
+ * @date 2025
+ */
+
+#define _XOPEN_SOURCE 700
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bme280.h"
+
+/* -- Reference (Bosch double-precision formulas) --------------------- */
+
+/** @brief Reference result in physical units. */
+typedef struct {
+    double t;   /**< [°C] */
+    double p;   /**< [Pa] */
+    double h;   /**< [%RH] */
+} ref_t;
+
+static int16_t dig_H4(const bme280_calib_t *c) { return (int16_t)(((int8_t)c->e4 * 16) | (c->e5 & 0x0F)); }
+static int16_t dig_H5(const bme280_calib_t *c) { return (int16_t)(((int8_t)c->e6 * 16) | (c->e5 >> 4)); }
+
+static void reference(const bme280_calib_t *c, const bme280_raw_t *raw, ref_t *r)
+{
+    double var1, var2, p, h;
+
+    var1 = (raw->adc_T / 16384.0 - c->dig_T1 / 1024.0) * c->dig_T2;
+    var2 = (raw->adc_T / 131072.0 - c->dig_T1 / 8192.0);
+    var2 = var2 * var2 * c->dig_T3;
+    double t_fine = var1 + var2;
+    r->t = t_fine / 5120.0;
+
+    var1 = t_fine / 2.0 - 64000.0;
+    var2 = var1 * var1 * c->dig_P6 / 32768.0;
+    var2 = var2 + var1 * c->dig_P5 * 2.0;
+    var2 = var2 / 4.0 + c->dig_P4 * 65536.0;
+    var1 = (c->dig_P3 * var1 * var1 / 524288.0 + c->dig_P2 * var1) / 524288.0;
+    var1 = (1.0 + var1 / 32768.0) * c->dig_P1;
+    if (var1 == 0.0) {
+        r->p = 0;
+    } else {
+        p = 1048576.0 - raw->adc_P;
+        p = (p - var2 / 4096.0) * 6250.0 / var1;
+        var1 = c->dig_P9 * p * p / 2147483648.0;
+        var2 = p * c->dig_P8 / 32768.0;
+        r->p = p + (var1 + var2 + c->dig_P7) / 16.0;
+    }
+
+    h = t_fine - 76800.0;
+    h = (raw->adc_H - (dig_H4(c) * 64.0 + dig_H5(c) / 16384.0 * h)) *
+        (c->dig_H2 / 65536.0 * (1.0 + c->dig_H6 / 67108864.0 * h * (1.0 + c->dig_H3 / 67108864.0 * h)));
+    h = h * (1.0 - c->dig_H1 * h / 524288.0);
+    r->h = h < 0.0 ? 0.0 : (h > 100.0 ? 100.0 : h);
+}
+
+/* -- Corpus ---------------------------------------------------------- */
+
+/** @brief Datasheet example calibration (humidity: typical part). */
+static const bme280_calib_t calib_datasheet = {
+    .dig_T1 = 27504, .dig_T2 = 26435, .dig_T3 = -1000,
+    .dig_P1 = 36477, .dig_P2 = -10685, .dig_P3 = 3024, .dig_P4 = 2855,
+    .dig_P5 = 140, .dig_P6 = -7, .dig_P7 = 15500, .dig_P8 = -14600, .dig_P9 = 6000,
+    .dig_H1 = 75, .dig_H2 = 362, .dig_H3 = 0,
+    .e4 = 0x13, .e5 = 0x29, .e6 = 0x03, .dig_H6 = 30,   /* H4 = 313, H5 = 50 */
+};
+
+static uint32_t rng = 12345;
+
+static uint32_t next_rand(void)
+{
+    rng = rng * 1103515245u + 12345u;
+    return rng >> 8;
+}
+
+/** @brief Scale a parameter by a random factor in [1 - spread, 1 + spread]. */
+static long vary(long v, double spread)
+{
+    double f = 1.0 + spread * (2.0 * (next_rand() & 0xFFFF) / 65535.0 - 1.0);
+    return lround(v * f);
+}
+
+static void random_calib(bme280_calib_t *c)
+{
+    *c = calib_datasheet;
+    c->dig_T1 = (uint16_t)vary(c->dig_T1, 0.05);
+    c->dig_T2 = (int16_t)vary(c->dig_T2, 0.05);
+    c->dig_T3 = (int16_t)vary(c->dig_T3, 0.20);
+    c->dig_P1 = (uint16_t)vary(c->dig_P1, 0.05);
+    c->dig_P2 = (int16_t)vary(c->dig_P2, 0.10);
+    c->dig_P3 = (int16_t)vary(c->dig_P3, 0.10);
+    c->dig_P4 = (int16_t)vary(c->dig_P4, 0.50);
+    c->dig_P5 = (int16_t)vary(c->dig_P5, 0.50);
+    c->dig_P6 = (int16_t)vary(c->dig_P6, 0.50);
+    c->dig_P7 = (int16_t)vary(c->dig_P7, 0.10);
+    c->dig_P8 = (int16_t)vary(c->dig_P8, 0.10);
+    c->dig_P9 = (int16_t)vary(c->dig_P9, 0.10);
+    c->dig_H1 = (uint8_t)vary(c->dig_H1, 0.10);
+    c->dig_H2 = (int16_t)vary(c->dig_H2, 0.10);
+    c->dig_H6 = (int8_t)vary(c->dig_H6, 0.10);
+}
+
+/**
+ * @brief Find the raw value whose reference result hits a target (bisection).
+ * @param sel 0 = temperature, 1 = pressure, 2 = humidity.
+ */
+static int32_t invert(const bme280_calib_t *c, bme280_raw_t *raw, int sel, double target)
+{
+    int32_t lo = 0, hi = (sel == 2) ? 0xFFFF : 0xFFFFF;
+    ref_t r;
+
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        if (sel == 0) raw->adc_T = mid; else if (sel == 1) raw->adc_P = mid; else raw->adc_H = mid;
+        reference(c, raw, &r);
+        double v = (sel == 0) ? r.t : (sel == 1) ? r.p : r.h;
+        /* Pressure falls with adc_P, T and H rise with their ADC value */
+        if ((sel == 1) ? (v > target) : (v < target)) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/* -- Statistics ------------------------------------------------------ */
+
+typedef struct {
+    double max, sum;
+    unsigned long n;
+} err_t;
+
+static void err_add(err_t *e, double d)
+{
+    d = fabs(d);
+    if (d > e->max) e->max = d;
+    e->sum += d;
+    e->n++;
+}
+
+static struct {
+    err_t t, p64, p32, h, p_diff;
+    unsigned long p_mismatch, readings;
+} st;
+
+static void check(const bme280_calib_t *c, const bme280_raw_t *raw)
+{
+    bme280_data_t d64, d32;
+    ref_t r;
+
+    reference(c, raw, &r);
+    if (r.t < -40.0 || r.t > 85.0 || r.p < 30000.0 || r.p > 110000.0) return;
+
+    bme280_compensate_int64(c, raw, &d64);
+    bme280_compensate_int32(c, raw, &d32);
+
+    st.readings++;
+    err_add(&st.t, d32.temperature / 100.0 - r.t);
+    err_add(&st.p64, (double)d64.pressure - r.p);
+    err_add(&st.p32, (double)d32.pressure - r.p);
+    err_add(&st.p_diff, (double)d32.pressure - (double)d64.pressure);
+    err_add(&st.h, d32.humidity / 1024.0 - r.h);
+    if (d32.pressure != d64.pressure) st.p_mismatch++;
+}
+
+static void run_grid(const bme280_calib_t *c)
+{
+    bme280_raw_t raw = {0, 0, 0};
+
+    for (double t = -40.0; t <= 85.0; t += 5.0) {
+        raw.adc_T = invert(c, &raw, 0, t);
+        for (double p = 30000.0; p <= 110000.0; p += 2500.0) {
+            raw.adc_P = invert(c, &raw, 1, p);
+            for (double h = 0.0; h <= 100.0; h += 10.0) {
+                raw.adc_H = invert(c, &raw, 2, h);
+                check(c, &raw);
+            }
+        }
+    }
+}
+
+static int run_file(const bme280_calib_t *c, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+    long t, p, h;
+
+    if (!f) { perror(path); return -1; }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%ld,%ld,%ld", &t, &p, &h) == 3) {
+            bme280_raw_t raw = { (int32_t)p, (int32_t)t, (int32_t)h };
+            check(c, &raw);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static void print_err(const char *name, const err_t *e, const char *unit)
+{
+    printf("  %-22s max %9.4f  mean %9.4f %s\n", name, e->max, e->n ? e->sum / e->n : 0.0, unit);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n calib_sets] [-s seed] [-f raw.csv]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned n_sets = 50;
+    const char *file = NULL;
+    bme280_calib_t c;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:f:h")) != -1) {
+        switch (opt) {
+        case 'n': n_sets = strtoul(optarg, 0, 0); break;
+        case 's': rng = strtoul(optarg, 0, 0); break;
+        case 'f': file = optarg; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+
+    for (unsigned i = 0; i <= n_sets; i++) {
+        if (i == 0) c = calib_datasheet; else random_calib(&c);
+        run_grid(&c);
+        if (file && run_file(&c, file) < 0) return 1;
+    }
+
+    printf("BME280 compensation accuracy: %u calibration sets, %lu readings\n",
+           n_sets + 1, st.readings);
+    print_err("temperature", &st.t, "degC");
+    print_err("pressure int64", &st.p64, "Pa");
+    print_err("pressure int32", &st.p32, "Pa");
+    print_err("pressure int32-int64", &st.p_diff, "Pa");
+    print_err("humidity", &st.h, "%RH");
+    printf("  pressure int32 != int64 in %lu readings (%.2f %%)\n",
+           st.p_mismatch, st.readings ? 100.0 * st.p_mismatch / st.readings : 0.0);
+    return 0;
+}
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+# Pre-allocate the rotating log file set DATA000 ... DATA999 on a mounted
+# SD card (lib/sdlog with SDLOG_ROTATE). Petit FatFs cannot create or grow
+# files, so every file must exist at its final size before logging.
+#
+# Files are created one after another on a freshly formatted card so their
+# directory entries are in order and each file is one contiguous extent.
+#
+#   python3 mklogset.py /media/sdcard --count 365 --size 1M --ext TXT
+import argparse
+import os
+
+
+def parse_size(text):
+    units = {"K": 1024, "M": 1024 ** 2, "G": 1024 ** 3}
+    text = text.strip().upper()
+    if text[-1] in units:
+        return int(float(text[:-1]) * units[text[-1]])
+    return int(text)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Pre-allocate the SD log file set")
+    ap.add_argument("root", help="mount point of the SD card")
+    ap.add_argument("--count", type=int, default=1000, help="number of files (max 1000)")
+    ap.add_argument("--size", type=parse_size, default=1024 ** 2, help="size of each file (e.g. 512K, 4M)")
+    ap.add_argument("--ext", default="TXT", choices=["TXT", "BIN"], help="log format extension")
+    args = ap.parse_args()
+
+    if not 1 <= args.count <= 1000:
+        ap.error("--count must be between 1 and 1000")
+    size = args.size // 512 * 512           # Whole sectors only
+    if size == 0:
+        ap.error("--size must be at least 512 bytes")
+
+    zero = bytes(64 * 1024)
+    for n in range(args.count):
+        path = os.path.join(args.root, f"DATA{n:03d}.{args.ext}")
+        with open(path, "wb") as fh:
+            left = size
+            while left:
+                chunk = min(left, len(zero))
+                fh.write(zero[:chunk])
+                left -= chunk
+            fh.flush()
+            os.fsync(fh.fileno())
+    print(f"{args.count} files of {size} bytes in {args.root}")
+
+
+if __name__ == "__main__":
+    main()
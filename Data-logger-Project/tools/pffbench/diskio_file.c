@@ -0,0 +1,209 @@
+/**
+ * @file diskio_file.c
+ * @brief Host disk I/O backend for Petit FatFs backed by an image file.
+ *
+ * Mirrors the protocol of lib/pff/diskio.c (partial sector writes, CMD25
+ * sessions, deferred busy state) so pff.c behaves exactly as on the card,
+ * while data goes to a FAT image and time goes to a simulated clock.
+ *
+ * @author Team DE2-Project
+ * @date 2025
+ */
+
+#define _XOPEN_SOURCE 700
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "diskio_file.h"
+
+disk_stats_t disk_stats;
+
+static int img_fd = -1;             /**< Image file descriptor */
+static disk_model_t model;          /**< Active latency model */
+static DWORD fat_lo, fat_hi;        /**< FAT area [fat_lo, fat_hi) */
+
+static BYTE sect_buf[512];          /**< Sector being written */
+static DWORD sect_no;               /**< Sector number of sect_buf */
+static UINT wc;                     /**< Bytes left in the sector being written */
+static uint64_t busy_until;         /**< Time the card finishes programming [ns] */
+static BYTE stop_pending;           /**< Stop Tran queued until the card is ready */
+#if PF_USE_STREAM
+static DWORD stream_next;           /**< Sector expected by the open session (0 = none) */
+#endif
+
+
+/* -- Latency model -------------------------------------------------- */
+
+/** @brief Account SPI transfer time of n bytes. */
+static void spi_bytes(uint32_t n)
+{
+    disk_stats.now_ns += (uint64_t)n * model.byte_ns;
+}
+
+/** @brief Account one command round trip. */
+static void command(void)
+{
+    disk_stats.commands++;
+    disk_stats.now_ns += (uint64_t)model.cmd_us * 1000;
+    spi_bytes(8);
+}
+
+/** @brief Block until the card is ready (wait_idle() of the real driver). */
+static void wait_idle(void)
+{
+    while (disk_busy()) {
+        if (disk_stats.now_ns < busy_until) disk_stats.now_ns = busy_until;
+    }
+}
+
+
+/* -- Backend control ------------------------------------------------ */
+
+int disk_file_open(const char *path, const disk_model_t *m, DWORD fat_from, DWORD fat_to)
+{
+    img_fd = open(path, O_RDWR);
+    if (img_fd < 0) return -1;
+
+    model = *m;
+    fat_lo = fat_from;
+    fat_hi = fat_to;
+    memset(&disk_stats, 0, sizeof(disk_stats));
+    return 0;
+}
+
+void disk_file_close(void)
+{
+    if (img_fd >= 0) close(img_fd);
+    img_fd = -1;
+}
+
+void disk_file_idle(uint32_t us)
+{
+    disk_stats.now_ns += (uint64_t)us * 1000;
+}
+
+
+/* -- diskio.h interface --------------------------------------------- */
+
+DSTATUS disk_initialize(void)
+{
+    busy_until = 0;
+    stop_pending = 0;
+#if PF_USE_STREAM
+    stream_next = 0;
+#endif
+    return (img_fd >= 0) ? 0 : STA_NOINIT;
+}
+
+DRESULT disk_readp(BYTE* buff, DWORD sector, UINT offset, UINT count)
+{
+    BYTE tmp[512];
+
+    if (!count) return RES_PARERR;
+#if PF_USE_STREAM
+    disk_stop_write();
+#endif
+    wait_idle();
+
+    command();
+    spi_bytes(512 + 2 + 1);
+    disk_stats.reads++;
+    if (sector >= fat_lo && sector < fat_hi) disk_stats.fat_reads++;
+
+    if (pread(img_fd, tmp, 512, (off_t)sector * 512) != 512) return RES_ERROR;
+    if (buff) memcpy(buff, tmp + offset, count);
+    return RES_OK;
+}
+
+#if PF_USE_CLMT
+DRESULT disk_scanp(BYTE* buff, UINT size, DWORD sector, UINT offset, UINT count,
+                   UINT (*func)(const BYTE*, UINT))
+{
+    BYTE tmp[512];
+    UINT n;
+
+    if (!count || !size || offset + count > 512) return RES_PARERR;
+    if (disk_readp(tmp, sector, 0, 512)) return RES_ERROR;
+    while (count) {
+        n = (count < size) ? count : size;
+        memcpy(buff, tmp + offset, n);
+        offset += n;
+        count -= n;
+        if (!func(buff, n)) break;
+    }
+    return RES_OK;
+}
+#endif
+
+DRESULT disk_writep(const BYTE* buff, DWORD sc)
+{
+    if (buff) {
+        UINT bc = (UINT)sc;
+        if (bc > wc) bc = wc;
+        memcpy(&sect_buf[512 - wc], buff, bc);
+        wc -= bc;
+        spi_bytes(bc);
+        return RES_OK;
+    }
+
+    if (sc) {
+#if PF_USE_STREAM
+        if (stream_next && sc == stream_next) {
+            wait_idle();
+            spi_bytes(2);                   /* Data token */
+            stream_next++;
+        } else {
+            disk_stop_write();
+            command();
+            spi_bytes(2);
+            stream_next = sc + 1;
+            disk_stats.sessions++;
+        }
+#else
+        command();
+        spi_bytes(2);
+#endif
+        sect_no = sc;
+        wc = 512;
+        return RES_OK;
+    }
+
+    /* Finalize: pad, CRC, data response */
+    spi_bytes(wc + 2 + 1);
+    memset(&sect_buf[512 - wc], 0, wc);
+    wc = 0;
+    if (pwrite(img_fd, sect_buf, 512, (off_t)sect_no * 512) != 512) return RES_ERROR;
+    disk_stats.sectors++;
+#if PF_USE_STREAM
+    busy_until = disk_stats.now_ns + (uint64_t)model.stream_busy_us * 1000;
+#else
+    busy_until = disk_stats.now_ns + (uint64_t)model.busy_us * 1000;
+#endif
+    return RES_OK;
+}
+
+BYTE disk_busy(void)
+{
+    if (disk_stats.now_ns >= busy_until && !stop_pending) return 0;
+
+    spi_bytes(2);
+    if (disk_stats.now_ns < busy_until) return 1;
+
+    /* Ready: send the queued Stop Tran, the card closes the session */
+    stop_pending = 0;
+    spi_bytes(2);
+    busy_until = disk_stats.now_ns + (uint64_t)model.busy_us * 1000;
+    return 1;
+}
+
+#if PF_USE_STREAM
+DRESULT disk_stop_write(void)
+{
+    if (stream_next) {
+        stream_next = 0;
+        stop_pending = 1;
+        disk_busy();
+    }
+    return RES_OK;
+}
+#endif
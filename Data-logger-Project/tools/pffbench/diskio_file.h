@@ -0,0 +1,60 @@
+/**
+ * @file diskio_file.h
+ * @brief Host (Linux) disk I/O backend for Petit FatFs backed by an image file.
+ *
+ * Implements the diskio.h interface on top of a FAT image so lib/pff can be
+ * built and measured on a PC. Every card operation advances a simulated
+ * clock according to a simple SD latency model (command overhead, SPI byte
+ * time and flash programming busy time).
+ *
+ * @author Team DE2-Project
+ * @date 2025
+ */
+
+#ifndef DISKIO_FILE_H
+#define DISKIO_FILE_H
+
+#include <stdint.h>
+#include "diskio.h"
+
+/** @brief SD card latency model. */
+typedef struct {
+    uint32_t cmd_us;          /**< Command round trip overhead [us] */
+    uint32_t byte_ns;         /**< SPI transfer time per byte [ns] */
+    uint32_t busy_us;         /**< Programming time of a single-block write [us] */
+    uint32_t stream_busy_us;  /**< Programming time of a block inside CMD25 [us] */
+} disk_model_t;
+
+/** @brief Counters collected by the backend. */
+typedef struct {
+    uint64_t now_ns;          /**< Simulated time since disk_file_open() [ns] */
+    uint32_t reads;           /**< disk_readp() and disk_scanp() calls */
+    uint32_t fat_reads;       /**< Reads that hit the FAT area */
+    uint32_t commands;        /**< Read/write commands sent to the card */
+    uint32_t sectors;         /**< Sectors written */
+    uint32_t sessions;        /**< CMD25 sessions opened */
+} disk_stats_t;
+
+/** @brief Live counters, reset by disk_file_open(). */
+extern disk_stats_t disk_stats;
+
+/**
+ * @brief  Attach an image file as the card.
+ * @param  path     Image file path.
+ * @param  model    Latency model.
+ * @param  fat_from First sector of the FAT area (for FAT read accounting).
+ * @param  fat_to   First sector after the FAT area.
+ * @return 0 on success, -1 if the file cannot be opened.
+ */
+int disk_file_open(const char *path, const disk_model_t *model, DWORD fat_from, DWORD fat_to);
+
+/** @brief Detach the image file. */
+void disk_file_close(void);
+
+/**
+ * @brief  Advance the simulated clock (application work between writes).
+ * @param  us Time to add [us].
+ */
+void disk_file_idle(uint32_t us);
+
+#endif /* DISKIO_FILE_H */
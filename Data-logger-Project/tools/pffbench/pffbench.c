@@ -0,0 +1,331 @@
+/**
+ * @file pffbench.c
+ * @brief Host throughput benchmark of lib/pff for the SD logger write path.
+ *
+ * Builds a sparse FAT32 image holding a pre-allocated DATA.TXT, mounts it
+ * through the file-backed diskio (diskio_file.c) and replays the text lines
+ * produced by sd_log_append_line(), for several cluster sizes:
+ *
+ *  - direct: one pf_write() per line (the original logger),
+ *  - staged: lines collected in a 512 B buffer and written per sector,
+ *            with a partial-sector flush every N lines (lib/sdlog).
+ *
+ * Reported per run: sectors/s and payload rate on the simulated clock,
+ * FAT sector reads per MB of log, the worst pf_write() latency, the cost of
+ * pf_open() and of the seek to the end of the file after a remount (the
+ * resume path of the logger).
+ *
+ * Build and run (from this directory):
+ * @code
+ * gcc -O2 -Wall -I../../lib/pff -o pffbench pffbench.c diskio_file.c ../../lib/pff/pff.c
+ * ./pffbench -m 1024 -c 8
+ * @endcode
+ *
+ * @author Team DE2-Project
+ * @date 2025
+ */
+
+#define _XOPEN_SOURCE 700
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pff.h"
+#include "diskio_file.h"
+
+/* -- Image geometry ------------------------------------------------- */
+
+#define RSVD_SECT   32          /**< Reserved sectors before the FAT */
+#define N_CLUST     66000UL     /**< Data clusters (FAT32 needs > 65524) */
+#define FILE_CLUST  3           /**< First cluster of DATA.TXT (2 = root dir) */
+
+/** @brief Layout of a generated image. */
+typedef struct {
+    DWORD fat_sect;             /**< First FAT sector */
+    DWORD fat_size;             /**< Sectors per FAT */
+    DWORD data_sect;            /**< First data sector (cluster 2) */
+    BYTE  csize;                /**< Sectors per cluster */
+} layout_t;
+
+/** @brief Benchmark options. */
+typedef struct {
+    const char *image;          /**< Image file path */
+    DWORD log_bytes;            /**< Size of DATA.TXT */
+    UINT extents;               /**< Number of fragments of DATA.TXT */
+    UINT flush_lines;           /**< Staged mode: partial flush interval (0 = off) */
+    disk_model_t model;         /**< Card latency model */
+} options_t;
+
+/** @brief Result of one replay. */
+typedef struct {
+    disk_stats_t disk;          /**< Backend counters */
+    DWORD bytes;                /**< Payload bytes logged */
+    uint64_t worst_ns;          /**< Worst single pf_write() call */
+    uint64_t open_ns;           /**< pf_open() time */
+    uint32_t open_fat;          /**< FAT sector reads of pf_open() */
+    uint64_t seek_ns;           /**< pf_lseek() to the end after a remount */
+    uint32_t seek_fat;          /**< FAT sector reads of that seek */
+} result_t;
+
+
+static void st_word(BYTE *p, WORD v)  { p[0] = (BYTE)v; p[1] = (BYTE)(v >> 8); }
+static void st_dword(BYTE *p, DWORD v) { st_word(p, (WORD)v); st_word(p + 2, (WORD)(v >> 16)); }
+
+/** @brief Write one sector of the image. */
+static int put_sect(int fd, DWORD sect, const BYTE *buf)
+{
+    return pwrite(fd, buf, 512, (off_t)sect * 512) == 512 ? 0 : -1;
+}
+
+/**
+ * @brief  Create a sparse FAT32 image with a pre-allocated DATA.TXT.
+ * @param  opt   Benchmark options (path, file size, fragmentation).
+ * @param  csize Sectors per cluster.
+ * @param  lay   Returns the layout of the image.
+ * @return 0 on success, -1 on I/O error.
+ */
+static int make_image(const options_t *opt, BYTE csize, layout_t *lay)
+{
+    BYTE buf[512];
+    DWORD n_file, per_ext, cl, next, sect, fat_buf_sect;
+    DWORD fat[128];
+    UINT i;
+    int fd;
+
+    lay->csize = csize;
+    lay->fat_sect = RSVD_SECT;
+    lay->fat_size = ((N_CLUST + 2) * 4 + 511) / 512;
+    lay->data_sect = RSVD_SECT + 2 * lay->fat_size;
+
+    fd = open(opt->image, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, (off_t)(lay->data_sect + N_CLUST * csize) * 512)) goto fail;
+
+    /* Boot sector with FAT32 BPB */
+    memset(buf, 0, sizeof(buf));
+    buf[0] = 0xEB; buf[1] = 0x58; buf[2] = 0x90;
+    memcpy(&buf[3], "MSWIN4.1", 8);
+    st_word(&buf[11], 512);                         /* BPB_BytsPerSec */
+    buf[13] = csize;                                /* BPB_SecPerClus */
+    st_word(&buf[14], RSVD_SECT);                   /* BPB_RsvdSecCnt */
+    buf[16] = 2;                                    /* BPB_NumFATs */
+    buf[21] = 0xF8;                                 /* BPB_Media */
+    st_dword(&buf[32], lay->data_sect + N_CLUST * csize);  /* BPB_TotSec32 */
+    st_dword(&buf[36], lay->fat_size);              /* BPB_FATSz32 */
+    st_dword(&buf[44], 2);                          /* BPB_RootClus */
+    buf[66] = 0x29;
+    memcpy(&buf[71], "NO NAME    ", 11);
+    memcpy(&buf[82], "FAT32   ", 8);                /* BS_FilSysType32 */
+    st_word(&buf[510], 0xAA55);
+    if (put_sect(fd, 0, buf)) goto fail;
+
+    /* Root directory (cluster 2) with a single entry */
+    memset(buf, 0, sizeof(buf));
+    memcpy(&buf[0], "DATA    TXT", 11);
+    buf[11] = AM_ARC;
+    st_word(&buf[20], (WORD)(FILE_CLUST >> 16));
+    st_word(&buf[26], (WORD)FILE_CLUST);
+    st_dword(&buf[28], opt->log_bytes);
+    if (put_sect(fd, lay->data_sect, buf)) goto fail;
+
+    /* FAT chain: root dir, then the file split into extents with one free cluster between them */
+    n_file = (opt->log_bytes + (DWORD)csize * 512 - 1) / ((DWORD)csize * 512);
+    per_ext = (n_file + opt->extents - 1) / opt->extents;
+    memset(fat, 0, sizeof(fat));
+    fat_buf_sect = 0;
+    fat[0] = 0x0FFFFFF8; fat[1] = 0x0FFFFFFF; fat[2] = 0x0FFFFFFF;
+
+    cl = FILE_CLUST;
+    for (i = 1; i <= n_file; i++) {
+        next = (i == n_file) ? 0x0FFFFFFF : (i % per_ext ? cl + 1 : cl + 2);
+        sect = cl / 128;
+        if (sect != fat_buf_sect) {                 /* Flush the FAT sector (both copies) */
+            if (put_sect(fd, lay->fat_sect + fat_buf_sect, (BYTE*)fat) ||
+                put_sect(fd, lay->fat_sect + lay->fat_size + fat_buf_sect, (BYTE*)fat)) goto fail;
+            memset(fat, 0, sizeof(fat));
+            fat_buf_sect = sect;
+        }
+        fat[cl % 128] = next;                       /* Host is little-endian */
+        cl = (next < N_CLUST + 2) ? next : cl;
+    }
+    if (put_sect(fd, lay->fat_sect + fat_buf_sect, (BYTE*)fat) ||
+        put_sect(fd, lay->fat_sect + lay->fat_size + fat_buf_sect, (BYTE*)fat)) goto fail;
+
+    close(fd);
+    return 0;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+/** @brief Format the n-th line the way sd_log_append_line() does. */
+static UINT make_line(char *buf, DWORD n)
+{
+    DWORD s = n % 86400UL;
+    return (UINT)sprintf(buf, "%02d:%02d:%02d, %d.%02d, %d.%02d, %d.%02d, %u\r\n",
+                         (int)(s / 3600), (int)(s / 60 % 60), (int)(s % 60),
+                         21 + (int)(n % 7), (int)(n * 37 % 100),
+                         1013 + (int)(n % 11) - 5, (int)(n * 53 % 100),
+                         45 + (int)(n % 13), (int)(n * 71 % 100),
+                         (unsigned)(n * 13 % 101));
+}
+
+/** @brief pf_write() wrapper that tracks the worst call latency. */
+static FRESULT timed_write(const void *buf, UINT n, result_t *r)
+{
+    uint64_t t0 = disk_stats.now_ns;
+    UINT bw;
+    FRESULT res = pf_write(buf, n, &bw);
+
+    if (disk_stats.now_ns - t0 > r->worst_ns) r->worst_ns = disk_stats.now_ns - t0;
+    if (res == FR_OK && bw < n) res = FR_DISK_ERR;  /* End of the pre-allocated file */
+    return res;
+}
+
+/**
+ * @brief  Replay the logger workload until the file is full.
+ * @param  staged 0: one pf_write() per line, 1: 512 B staging buffer.
+ * @param  opt    Benchmark options.
+ * @param  r      Returns the counters of the run.
+ * @return FRESULT of the first failing call, FR_OK at end of file.
+ */
+static FRESULT replay(int staged, const options_t *opt, result_t *r)
+{
+    static FATFS fs;
+    BYTE stage[512];
+    char line[64];
+    UINT len, fill = 0, take;
+    DWORD n = 0;
+    FRESULT res;
+
+    if ((res = pf_mount(&fs)) != FR_OK) return res;
+    memset(&disk_stats, 0, sizeof(disk_stats));
+    if ((res = pf_open("DATA.TXT")) != FR_OK) return res;
+    r->open_ns = disk_stats.now_ns;
+    r->open_fat = disk_stats.fat_reads;
+    memset(&disk_stats, 0, sizeof(disk_stats));     /* Measure the logging separately */
+
+    for (;;) {
+        /* Stop one line short of the end of the file (staged data starts at the sector start) */
+        if ((staged ? fs.fptr - fs.fptr % 512 + fill : fs.fptr) + sizeof(line) > fs.fsize) break;
+        len = make_line(line, n++);
+        if (!staged) {
+            if ((res = timed_write(line, len, r)) != FR_OK) return res;
+        } else {
+            pf_write_pending();                     /* sd_log_poll() between samples */
+            take = (len < 512 - fill) ? len : 512 - fill;
+            memcpy(&stage[fill], line, take);
+            fill += take;
+            if (fill == 512) {
+                if ((res = timed_write(stage, 512, r)) != FR_OK) return res;
+                fill = len - take;
+                memcpy(stage, line + take, fill);
+            } else if (opt->flush_lines && n % opt->flush_lines == 0) {
+                /* Partial flush: the sector is rewritten from its start later */
+                if ((res = timed_write(stage, fill, r)) != FR_OK) return res;
+                if ((res = timed_write(0, 0, r)) != FR_OK) return res;
+            }
+        }
+        r->bytes += len;
+    }
+    if (staged && fill) timed_write(stage, fill, r);
+    timed_write(0, 0, r);
+    while (pf_write_pending()) disk_file_idle(10);   /* sd_log_stop() */
+    pf_mount(NULL);
+    r->disk = disk_stats;
+
+    /* Resume: remount, open and seek to the end of the file */
+    if ((res = pf_mount(&fs)) != FR_OK || (res = pf_open("DATA.TXT")) != FR_OK) return res;
+    memset(&disk_stats, 0, sizeof(disk_stats));
+    if ((res = pf_lseek(fs.fsize)) != FR_OK) return res;
+    r->seek_ns = disk_stats.now_ns;
+    r->seek_fat = disk_stats.fat_reads;
+    pf_mount(NULL);
+    return FR_OK;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-m log_kB] [-c csize] [-x extents] [-F flush_lines] [-o image]\n"
+        "          [-C cmd_us] [-B byte_ns] [-W busy_us] [-S stream_busy_us]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const BYTE default_csize[] = {1, 8, 64};
+    BYTE csizes[8];
+    UINT n_cs = 0, i;
+    options_t opt = {
+        .image = "pffbench.img",
+        .log_bytes = 1024UL * 1024,
+        .extents = 1,
+        .flush_lines = 10,                          /* SDLOG_FLUSH_MS at 1 Hz sampling */
+        .model = { .cmd_us = 20, .byte_ns = 1000, .busy_us = 800, .stream_busy_us = 250 },
+    };
+    int c, staged;
+
+    while ((c = getopt(argc, argv, "m:c:x:F:o:C:B:W:S:h")) != -1) {
+        switch (c) {
+        case 'm': opt.log_bytes = strtoul(optarg, 0, 0) * 1024; break;
+        case 'c': if (n_cs < sizeof(csizes)) csizes[n_cs++] = (BYTE)strtoul(optarg, 0, 0); break;
+        case 'x': opt.extents = (UINT)strtoul(optarg, 0, 0); break;
+        case 'F': opt.flush_lines = (UINT)strtoul(optarg, 0, 0); break;
+        case 'o': opt.image = optarg; break;
+        case 'C': opt.model.cmd_us = (uint32_t)strtoul(optarg, 0, 0); break;
+        case 'B': opt.model.byte_ns = (uint32_t)strtoul(optarg, 0, 0); break;
+        case 'W': opt.model.busy_us = (uint32_t)strtoul(optarg, 0, 0); break;
+        case 'S': opt.model.stream_busy_us = (uint32_t)strtoul(optarg, 0, 0); break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (!n_cs) { memcpy(csizes, default_csize, sizeof(default_csize)); n_cs = sizeof(default_csize); }
+    if (!opt.extents) opt.extents = 1;
+
+    printf("log %lu kB, %u extent(s), model: cmd %u us, byte %u ns, busy %u/%u us\n\n",
+           (unsigned long)(opt.log_bytes / 1024), opt.extents, opt.model.cmd_us,
+           opt.model.byte_ns, opt.model.busy_us, opt.model.stream_busy_us);
+    printf("csize  mode     sectors/s   kB/s   FAT rd/MB  sessions  worst write [ms]"
+           "  open [ms] (FAT rd)  seek end [ms] (FAT rd)\n");
+
+    for (i = 0; i < n_cs; i++) {
+        layout_t lay;
+
+        if (csizes[i] == 0 || (csizes[i] & (csizes[i] - 1)) || csizes[i] > 128) {
+            fprintf(stderr, "csize must be a power of 2 up to 128\n");
+            return 2;
+        }
+        for (staged = 0; staged < 2; staged++) {
+            result_t r;
+            FRESULT res;
+            double sec, mb;
+
+            memset(&r, 0, sizeof(r));
+            if (make_image(&opt, csizes[i], &lay) ||
+                disk_file_open(opt.image, &opt.model, lay.fat_sect, lay.data_sect)) {
+                perror(opt.image);
+                return 1;
+            }
+            res = replay(staged, &opt, &r);
+            disk_file_close();
+            if (res != FR_OK) {
+                fprintf(stderr, "csize %u: pff error %d\n", csizes[i], (int)res);
+                return 1;
+            }
+
+            sec = r.disk.now_ns / 1e9;
+            mb = r.bytes / (1024.0 * 1024.0);
+            printf("%5u  %-7s %10.0f %7.1f %10.1f %9lu %17.3f %10.3f %9lu %14.3f %9lu\n",
+                   csizes[i], staged ? "staged" : "direct",
+                   r.disk.sectors / sec, r.bytes / 1024.0 / sec,
+                   r.disk.fat_reads / mb, (unsigned long)r.disk.sessions,
+                   r.worst_ns / 1e6,
+                   r.open_ns / 1e6, (unsigned long)r.open_fat,
+                   r.seek_ns / 1e6, (unsigned long)r.seek_fat);
+        }
+    }
+    unlink(opt.image);
+    return 0;
+}
@@ -0,0 +1,176 @@
+# Decoder for the binary SD log format (DATA.BIN) written by lib/sdlog
+# with SDLOG_FORMAT_BINARY.
+#
+# Every 512-byte sector starts with a 10-byte header followed by up to
+# 27 fixed-size records, so record k is always found at
+#   sector k // RECS_PER_SECT, offset HDR_SIZE + (k % RECS_PER_SECT) * REC_SIZE
+#
+# A sector is valid when its CRC matches and its sequence number is the
+# one of sector 0 plus its index. Valid sectors form a prefix of the file;
+# the first invalid one (erased, torn by a power loss or left over from an
+# older session) marks the end of the log.
+import datetime as dt
+
+import numpy as np
+
+SECTOR_SIZE = 512
+MAGIC = b"DL"
+VERSION = 5
+
+HEADER_DTYPE = np.dtype([
+    ("magic", "S2"),
+    ("version", "u1"),
+    ("count", "u1"),
+    ("seq", "<u4"),
+    ("crc", "<u2"),     # CRC-16/CCITT of the sector without this field
+])
+
+RECORD_DTYPE = np.dtype([
+    ("time", "<u4"),    # seconds since 2000-01-01 00:00:00 (RTC local time)
+    ("ms", "<u2"),      # milliseconds of the second
+    ("temp", "<i2"),    # 0.01 degC
+    ("hum", "<u2"),     # 0.01 %RH
+    ("press", "<u4"),   # Pa
+    ("light", "<u2"),   # %
+    ("batt", "<u2"),    # mV
+])
+
+HDR_SIZE = HEADER_DTYPE.itemsize
+REC_SIZE = RECORD_DTYPE.itemsize
+RECS_PER_SECT = (SECTOR_SIZE - HDR_SIZE) // REC_SIZE
+CRC_OFS = HEADER_DTYPE.fields["crc"][1]
+
+
+def sector_crc(sectors):
+    """
+    CRC-16/CCITT (avr-libc _crc_ccitt_update, init 0xFFFF) of each row of
+    an (n, 512) uint8 array, skipping the CRC field. Rows are processed in
+    parallel, one byte column at a time.
+    """
+    crc = np.full(len(sectors), 0xFFFF, dtype=np.uint16)
+    for i in range(SECTOR_SIZE):
+        if CRC_OFS <= i < CRC_OFS + 2:
+            continue
+        data = sectors[:, i] ^ (crc & 0xFF).astype(np.uint8)
+        data ^= data << 4
+        d16 = data.astype(np.uint16)
+        crc = ((d16 << 8) | (crc >> 8)) ^ (data >> 4) ^ (d16 << 3)
+    return crc
+
+
+def sector_headers(sectors):
+    """Headers of an (n, 512) uint8 array as an array of HEADER_DTYPE."""
+    return sectors[:, :HDR_SIZE].copy().view(HEADER_DTYPE).reshape(len(sectors))
+
+
+def valid_sectors(sectors, seq0=None):
+    """
+    Boolean mask of the sectors that pass the header and CRC checks and,
+    when seq0 is given, carry sequence number seq0 + row index.
+    """
+    n_sect = len(sectors)
+    headers = sector_headers(sectors)
+    ok = (headers["magic"] == MAGIC) & (headers["version"] == VERSION)
+    ok &= headers["count"] <= RECS_PER_SECT
+    ok &= headers["crc"] == sector_crc(sectors)
+    if seq0 is not None:
+        ok &= headers["seq"] == (seq0 + np.arange(n_sect, dtype=np.uint64)) % 2 ** 32
+    return ok
+
+
+def find_end(path):
+    """
+    Number of valid sectors at the top of a binary log, found by binary
+    search so only about log2(file sectors) sectors are read.
+    """
+    def read_sector(fh, index):
+        fh.seek(index * SECTOR_SIZE)
+        buf = fh.read(SECTOR_SIZE)
+        if len(buf) < SECTOR_SIZE:
+            return None
+        return np.frombuffer(buf, dtype=np.uint8).reshape(1, SECTOR_SIZE)
+
+    with open(path, "rb") as fh:
+        fh.seek(0, 2)
+        n_sect = fh.tell() // SECTOR_SIZE
+        first = read_sector(fh, 0)
+        if first is None or not valid_sectors(first)[0]:
+            return 0
+        seq0 = int(sector_headers(first)["seq"][0])
+
+        lo, hi = 1, n_sect              # first invalid sector lies in [lo, hi]
+        while lo < hi:
+            mid = (lo + hi) // 2
+            sect = read_sector(fh, mid)
+            if sect is not None and valid_sectors(sect, seq0 + mid)[0]:
+                lo = mid + 1
+            else:
+                hi = mid
+        return lo
+
+
+def load_records(path):
+    """
+    Load all valid records of a binary log into a numpy structured array
+    (dtype RECORD_DTYPE).
+
+    Reading stops at the first invalid sector, which is the erased remainder
+    of a pre-allocated file or a sector torn by a power loss.
+    """
+    raw = np.fromfile(path, dtype=np.uint8)
+    n_sect = len(raw) // SECTOR_SIZE
+    sectors = raw[:n_sect * SECTOR_SIZE].reshape(n_sect, SECTOR_SIZE)
+    if n_sect == 0:
+        return np.zeros(0, dtype=RECORD_DTYPE)
+
+    headers = sector_headers(sectors)
+    valid = valid_sectors(sectors, int(headers["seq"][0]))
+    # Logged data is one contiguous run from the top of the file
+    n_valid = int(np.argmin(valid)) if not valid.all() else n_sect
+    counts = headers["count"][:n_valid]
+
+    body = sectors[:n_valid, HDR_SIZE:HDR_SIZE + RECS_PER_SECT * REC_SIZE]
+    recs = body.copy().view(RECORD_DTYPE).reshape(n_valid, RECS_PER_SECT)
+    used = np.arange(RECS_PER_SECT)[None, :] < counts[:, None]
+    return recs[used]
+
+
+def read_record(path, index):
+    """Read a single record by its index without loading the whole file."""
+    sect, slot = divmod(index, RECS_PER_SECT)
+    with open(path, "rb") as fh:
+        fh.seek(sect * SECTOR_SIZE)
+        buf = fh.read(SECTOR_SIZE)
+        if len(buf) < SECTOR_SIZE:
+            raise IndexError(f"record {index} is not in the log")
+    sector = np.frombuffer(buf, dtype=np.uint8).reshape(1, SECTOR_SIZE)
+    if not valid_sectors(sector)[0] or slot >= sector_headers(sector)["count"][0]:
+        raise IndexError(f"record {index} is not in the log")
+    return np.frombuffer(buf, dtype=RECORD_DTYPE, count=1, offset=HDR_SIZE + slot * REC_SIZE)[0]
+
+
+def parse_bin_file(path):
+    """
+    Same output as parse_txt_file() in ui/main_window.py:
+
+      times: numpy array of POSIX epoch seconds (float)
+      data: dict with keys 'temperature','pressure','humidity','light','battery'
+    """
+    recs = load_records(path)
+
+    # The RTC keeps local time like the text log, so the UTC offset of each
+    # record's own date applies (DST). It is looked up once per hour of log:
+    # transitions fall on whole hours.
+    epoch = dt.datetime(2000, 1, 1)
+    hours, inv = np.unique(recs["time"] // 3600, return_inverse=True)
+    base = np.array([(epoch + dt.timedelta(hours=int(h))).timestamp() for h in hours])
+    times = base[inv] + recs["time"] % 3600 + recs["ms"] / 1000.0
+
+    data = {
+        "temperature": recs["temp"] / 100.0,
+        "pressure": recs["press"] / 100.0,   # Pa -> hPa
+        "humidity": recs["hum"] / 100.0,
+        "light": recs["light"].astype(np.float64),
+        "battery": recs["batt"] / 1000.0,    # mV -> V
+    }
+    return times, data
@@ -0,0 +1,137 @@
+# Checks that a binary log (DATA.BIN) and a text log of the same samples
+# decode to the same timestamps, including across DST changes.
+#
+# Run from this directory:
+#   python -m unittest test_binlog
+import datetime as dt
+import os
+import sys
+import tempfile
+import time
+import types
+import unittest
+
+import numpy as np
+
+import binlog
+
+
+def _stub_gui_modules():
+    """Let ui.main_window import without PySide6/pyqtgraph (parser only)."""
+    class Stub(types.ModuleType):
+        def __getattr__(self, name):
+            if name.startswith("__"):
+                raise AttributeError(name)
+            if name == "Slot":
+                return lambda *a, **k: (lambda f: f)
+            return type(name, (), {"__init__": lambda self, *a, **k: None})
+
+    for name in ("PySide6", "PySide6.QtWidgets", "PySide6.QtCore", "pyqtgraph"):
+        try:
+            __import__(name)
+        except ImportError:
+            sys.modules[name] = Stub(name)
+            sys.modules[name].__path__ = []
+
+
+_stub_gui_modules()
+from ui.main_window import parse_txt_file  # noqa: E402
+
+# Local times around the DST changes of 2025 in central Europe
+SAMPLES = [
+    dt.datetime(2025, 3, 29, 23, 59, 59, 500000),
+    dt.datetime(2025, 3, 30, 1, 59, 59, 250000),
+    dt.datetime(2025, 3, 30, 3, 0, 0, 0),
+    dt.datetime(2025, 3, 30, 12, 0, 0, 125000),
+    dt.datetime(2025, 7, 1, 12, 0, 0, 0),
+    dt.datetime(2025, 10, 26, 1, 30, 0, 0),
+    dt.datetime(2025, 10, 26, 3, 30, 0, 999000),
+    dt.datetime(2025, 10, 27, 0, 0, 0, 0),
+]
+
+
+def write_bin_log(path, samples):
+    """Write samples as lib/sdlog binary records, several sectors."""
+    per_sect = 3                        # Partly filled sectors, like after flushes
+    chunks = [samples[i:i + per_sect] for i in range(0, len(samples), per_sect)]
+    sectors = np.zeros((len(chunks) + 1, binlog.SECTOR_SIZE), dtype=np.uint8)
+    epoch = dt.datetime(2000, 1, 1)
+
+    for n, chunk in enumerate(chunks):
+        hdr = np.zeros(1, dtype=binlog.HEADER_DTYPE)
+        hdr["magic"] = binlog.MAGIC
+        hdr["version"] = binlog.VERSION
+        hdr["count"] = len(chunk)
+        hdr["seq"] = 100 + n
+        recs = np.zeros(len(chunk), dtype=binlog.RECORD_DTYPE)
+        for r, t in zip(recs, chunk):
+            r["time"] = (t.replace(microsecond=0) - epoch) // dt.timedelta(seconds=1)
+            r["ms"] = t.microsecond // 1000
+            r["temp"] = 2150
+            r["hum"] = 4500
+            r["press"] = 101325
+            r["light"] = 50
+            r["batt"] = 3700
+        sect = sectors[n]
+        sect[:binlog.HDR_SIZE] = np.frombuffer(hdr.tobytes(), dtype=np.uint8)
+        body = np.frombuffer(recs.tobytes(), dtype=np.uint8)
+        sect[binlog.HDR_SIZE:binlog.HDR_SIZE + len(body)] = body
+        crc = binlog.sector_crc(sectors[n:n + 1])[0]
+        sect[binlog.CRC_OFS:binlog.CRC_OFS + 2] = np.frombuffer(
+            np.array([crc], dtype="<u2").tobytes(), dtype=np.uint8)
+    sectors.tofile(path)                # Last sector erased: end of the log
+
+
+def write_txt_log(path, samples):
+    """Write samples as a day-rotated text log (one '# date' line per day)."""
+    day = None
+    with open(path, "w", encoding="utf-8") as fh:
+        for t in samples:
+            if t.date() != day:
+                day = t.date()
+                fh.write(f"# {day:%Y-%m-%d}\n")
+            fh.write(f"{t:%H:%M:%S}.{t.microsecond // 1000:03d}, 21.50, 1013.25, 45.00, 50, 3.700\n")
+
+
+class BinTxtTimestampTest(unittest.TestCase):
+    def setUp(self):
+        self._tz = os.environ.get("TZ")
+        os.environ["TZ"] = "Europe/Prague"
+        time.tzset()
+        self._dir = tempfile.TemporaryDirectory()
+
+    def tearDown(self):
+        self._dir.cleanup()
+        if self._tz is None:
+            del os.environ["TZ"]
+        else:
+            os.environ["TZ"] = self._tz
+        time.tzset()
+
+    def test_same_times_across_dst(self):
+        bin_path = os.path.join(self._dir.name, "DATA.BIN")
+        txt_path = os.path.join(self._dir.name, "DATA.TXT")
+        write_bin_log(bin_path, SAMPLES)
+        write_txt_log(txt_path, SAMPLES)
+
+        bin_times, bin_data = binlog.parse_bin_file(bin_path)
+        txt_times, txt_data = parse_txt_file(txt_path)
+
+        self.assertEqual(len(bin_times), len(SAMPLES))
+        np.testing.assert_allclose(bin_times, txt_times, rtol=0, atol=1e-6)
+        np.testing.assert_allclose(bin_times, [t.timestamp() for t in SAMPLES], rtol=0, atol=1e-6)
+        for key in ("temperature", "pressure", "humidity", "light", "battery"):
+            np.testing.assert_allclose(bin_data[key], txt_data[key], rtol=1e-9)
+
+    def test_displayed_local_time(self):
+        bin_path = os.path.join(self._dir.name, "DATA.BIN")
+        write_bin_log(bin_path, SAMPLES)
+
+        bin_times, _ = binlog.parse_bin_file(bin_path)
+        shown = [dt.datetime.fromtimestamp(float(t)) for t in bin_times]
+        self.assertEqual([s.replace(microsecond=0) for s in shown],
+                         [t.replace(microsecond=0) for t in SAMPLES])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -3,6 +3,7 @@ from PySide6.QtWidgets import QMainWindow, QWidget, QHBoxLayout, QVBoxLayout, QL
 from PySide6.QtCore import Slot
 from ui.panels.sidebar import Sidebar
 from ui.realtime_plot import RealtimePlotWidget
+from binlog import parse_bin_file
 
 # Simple parser for the TXT format specified by the user.
 import datetime as dt
@@ -14,13 +15,14 @@ def parse_txt_file(path):
 
     Returns:
       times: list of POSIX epoch seconds (float)
-      data: dict with keys 'temperature','pressure','humidity','light' each mapping to list of floats
+      data: dict with keys 'temperature','pressure','humidity','light','battery' each mapping to list of floats
     """
     times = []
     temps = []
     pressures = []
     hums = []
     lights = []
+    batts = []
 
     with open(path, "r", encoding="utf-8") as fh:
         lines = fh.readlines()
@@ -33,6 +35,12 @@ def parse_txt_file(path):
         if not ln:
             continue
         if ln.startswith("#"):
+            # "# YYYY-MM-DD" starts a file of a day-rotated log set
+            try:
+                base_date = dt.datetime.strptime(ln[1:].strip(), "%Y-%m-%d").date()
+                prev_dt = None
+            except ValueError:
+                pass
             continue
 
         parts = [p.strip() for p in ln.split(",")]
@@ -43,7 +51,9 @@ def parse_txt_file(path):
 
         time_str = parts[0]
         try:
-            t = dt.datetime.strptime(time_str, "%H:%M:%S").time()
+            # HH:MM:SS.mmm; logs written before millisecond timestamps lack the fraction
+            fmt = "%H:%M:%S.%f" if "." in time_str else "%H:%M:%S"
+            t = dt.datetime.strptime(time_str, fmt).time()
         except Exception:
             # skip lines that don't start with time in expected format
             continue
@@ -69,12 +79,15 @@ def parse_txt_file(path):
         pressures.append(to_float(parts[2]))
         hums.append(to_float(parts[3]))
         lights.append(to_float(parts[4]))
+        # battery column was added later; older logs have none
+        batts.append(to_float(parts[5]) if len(parts) > 5 else float('nan'))
 
     data = {
         'temperature': temps,
         'pressure': pressures,
         'humidity': hums,
-        'light': lights
+        'light': lights,
+        'battery': batts
     }
 
     return times, data
@@ -109,16 +122,20 @@ class MainWindow(QMainWindow):
 
     @Slot()
     def open_txt(self):
-        path, _ = QFileDialog.getOpenFileName(self, "Select TXT file", "", "Text files (*.txt);;All files (*)")
+        path, _ = QFileDialog.getOpenFileName(self, "Select log file", "",
+                                              "Log files (*.txt *.bin);;Text files (*.txt);;Binary logs (*.bin);;All files (*)")
         if not path:
             return
         try:
-            times_s, data = parse_txt_file(path)
+            if path.lower().endswith(".bin"):
+                times_s, data = parse_bin_file(path)
+            else:
+                times_s, data = parse_txt_file(path)
         except Exception as e:
             QMessageBox.critical(self, "Parsing error", f"Failed to parse file:\\n{e}")
             return
 
-        if not times_s or not data:
+        if len(times_s) == 0 or not data:
             QMessageBox.information(self, "No data", "No valid data found in the file.")
             return
 
@@ -131,6 +148,6 @@ class MainWindow(QMainWindow):
     @Slot()
     def on_selection_changed(self):
         # Redraw using previously loaded data
-        if not self._times or not self._data:
+        if len(self._times) == 0 or not self._data:
             return
         self.plot.set_data(self._times, self._data, self.sidebar.get_selected_channels())
@@ -39,6 +39,7 @@ class Sidebar(QFrame):
         self.cb_pressure = QCheckBox("Pressure")
         self.cb_humidity = QCheckBox("Humidity")
         self.cb_light = QCheckBox("Light")
+        self.cb_battery = QCheckBox("Battery")
 
         # Default selected option
         self.cb_temp.setChecked(True)
@@ -48,9 +49,10 @@ class Sidebar(QFrame):
         self.cb_pressure.stateChanged.connect(self._exclusive_select)
         self.cb_humidity.stateChanged.connect(self._exclusive_select)
         self.cb_light.stateChanged.connect(self._exclusive_select)
+        self.cb_battery.stateChanged.connect(self._exclusive_select)
 
         # Also connect to external selection_changed signal
-        for cb in [self.cb_temp, self.cb_pressure, self.cb_humidity, self.cb_light]:
+        for cb in [self.cb_temp, self.cb_pressure, self.cb_humidity, self.cb_light, self.cb_battery]:
             cb.stateChanged.connect(self.selection_changed)
             box_layout.addWidget(cb)
 
@@ -67,7 +69,7 @@ class Sidebar(QFrame):
 
         sender = self.sender()
 
-        for cb in [self.cb_temp, self.cb_pressure, self.cb_humidity, self.cb_light]:
+        for cb in [self.cb_temp, self.cb_pressure, self.cb_humidity, self.cb_light, self.cb_battery]:
             if cb is not sender:
                 cb.blockSignals(True)
                 cb.setChecked(False)
@@ -83,4 +85,6 @@ class Sidebar(QFrame):
             return ['humidity']
         if self.cb_light.isChecked():
             return ['light']
+        if self.cb_battery.isChecked():
+            return ['battery']
         return []
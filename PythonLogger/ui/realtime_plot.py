@@ -7,7 +7,8 @@ CHANNEL_META = {
     "temperature": ("Temperature", "°C"),
     "pressure": ("Pressure", "hPa"),
     "humidity": ("Humidity", "%"),
-    "light": ("Light", "%")
+    "light": ("Light", "%"),
+    "battery": ("Battery", "V")
 }
 
 class TimeAxisItem(pg.AxisItem):
@@ -88,7 +89,7 @@ class RealtimePlotWidget(QWidget):
                 self._curves[key] = curve
 
         # autoscale x to full data and add small margins
-        if times_epoch_s:
+        if len(times_epoch_s):
             try:
                 xmin = min(times_epoch_s)
                 xmax = max(times_epoch_s)
@@ -102,5 +103,6 @@ class RealtimePlotWidget(QWidget):
             "pressure":    "#00FF00",  # green
             "humidity":    "#0000FF",  # blue
             "light":       "#FFA500",  # orange
+            "battery":     "#FF00FF",  # magenta
         }
         return fixed_colors.get(key, "#FFFFFF")  # default white